@@ -12,7 +12,14 @@ extern "C" {
 
 #define PIPER2_OK 0
 #define PIPER2_DONE 1
+#define PIPER2_AGAIN 2
 #define PIPER2_ERR_GENERIC -1
+#define PIPER2_ERR_BUSY -2
+#define PIPER2_ERR_CANCELLED -3
+
+#define PIPER2_PRIORITY_INTERACTIVE 0
+#define PIPER2_PRIORITY_NORMAL 1
+#define PIPER2_PRIORITY_BULK 2
 
 /**
  * \brief Text-to-speech synthesizer.
@@ -92,6 +99,204 @@ typedef struct piper2_synthesize_options {
   float noise_w_scale;
 } piper2_synthesize_options;
 
+/**
+ * \brief Options for post-processing audio chunks.
+ *
+ * Post-processing runs in place on each chunk in a single vectorized pass.
+ * DC and loudness are tracked across the chunks of a request in fixed blocks
+ * of samples, so they come out the same however the audio is split into
+ * chunks. Gain follows the loudness of the preceding blocks and is ramped
+ * within each block, so it never jumps.
+ *
+ * \sa \ref piper2_create_options
+ */
+typedef struct piper2_postprocess_options {
+  /**
+   * \brief Post-process chunks before they are returned (default: false).
+   */
+  bool enabled;
+
+  /**
+   * \brief Subtract the running DC offset (default: true).
+   */
+  bool remove_dc;
+
+  /**
+   * \brief Adjust gain towards target_loudness_db (default: true).
+   */
+  bool normalize;
+
+  /**
+   * \brief Target RMS loudness of speech in dBFS (default: -20). Silence
+   * doesn't count towards the loudness estimate.
+   */
+  float target_loudness_db;
+
+  /**
+   * \brief Maximum gain in dB when normalizing (default: 12).
+   */
+  float max_gain_db;
+
+  /**
+   * \brief When normalizing, gain is reduced so the loudest sample so far
+   * stays under this level (default: 0.95). Samples are always clamped to
+   * [-1, 1].
+   */
+  float peak_limit;
+
+  /**
+   * \brief Length of the fade in at the start and fade out at the end of
+   * each chunk in milliseconds, or 0 for none (default: 5).
+   */
+  float fade_ms;
+} piper2_postprocess_options;
+
+/**
+ * \brief Options for creating a synthesizer.
+ *
+ * \sa \ref piper2_default_create_options
+ */
+typedef struct piper2_create_options {
+  /**
+   * \brief Path to a compiled pronunciation lexicon or NULL.
+   *
+   * Words found in the lexicon skip the phonemizer and stress models.
+   * Lexicons are compiled with piper2-lexicon-build.
+   */
+  const char *lexicon_path;
+
+  /**
+   * \brief Memory-map model files read-only instead of reading them into the
+   * heap.
+   *
+   * Mapped pages are shared between processes and can be reclaimed by the
+   * kernel. Weights of models in ORT format are used directly from the
+   * mapping. onnxruntime still copies the weights of \c .onnx models (the
+   * format voices are published in) into the heap, so convert models to ORT
+   * format to get the memory savings.
+   */
+  bool map_models;
+
+  /**
+   * \brief Maximum number of characters in a sentence or 0 for no limit.
+   *
+   * Longer sentences are split at word boundaries, which bounds the size of
+   * the buffers used during inference.
+   */
+  size_t max_sentence_chars;
+
+  /**
+   * \brief Seconds without use before the phonemizer and stress models are
+   * unloaded or 0 to keep them loaded.
+   *
+   * Unloaded models are loaded again when they are next needed. Voices in a
+   * registry load them through the registry, so they stay shared between
+   * voices and counted in its memory budget.
+   */
+  float frontend_idle_unload_seconds;
+
+  /**
+   * \brief NUMA node to place model weights and inference threads on or -1
+   * for any node.
+   *
+   * Models are loaded from a thread bound to the node, so their weights are
+   * allocated in its memory and onnxruntime's threads run on its CPUs.
+   * Create one synthesizer per node to replicate a voice. Ignored if
+   * libpiper2 was built without libnuma.
+   */
+  int numa_node;
+
+  /**
+   * \brief Pad voice model inputs up to a few fixed lengths.
+   *
+   * Sentences then share a small set of input shapes, so onnxruntime can
+   * reuse its memory plans (memory patterns and the CPU arena are enabled
+   * for the voice model) and input buffers are reused. Padding is masked
+   * with the input lengths, so it doesn't change the audio's length. Costs
+   * some memory, so it's off in the low memory options.
+   */
+  bool shape_buckets;
+
+  /**
+   * \brief Precision variant of the voice model to load (e.g., \c "int8" or
+   * \c "fp16") or NULL for the model as given.
+   *
+   * The variant of \c voice.onnx is \c voice.int8.onnx next to it. If the
+   * variant doesn't exist, the model as given is loaded instead. Variants
+   * share the config of the model as given.
+   */
+  const char *voice_precision;
+
+  /**
+   * \brief Precision variant of the phonemizer model or NULL (see
+   * voice_precision).
+   */
+  const char *phonemizer_precision;
+
+  /**
+   * \brief Precision variant of the stress model or NULL (see
+   * voice_precision).
+   */
+  const char *stress_precision;
+
+  /**
+   * \brief Post-processing of audio chunks (off by default).
+   */
+  piper2_postprocess_options postprocess;
+
+  /**
+   * \brief Start no threads of its own, so the synthesizer can be used in
+   * processes forked after it was created.
+   *
+   * onnxruntime sessions are created without intra-op thread pools (each
+   * model runs on its calling thread, so parallelism comes from scheduler
+   * workers or processes) and frontend_idle_unload_seconds is ignored.
+   *
+   * \sa \ref piper2_registry_prepare_fork
+   */
+  bool fork_safe;
+} piper2_create_options;
+
+/**
+ * \brief Get the default options for creating a synthesizer.
+ *
+ * \return default create options.
+ */
+piper2_create_options piper2_default_create_options(void);
+
+/**
+ * \brief Get options for creating a synthesizer on devices with little memory.
+ *
+ * Maps models, limits sentence length and unloads the phonemizer and stress
+ * models when idle.
+ *
+ * \return low memory create options.
+ */
+piper2_create_options piper2_low_memory_create_options(void);
+
+/**
+ * \brief Get the path of the model file that is loaded for a precision
+ * variant.
+ *
+ * This is model_path with the precision before its extension (see
+ * piper2_create_options::voice_precision) if that file exists, otherwise
+ * model_path itself.
+ *
+ * \param model_path path to the model as given.
+ *
+ * \param precision precision variant (e.g., \c "int8") or NULL.
+ *
+ * \param path buffer that receives the null-terminated path.
+ *
+ * \param path_size size of the buffer in bytes.
+ *
+ * \return length of the path. If it's path_size or more, the path was
+ * truncated.
+ */
+size_t piper2_resolve_model_variant(const char *model_path,
+                                    const char *precision, char *path,
+                                    size_t path_size);
+
 /**
  * \brief Create a Piper text-to-speech synthesizer with a phonemizer and stress
  * model.
@@ -119,6 +324,22 @@ piper2_synthesizer *piper2_create_phonemizer_stress(
     const char *voice_config_path, const char *phonemizer_model_path,
     const char *phonemizer_config_path, const char *stress_model_path);
 
+/**
+ * \brief Create a Piper text-to-speech synthesizer with a phonemizer and stress
+ * model, and additional options.
+ *
+ * Arguments are the same as \ref piper2_create_phonemizer_stress.
+ *
+ * \param options create options or NULL for defaults.
+ *
+ * \return a Piper text-to-speech synthesizer or NULL on error.
+ */
+piper2_synthesizer *piper2_create_phonemizer_stress_with_options(
+    const char *locale, const char *voice_model_path,
+    const char *voice_config_path, const char *phonemizer_model_path,
+    const char *phonemizer_config_path, const char *stress_model_path,
+    const piper2_create_options *options);
+
 /**
  * \brief Free resources for Piper synthesizer.
  *
@@ -126,6 +347,46 @@ piper2_synthesizer *piper2_create_phonemizer_stress(
  */
 void piper2_free(piper2_synthesizer *synth);
 
+/**
+ * \brief Memory used by a synthesizer.
+ *
+ * \sa \ref piper2_get_memory_usage
+ */
+typedef struct piper2_memory_usage {
+  /**
+   * \brief Size of the model files currently loaded by the synthesizer.
+   */
+  size_t model_bytes;
+
+  /**
+   * \brief Resident memory of the process now.
+   */
+  size_t resident_bytes;
+
+  /**
+   * \brief Highest resident memory of the whole process seen while this
+   * synthesizer was running a model.
+   *
+   * This is process memory, not this synthesizer's share of it: with
+   * several synthesizers in a process, each reports (roughly) the same peak.
+   */
+  size_t peak_resident_bytes;
+} piper2_memory_usage;
+
+/**
+ * \brief Get memory used by a synthesizer.
+ *
+ * Resident memory is only available on Linux and is 0 elsewhere.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param usage memory usage to fill.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_get_memory_usage(piper2_synthesizer *synth,
+                            piper2_memory_usage *usage);
+
 /**
  * \brief Get the default synthesis options for a Piper synthesizer.
  *
@@ -172,6 +433,632 @@ int piper2_synthesize_start(piper2_synthesizer *synth, const char *text,
 int piper2_synthesize_next(piper2_synthesizer *synth,
                            piper2_audio_chunk *chunk);
 
+/**
+ * \brief Start synthesizing the same text for several speakers of a
+ * multi-speaker voice.
+ *
+ * The text frontend runs once per sentence, and the voice model runs once
+ * per group of speakers with identical scales, batched over their speaker
+ * ids. This costs much less than synthesizing the text once per speaker.
+ *
+ * Uses separate state from piper2_synthesize_start/piper2_synthesize_next,
+ * but not at the same time as them.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param text text to synthesize into audio.
+ *
+ * \param options array of num_speakers synthesis options, one per output
+ * stream, each with its own speaker_id (see
+ * piper2_default_synthesize_options).
+ *
+ * \param num_speakers number of output streams.
+ *
+ * \sa \ref piper2_fanout_next
+ *
+ * \return PIPER2_OK, or error code if the voice has a single speaker or a
+ * speaker_id is out of range.
+ */
+int piper2_fanout_start(piper2_synthesizer *synth, const char *text,
+                        const piper2_synthesize_options *options,
+                        size_t num_speakers);
+
+/**
+ * \brief Synthesize the next sentence for every speaker.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param chunks array of num_speakers audio chunks to fill, in the order of
+ * the options passed to piper2_fanout_start.
+ *
+ * If the voice model has a y_lengths output, each chunk is cut to its
+ * speaker's own length. Otherwise batched audio is padded to the longest
+ * speaker's sentence: that speaker's chunk is kept whole, and trailing
+ * near-silence is trimmed from the others, so their quiet tails may be
+ * shorter than when synthesized alone.
+ *
+ * Each call invalidates the memory of the previous chunks. The final chunks
+ * will have is_last = true.
+ *
+ * \sa \ref piper2_fanout_start
+ *
+ * \return PIPER2_DONE when complete, otherwise PIPER2_OK or error code.
+ */
+int piper2_fanout_next(piper2_synthesizer *synth, piper2_audio_chunk *chunks);
+
+/**
+ * \brief Predicted size and cost of synthesizing text (or one sentence of
+ * it).
+ *
+ * \sa \ref piper2_estimate
+ */
+typedef struct piper2_cost_estimate {
+  /**
+   * \brief Number of sentences (1 for a single sentence).
+   */
+  size_t num_sentences;
+
+  /**
+   * \brief Number of characters after normalization.
+   */
+  size_t num_chars;
+
+  /**
+   * \brief Predicted number of phonemes.
+   */
+  size_t num_phonemes;
+
+  /**
+   * \brief Predicted length of the audio in seconds.
+   */
+  float audio_seconds;
+
+  /**
+   * \brief Predicted CPU time to synthesize in seconds, summed over all
+   * threads.
+   */
+  float cpu_seconds;
+} piper2_cost_estimate;
+
+/**
+ * \brief Per-voice model for predicting phonemes, duration and CPU cost from
+ * the text frontend's output.
+ *
+ * A synthesizer loads its cost model from \c MODEL.onnx.cost.json next to
+ * its voice model (written by piper2-bench --calibrate) if it exists,
+ * otherwise it starts with rough defaults.
+ *
+ * \sa \ref piper2_calibrate_cost_model
+ */
+typedef struct piper2_cost_model {
+  /**
+   * \brief Phonemes per character for words that aren't in the lexicon.
+   */
+  float phonemes_per_char;
+
+  /**
+   * \brief Seconds of audio per phoneme at length scale 1.
+   */
+  float seconds_per_phoneme;
+
+  /**
+   * \brief Fixed CPU seconds per sentence.
+   */
+  float cpu_seconds_per_sentence;
+
+  /**
+   * \brief CPU seconds per character run through the phonemizer and stress
+   * models.
+   */
+  float cpu_seconds_per_char;
+
+  /**
+   * \brief CPU seconds per second of audio from the voice model.
+   */
+  float cpu_seconds_per_audio_second;
+
+  /**
+   * \brief Number of sentences the model was calibrated on (0 for the
+   * defaults).
+   */
+  size_t num_calibration_sentences;
+} piper2_cost_model;
+
+/**
+ * \brief Predict the cost of synthesizing text without synthesizing it.
+ *
+ * Only the text frontend runs (normalization, sentence segmentation and
+ * lexicon lookups), which is much cheaper than synthesis. Safe to call from
+ * multiple threads, including while the synthesizer is in use.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param text text to estimate.
+ *
+ * \param options synthesis options or NULL for defaults.
+ *
+ * \param total estimate for the whole text.
+ *
+ * \param sentences array to fill with an estimate per sentence, or NULL.
+ * total->num_sentences may be larger than max_sentences.
+ *
+ * \param max_sentences number of elements in sentences.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_estimate(piper2_synthesizer *synth, const char *text,
+                    const piper2_synthesize_options *options,
+                    piper2_cost_estimate *total,
+                    piper2_cost_estimate *sentences, size_t max_sentences);
+
+/**
+ * \brief Get the cost model used by piper2_estimate.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_get_cost_model(piper2_synthesizer *synth, piper2_cost_model *model);
+
+/**
+ * \brief Replace the cost model used by piper2_estimate.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_set_cost_model(piper2_synthesizer *synth,
+                          const piper2_cost_model *model);
+
+/**
+ * \brief Fit a cost model for this voice on this host by synthesizing texts
+ * one sentence at a time and measuring CPU time.
+ *
+ * Calibration must run on an otherwise idle process: CPU time is measured
+ * for the whole process (so ONNX Runtime's intra-op threads are included),
+ * and work from other synthesizers, schedulers or threads would be charged
+ * to the calibration sentences. The fitted model is also set on the
+ * synthesizer.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param texts texts to synthesize (a few dozen sentences of varied length).
+ *
+ * \param num_texts number of texts.
+ *
+ * \param model fitted cost model.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_calibrate_cost_model(piper2_synthesizer *synth,
+                                const char *const *texts, size_t num_texts,
+                                piper2_cost_model *model);
+
+/**
+ * \brief Pool of worker threads that synthesizes requests for many callers.
+ */
+typedef struct piper2_scheduler piper2_scheduler;
+
+/**
+ * \brief Synthesis request submitted to a scheduler.
+ */
+typedef struct piper2_request piper2_request;
+
+/**
+ * \brief Options for a scheduler.
+ *
+ * \sa \ref piper2_default_scheduler_options
+ */
+typedef struct piper2_scheduler_options {
+  /**
+   * \brief Number of worker threads.
+   *
+   * A value of 0 means one worker per hardware thread.
+   */
+  size_t num_workers;
+
+  /**
+   * \brief Maximum number of sentences waiting for a worker.
+   *
+   * New requests are refused with PIPER2_ERR_BUSY once this is reached.
+   * Bulk requests are refused once half of it is reached, leaving room for
+   * interactive requests.
+   * A value of 0 means no limit.
+   */
+  size_t max_queued_sentences;
+
+  /**
+   * \brief Maximum number of sentences of a request that may be queued or
+   * synthesized ahead of the chunk the caller is reading.
+   *
+   * Requests whose caller doesn't read chunks stop being scheduled once this
+   * is reached.
+   */
+  size_t max_sentences_ahead;
+
+  /**
+   * \brief CPUs to run worker threads on, as a Linux cpu list (e.g.,
+   * \c "0-7,16-23") or NULL for any CPU.
+   */
+  const char *cpu_list;
+
+  /**
+   * \brief NUMA node to run worker threads on or -1 for any node.
+   *
+   * Use with synthesizers created on the same node (see
+   * piper2_create_options.numa_node). Ignored if cpu_list is set or
+   * libpiper2 was built without libnuma.
+   */
+  int numa_node;
+} piper2_scheduler_options;
+
+/**
+ * \brief Get the default scheduler options.
+ *
+ * \return default scheduler options.
+ */
+piper2_scheduler_options piper2_default_scheduler_options(void);
+
+/**
+ * \brief Create a scheduler and start its worker threads.
+ *
+ * \param options scheduler options or NULL for defaults.
+ *
+ * \return a scheduler or NULL on error.
+ */
+piper2_scheduler *
+piper2_scheduler_create(const piper2_scheduler_options *options);
+
+/**
+ * \brief Stop worker threads and free resources for a scheduler.
+ *
+ * Outstanding requests are cancelled and their queued sentences dropped, so
+ * this only waits for sentences that are already running. The requests must
+ * still be freed with piper2_request_free.
+ *
+ * \param sched Piper scheduler.
+ */
+void piper2_scheduler_free(piper2_scheduler *sched);
+
+/**
+ * \brief Submit text for synthesis on the scheduler's worker threads.
+ *
+ * Sentences are ordered by priority, then the first sentence of each request
+ * ahead of the rest, then earliest deadline, then submission order.
+ *
+ * \param sched Piper scheduler.
+ *
+ * \param synth Piper synthesizer, which must outlive the request.
+ * The same synthesizer may be used by many requests at once, but not with
+ * piper2_synthesize_start/piper2_synthesize_next at the same time.
+ *
+ * \param text text to synthesize into audio.
+ *
+ * \param options synthesis options or NULL for defaults.
+ *
+ * \param priority one of the PIPER2_PRIORITY_* values (anything else is an
+ * error).
+ *
+ * \param deadline_ms milliseconds from now that the audio is needed by, or 0
+ * for no deadline.
+ *
+ * \param request receives the new request.
+ *
+ * \sa \ref piper2_request_next
+ *
+ * \return PIPER2_OK, PIPER2_ERR_BUSY if the scheduler is overloaded, or
+ * error code.
+ */
+int piper2_scheduler_submit(piper2_scheduler *sched,
+                            piper2_synthesizer *synth, const char *text,
+                            const piper2_synthesize_options *options,
+                            int priority, int64_t deadline_ms,
+                            piper2_request **request);
+
+/**
+ * \brief Get the next chunk of audio for a request, waiting until it's ready.
+ *
+ * \param request Piper request.
+ *
+ * \param chunk audio chunk to fill.
+ *
+ * Each call will fill the audio chunk, invalidating the memory of the
+ * previous chunk.
+ *
+ * \return PIPER2_DONE when complete, otherwise PIPER2_OK or error code.
+ */
+int piper2_request_next(piper2_request *request, piper2_audio_chunk *chunk);
+
+/**
+ * \brief Get the next chunk of audio for a request if it's ready, without
+ * waiting.
+ *
+ * \param request Piper request.
+ *
+ * \param chunk audio chunk to fill.
+ *
+ * Each call that returns PIPER2_OK will fill the audio chunk, invalidating the
+ * memory of the previous chunk.
+ *
+ * \sa \ref piper2_request_fd
+ *
+ * \return PIPER2_AGAIN if the next chunk isn't ready yet, PIPER2_DONE when
+ * complete, otherwise PIPER2_OK or error code.
+ */
+int piper2_request_try_next(piper2_request *request,
+                            piper2_audio_chunk *chunk);
+
+/**
+ * \brief Get a file descriptor that is readable while the request has a
+ * chunk ready.
+ *
+ * The descriptor can be added to an epoll/poll/select set. It stays readable
+ * until piper2_request_try_next returns PIPER2_AGAIN, and also becomes
+ * readable when the request is done, cancelled or fails. Do not read from or
+ * close it; it is owned by the request.
+ *
+ * An eventfd is used on Linux, with a pipe as a fallback elsewhere.
+ *
+ * \param request Piper request.
+ *
+ * \return file descriptor or -1 on error.
+ */
+int piper2_request_fd(piper2_request *request);
+
+/**
+ * \brief Stop synthesizing a request.
+ *
+ * Sentences that are already running still complete in the background, but
+ * piper2_request_next will return PIPER2_ERR_CANCELLED. The request's
+ * synthesizer is in use until piper2_request_free returns.
+ *
+ * \param request Piper request.
+ */
+void piper2_request_cancel(piper2_request *request);
+
+/**
+ * \brief Cancel a request if needed and free its resources.
+ *
+ * Waits for sentences that are already running to finish, so the request's
+ * synthesizer may be freed once this returns.
+ *
+ * \param request Piper request.
+ */
+void piper2_request_free(piper2_request *request);
+
+/**
+ * \brief Voices loaded on demand by name, within a memory budget.
+ *
+ * Voices that use the same phonemizer and stress models share a single copy
+ * of them. Voices that are not acquired are evicted in least recently used
+ * order when loading another voice would exceed the memory budget.
+ */
+typedef struct piper2_registry piper2_registry;
+
+/**
+ * \brief Create a voice registry.
+ *
+ * \param memory_budget_bytes total size of loaded voice models and the
+ * phonemizer and stress models they share to stay under, or 0 for no limit.
+ * Sizes are estimated from the model files. Voices in use
+ * are never evicted, so the budget may be exceeded if all voices are in use.
+ *
+ * \return a voice registry.
+ */
+piper2_registry *piper2_registry_create(size_t memory_budget_bytes);
+
+/**
+ * \brief Free a voice registry and all of its loaded voices.
+ *
+ * No synthesizers from the registry may be in use.
+ *
+ * \param registry Piper voice registry.
+ */
+void piper2_registry_free(piper2_registry *registry);
+
+/**
+ * \brief Make a voice available by name without loading it.
+ *
+ * Arguments are the same as \ref
+ * piper2_create_phonemizer_stress_with_options.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param name unique name of the voice.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_registry_add_voice(piper2_registry *registry, const char *name,
+                              const char *locale, const char *voice_model_path,
+                              const char *voice_config_path,
+                              const char *phonemizer_model_path,
+                              const char *phonemizer_config_path,
+                              const char *stress_model_path,
+                              const piper2_create_options *options);
+
+/**
+ * \brief Get the synthesizer for a voice, loading it if needed.
+ *
+ * The voice will not be evicted until it is released with
+ * piper2_registry_release. Do not call piper2_free on it.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param name name of the voice.
+ *
+ * \return synthesizer or NULL if the voice is unknown or failed to load.
+ */
+piper2_synthesizer *piper2_registry_acquire(piper2_registry *registry,
+                                            const char *name);
+
+/**
+ * \brief Get the synthesizer for a voice without waiting for it to load.
+ *
+ * Like piper2_registry_acquire, but a voice that isn't loaded is loaded in
+ * the background instead, for event loops that can't block. Call again
+ * later to get it.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param name name of the voice.
+ *
+ * \param synth receives the synthesizer on PIPER2_OK.
+ *
+ * \return PIPER2_OK, PIPER2_AGAIN if the voice is loading, or error code if
+ * the voice is unknown or its last load failed.
+ */
+int piper2_registry_try_acquire(piper2_registry *registry, const char *name,
+                                piper2_synthesizer **synth);
+
+/**
+ * \brief Release a synthesizer from piper2_registry_acquire.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param synth Piper synthesizer.
+ */
+void piper2_registry_release(piper2_registry *registry,
+                             piper2_synthesizer *synth);
+
+/**
+ * \brief Load a voice in the background if it isn't already loaded.
+ *
+ * Use this for voices that are likely to be acquired soon.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param name name of the voice.
+ *
+ * \return PIPER2_OK or error code if the voice is unknown.
+ */
+int piper2_registry_preload(piper2_registry *registry, const char *name);
+
+/**
+ * \brief Load and warm up every voice, then stop the registry's background
+ * thread so the process can fork workers that share the models.
+ *
+ * Every voice must have been added with fork_safe set, and the memory
+ * budget must fit all of them. Each voice synthesizes warmup_text once so
+ * onnxruntime's arenas and other caches are populated before the fork.
+ * Forked processes inherit the loaded voices copy-on-write, and should
+ * create their own schedulers (and thus worker threads) after the fork.
+ *
+ * Call with no voices in use and no schedulers running. Afterwards,
+ * piper2_registry_preload does nothing.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param warmup_text text to synthesize with each voice or NULL to skip
+ * warming up.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_registry_prepare_fork(piper2_registry *registry,
+                                 const char *warmup_text);
+
+/**
+ * \brief Get the estimated size of all loaded voice models and the
+ * phonemizer and stress models they share.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \return size in bytes.
+ */
+size_t piper2_registry_memory_used(piper2_registry *registry);
+
+/**
+ * \brief Log of synthesis requests for replaying traffic later.
+ *
+ * Each request is recorded when it finishes (or is cancelled, or refused as
+ * busy) with its text, voice, synthesis options, arrival time and the time
+ * each chunk was returned. Records are buffered, and written when the buffer
+ * fills, when a record arrives a second or more after the last write, or when
+ * the log is closed. After traffic stops, the last records stay in memory
+ * until then. See piper2_capture.hpp for the file format and piper2-replay
+ * for replaying a log.
+ */
+typedef struct piper2_capture piper2_capture;
+
+/**
+ * \brief Create a capture log, replacing the file if it exists.
+ *
+ * \param path path to the log file.
+ *
+ * \return a capture log or NULL on error.
+ */
+piper2_capture *piper2_capture_open(const char *path);
+
+/**
+ * \brief Close a capture log.
+ *
+ * No synthesizers or registries may still be capturing to it.
+ *
+ * \param capture Piper capture log.
+ */
+void piper2_capture_close(piper2_capture *capture);
+
+/**
+ * \brief Record requests to a synthesizer in a capture log.
+ *
+ * Covers piper2_synthesize_start and piper2_scheduler_submit. Set this
+ * before synthesizing.
+ *
+ * \param synth Piper synthesizer.
+ *
+ * \param capture capture log or NULL to stop capturing.
+ *
+ * \param voice_name name of the voice recorded with each request, or NULL.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_set_capture(piper2_synthesizer *synth, piper2_capture *capture,
+                       const char *voice_name);
+
+/**
+ * \brief Record requests to every voice of a registry in a capture log,
+ * using the registry's voice names.
+ *
+ * Applies to voices that are already loaded and voices loaded later. Set
+ * this before acquiring voices.
+ *
+ * \param registry Piper voice registry.
+ *
+ * \param capture capture log or NULL to stop capturing.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_registry_set_capture(piper2_registry *registry,
+                                piper2_capture *capture);
+
+/**
+ * \brief Start recording a timeline of synthesis stages in every thread.
+ *
+ * Segmentation, number formatting, phonemizer and stress runs, voice model
+ * runs, copying out audio, post-processing and time spent queued in a
+ * scheduler are recorded with their request and sentence. Events go into
+ * per-thread buffers without locking. While stopped, tracing costs a check
+ * of a flag per stage.
+ *
+ * \return PIPER2_OK or error code if libpiper2 was built without tracing
+ * (PIPER2_TRACING=OFF).
+ */
+int piper2_trace_start(void);
+
+/**
+ * \brief Stop recording trace events. Recorded events are kept until
+ * flushed.
+ */
+void piper2_trace_stop(void);
+
+/**
+ * \brief Write trace events recorded since the last flush to a Chrome trace
+ * JSON file, which can be opened in Perfetto or chrome://tracing.
+ *
+ * May be called while recording. Each thread keeps at most 65536 events
+ * between flushes; later events are dropped and counted in the trace.
+ *
+ * \param path path to the trace file, which is replaced.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_trace_flush(const char *path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,129 @@
+#ifndef PIPER2_CAPTURE_H_
+#define PIPER2_CAPTURE_H_
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Binary log of synthesis requests (see piper2_capture_open).
+//
+// All integers and floats are little endian.
+//
+// File header (24 bytes):
+//
+//   char[8] magic "PPR2CAP\0"
+//   uint32  version (1)
+//   uint32  reserved (0)
+//   uint64  capture start, microseconds since the Unix epoch
+//
+// Followed by one record per request, written when the request finishes (or
+// is refused):
+//
+//   uint32  size of the rest of the record in bytes
+//   uint64  arrival, microseconds after capture start
+//   uint8   status (CAPTURE_STATUS_*)
+//   uint8   priority (PIPER2_PRIORITY_*, or CAPTURE_NO_PRIORITY for
+//           piper2_synthesize_start)
+//   uint16  voice name length
+//   uint32  text length
+//   int32   speaker id
+//   float32 length scale
+//   float32 noise scale
+//   float32 noise w scale
+//   int64   deadline in milliseconds after arrival (0 = none)
+//   uint32  number of chunks
+//   char[]  voice name (UTF-8)
+//   char[]  text (UTF-8)
+//   per chunk:
+//     uint32  time the chunk was returned, microseconds after arrival
+//     uint32  number of samples
+//
+// Readers skip bytes in a record past the fields they know, so later
+// versions may append fields.
+
+const uint32_t CAPTURE_VERSION = 1;
+const uint8_t CAPTURE_STATUS_DONE = 0;
+const uint8_t CAPTURE_STATUS_ERROR = 1;
+const uint8_t CAPTURE_STATUS_CANCELLED = 2;
+const uint8_t CAPTURE_STATUS_REFUSED = 3; // PIPER2_ERR_BUSY, no chunks
+const uint8_t CAPTURE_NO_PRIORITY = 255;
+
+struct CapturedChunk {
+    uint32_t ready_us = 0;
+    uint32_t num_samples = 0;
+};
+
+struct CapturedRequest {
+    uint64_t arrival_us = 0;
+    uint8_t status = CAPTURE_STATUS_DONE;
+    uint8_t priority = CAPTURE_NO_PRIORITY;
+    std::string voice;
+    std::string text;
+    int32_t speaker_id = 0;
+    float length_scale = 0;
+    float noise_scale = 0;
+    float noise_w_scale = 0;
+    int64_t deadline_ms = 0;
+    std::vector<CapturedChunk> chunks;
+};
+
+struct CaptureLog {
+    uint64_t start_unix_us = 0;
+    std::vector<CapturedRequest> requests;
+};
+
+// Records are buffered and written in batches, so workers finishing requests
+// don't wait on the disk
+const std::size_t CAPTURE_FLUSH_BYTES = 64 * 1024;
+const std::chrono::milliseconds CAPTURE_FLUSH_INTERVAL{1000};
+
+struct piper2_capture {
+    // Guards pending and last_flush
+    std::mutex mutex;
+    std::string pending;
+    std::chrono::steady_clock::time_point last_flush;
+
+    // Held while writing, without mutex
+    std::mutex file_mutex;
+    std::ofstream file;
+    std::chrono::steady_clock::time_point start_time;
+
+    // Add an encoded record, writing out pending records if it's time
+    void append(const std::string &record);
+
+    // Write out pending records
+    void flush();
+};
+
+// A request being captured. Timestamps come from the steady clock so they
+// aren't affected by changes to the system time.
+struct RequestCapture {
+    piper2_capture *capture = nullptr;
+    CapturedRequest request;
+    std::chrono::steady_clock::time_point arrival;
+
+    // Start capturing a request that arrived now (no-op if capture is null).
+    // Finishes any request that was still being captured as cancelled.
+    void begin(piper2_capture *capture, const std::string &voice,
+               const char *text, uint8_t priority, int64_t deadline_ms,
+               int32_t speaker_id, float length_scale, float noise_scale,
+               float noise_w_scale);
+
+    // Record a chunk being returned to the caller
+    void add_chunk(std::size_t num_samples);
+
+    // Write the request to the log and stop capturing it
+    void end(uint8_t status);
+
+    ~RequestCapture() { end(CAPTURE_STATUS_CANCELLED); }
+};
+
+// Read a whole capture log, returning nothing if the file can't be read or
+// has the wrong magic. A truncated final record is ignored.
+std::optional<CaptureLog> read_capture_log(const std::string &path);
+
+#endif // PIPER2_CAPTURE_H_
@@ -1,16 +1,30 @@
 #ifndef PIPER2_IMPL_H_
 #define PIPER2_IMPL_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <json.hpp>
 
+#include "piper2.h"
+#include "piper2_capture.hpp"
+#include "piper2_lexicon.hpp"
+#include "piper2_mapped_file.hpp"
+#include "piper2_placement.hpp"
+#include "piper2_postprocess.hpp"
+#include "piper2_trace.hpp"
+
 #include <onnxruntime_cxx_api.h>
 
 #include <unicode/brkiter.h>
@@ -53,7 +67,40 @@ const float DEFAULT_NOISE_SCALE = 0.667f;
 const float DEFAULT_NOISE_W_SCALE = 0.8f;
 
 // onnx
-Ort::Env ort_env{ORT_LOGGING_LEVEL_WARNING, "piper2"};
+inline Ort::Env ort_env{ORT_LOGGING_LEVEL_WARNING, "piper2"};
+
+// Word whose pronunciation was found in the lexicon
+struct LexiconWord {
+    // Range of the word in the sentence's char ids
+    std::size_t char_start = 0;
+    std::size_t char_end = 0;
+
+    icu::UnicodeString phonemes;
+};
+
+// Sentence produced by the text frontend, ready for phonemization.
+struct Sentence {
+    std::vector<CharId> char_ids;
+
+    // Words that don't need the phonemizer, in order
+    std::vector<LexiconWord> lexicon_words;
+};
+
+// Settings applied to every sentence of a synthesis request.
+struct SynthesisParams {
+    float length_scale = DEFAULT_LENGTH_SCALE;
+    float noise_scale = DEFAULT_NOISE_SCALE;
+    float noise_w_scale = DEFAULT_NOISE_W_SCALE;
+    SpeakerId speaker_id = 0;
+};
+
+// Audio and debug info for a single synthesized sentence.
+struct SentenceAudio {
+    std::vector<float> samples;
+    std::string chars;
+    std::string phonemes;
+    std::vector<int> phoneme_ids;
+};
 
 struct piper2_synthesizer {
     // From voice config
@@ -76,24 +123,85 @@ struct piper2_synthesizer {
     PhonemeMap phonemizer_phoneme_map;
     icu::UnicodeString phonemizer_stress_char;
 
+    // Optional pronunciation lexicon (memory-mapped)
+    std::shared_ptr<Lexicon> lexicon;
+
+    // Sentences longer than this are split (0 = no limit)
+    std::size_t max_sentence_chars = 0;
+
     // onnx
-    std::unique_ptr<Ort::Session> voice_session;
-    std::unique_ptr<Ort::Session> phonemizer_session;
-    std::unique_ptr<Ort::Session> stress_session;
+    std::string voice_model_path; // precision variant if selected
+    std::shared_ptr<Ort::Session> voice_session;
     Ort::AllocatorWithDefaultOptions session_allocator;
     Ort::SessionOptions session_options;
     Ort::Env session_env;
+    bool map_models = false;
+    int numa_node = -1;
+
+    // Phonemizer and stress sessions are shared between voices, and may be
+    // unloaded when idle and loaded again by get_frontend_sessions.
+    // Guarded by frontend_sessions_mutex.
+    std::string phonemizer_model_path; // precision variant if selected
+    std::string stress_model_path;     // precision variant if selected
+    mutable std::shared_ptr<Ort::Session> phonemizer_session;
+    mutable std::shared_ptr<Ort::Session> stress_session;
+    mutable std::chrono::steady_clock::time_point frontend_last_used;
+    mutable std::mutex frontend_sessions_mutex;
+    mutable std::condition_variable frontend_unload_cond;
+    std::chrono::steady_clock::duration frontend_idle_unload{0};
+    std::thread frontend_unload_thread;
+
+    // Loads a phonemizer or stress session again after an idle unload, in
+    // place of load_session. Set by the registry so voices keep sharing them.
+    // Called with frontend_sessions_mutex held.
+    std::function<std::shared_ptr<Ort::Session>(const std::string &)>
+        frontend_session_loader;
+    bool stopping = false;
+
+    // Voice model inputs padded to bucket lengths, by length.
+    // Reused between sentences, guarded by bucket_buffers_mutex.
+    bool shape_buckets = false;
+    mutable std::map<std::size_t, std::vector<std::vector<PhonemeId>>>
+        bucket_buffers;
+    mutable std::mutex bucket_buffers_mutex;
+
+    // Applied to chunks in order as they are returned
+    piper2_postprocess_options postprocess;
+
+    // For piper2_estimate, guarded by cost_model_mutex
+    piper2_cost_model cost_model;
+    mutable std::mutex cost_model_mutex;
+
+    // Memory usage
+    std::size_t voice_model_bytes = 0;
+    std::size_t frontend_model_bytes = 0;
+    mutable std::atomic<std::size_t> peak_resident_bytes{0};
 
     // synthesize state
-    std::queue<std::vector<CharId>> char_id_queue;
-    std::vector<float> chunk_samples;
-    std::string chunk_chars;
-    std::string chunk_phonemes;
-    std::vector<int> chunk_phoneme_ids;
-    float length_scale = DEFAULT_LENGTH_SCALE;
-    float noise_scale = DEFAULT_NOISE_SCALE;
-    float noise_w_scale = DEFAULT_NOISE_W_SCALE;
-    SpeakerId speaker_id = 0;
+    std::queue<Sentence> sentence_queue;
+    SentenceAudio chunk_audio;
+    SynthesisParams params;
+    PostprocessState postprocess_state;
+    uint64_t trace_request_id = 0;
+    uint32_t trace_sentence_idx = 0;
+
+    // piper2_fanout_start/next state, one element per speaker
+    std::queue<Sentence> fanout_queue;
+    std::vector<SynthesisParams> fanout_params;
+    std::vector<SentenceAudio> fanout_audio;
+    std::vector<PostprocessState> fanout_postprocess_states;
+    uint64_t fanout_trace_request_id = 0;
+    uint32_t fanout_trace_sentence_idx = 0;
+
+    // Optional request log (see piper2_set_capture).
+    // capture is for piper2_synthesize_start/next.
+    piper2_capture *capture_log = nullptr;
+    std::string capture_voice;
+    RequestCapture capture;
+
+    // Guards the ICU frontend objects below, which are shared between
+    // piper2_synthesize_start and scheduler submissions.
+    std::mutex frontend_mutex;
 
     // ICU
     icu::Locale locale;
@@ -111,7 +219,7 @@ struct piper2_synthesizer {
     std::unique_ptr<icu::RegexPattern> pattern_whitespace;
 };
 
-std::optional<char32_t> get_codepoint(const std::string &s) {
+inline std::optional<char32_t> get_codepoint(const std::string &s) {
     auto us = icu::UnicodeString::fromUTF8(s);
     if (us.isEmpty()) {
         return std::nullopt;
@@ -120,4 +228,77 @@ std::optional<char32_t> get_codepoint(const std::string &s) {
     return static_cast<char32_t>(cp);
 }
 
+// Create a synthesizer, reusing phonemizer/stress sessions if they are not
+// null.
+piper2_synthesizer *
+create_synthesizer(const char *locale, const char *voice_model_path,
+                   const char *voice_config_path,
+                   const char *phonemizer_model_path,
+                   const char *phonemizer_config_path,
+                   const char *stress_model_path,
+                   const piper2_create_options *options,
+                   std::shared_ptr<Ort::Session> phonemizer_session,
+                   std::shared_ptr<Ort::Session> stress_session);
+
+// Path of a model's precision variant (model.onnx -> model.<precision>.onnx)
+// if precision is set and the variant exists, otherwise the model's path.
+std::string resolve_model_variant(const std::string &model_path,
+                                  const char *precision);
+
+// Cost model from MODEL.cost.json next to a voice model, or defaults.
+piper2_cost_model load_cost_model(const std::string &voice_model_path);
+
+// Load an ONNX model, memory-mapping the file if requested.
+std::shared_ptr<Ort::Session>
+load_session(const std::string &model_path,
+             const Ort::SessionOptions &session_options, bool map_model);
+
+// Split text into sentences and map characters to phonemizer ids.
+std::vector<Sentence> text_to_sentences(piper2_synthesizer *synth,
+                                        const char *text);
+
+// Run the frontend on a sentence, filling everything in audio but samples.
+// syn_phoneme_ids are the voice model's input.
+// Only reads from synth, so it may be called from multiple threads at once.
+int phonemize_sentence(const piper2_synthesizer *synth,
+                       const Sentence &sentence, SentenceAudio &audio,
+                       std::vector<PhonemeId> &syn_phoneme_ids);
+
+// Takes the voice model's output in place, to copy it straight to its final
+// destination. May modify the samples. Returns PIPER2_OK or error code.
+using SampleSink = std::function<int(float *samples, std::size_t num_samples)>;
+
+// Run the voice model on the same phoneme ids for each speaker in a batch
+// (params.speaker_id if speaker_ids is empty). The model takes a single
+// scales tensor, so every item uses the scales of params. Audio is padded to
+// the longest item in the batch, unless the model reports each item's length
+// (see voice_model_reports_lengths).
+// With a sink (single speaker only), audio goes to the sink instead of
+// samples.
+// Only reads from synth, so it may be called from multiple threads at once.
+int run_voice_model(const piper2_synthesizer *synth,
+                    const std::vector<PhonemeId> &syn_phoneme_ids,
+                    const SynthesisParams &params,
+                    const std::vector<SpeakerId> &speaker_ids,
+                    std::vector<std::vector<float>> &samples,
+                    const SampleSink *sink = nullptr);
+
+// True if the voice model has a y_lengths output, so batched audio from
+// run_voice_model is cut to each item's own length.
+bool voice_model_reports_lengths(const piper2_synthesizer *synth);
+
+// Phonemize and synthesize a single sentence.
+// Only reads from synth, so it may be called from multiple threads at once.
+int synthesize_sentence(const piper2_synthesizer *synth,
+                        const Sentence &sentence,
+                        const SynthesisParams &params, SentenceAudio &audio);
+
+// Convert public synthesis options into per-request settings.
+SynthesisParams make_synthesis_params(piper2_synthesizer *synth,
+                                      const piper2_synthesize_options *options);
+
+// Fill a public audio chunk from synthesized sentence audio.
+void fill_audio_chunk(const piper2_synthesizer *synth,
+                      const SentenceAudio &audio, piper2_audio_chunk *chunk);
+
 #endif // PIPER2_IMPL_H_
@@ -0,0 +1,58 @@
+#ifndef PIPER2_LEXICON_H_
+#define PIPER2_LEXICON_H_
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "piper2_mapped_file.hpp"
+
+// Compiled pronunciation lexicon.
+//
+// The file is an open-addressing hash table that is memory-mapped read-only,
+// so its pages are shared by every process using the same lexicon.
+// All integers are little endian.
+//
+//   header (24 bytes):
+//     char[8] magic "PPR2LEX\0"
+//     uint32  version (1)
+//     uint32  number of entries
+//     uint32  number of slots (power of 2)
+//     uint32  reserved (0)
+//   slots (8 bytes each):
+//     uint32  FNV-1a hash of word
+//     uint32  file offset of entry, or 0 if the slot is empty
+//   entries:
+//     uint16  word length in bytes
+//     uint16  phonemes length in bytes
+//     word (UTF-8, lower case without accents)
+//     phonemes (UTF-8, with stress markers)
+
+const char LEXICON_MAGIC[8] = {'P', 'P', 'R', '2', 'L', 'E', 'X', '\0'};
+const uint32_t LEXICON_VERSION = 1;
+const std::size_t LEXICON_HEADER_SIZE = 24;
+const std::size_t LEXICON_SLOT_SIZE = 8;
+
+struct Lexicon {
+    std::shared_ptr<MappedFile> file;
+    const uint8_t *data = nullptr;
+    std::size_t data_size = 0;
+    uint32_t num_entries = 0;
+    uint32_t num_slots = 0;
+
+    // Phonemes for a word or nullopt if it isn't in the lexicon
+    std::optional<std::string_view> lookup(std::string_view word) const;
+};
+
+// Memory-map a compiled lexicon, returning null if it's missing or invalid
+std::unique_ptr<Lexicon> open_lexicon(const std::string &path);
+
+// Compile word -> phonemes entries into a lexicon file
+bool build_lexicon(const std::map<std::string, std::string> &entries,
+                   const std::string &path);
+
+#endif // PIPER2_LEXICON_H_
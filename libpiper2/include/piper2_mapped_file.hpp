@@ -0,0 +1,26 @@
+#ifndef PIPER2_MAPPED_FILE_H_
+#define PIPER2_MAPPED_FILE_H_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file.
+// Memory-mapped where possible so pages are shared between processes and can
+// be dropped by the kernel under memory pressure, otherwise read into a
+// buffer.
+struct MappedFile {
+    const uint8_t *data = nullptr;
+    std::size_t size = 0;
+
+    // File contents when memory mapping isn't available
+    std::vector<uint8_t> buffer;
+
+    ~MappedFile();
+};
+
+// Map a file, returning null if it can't be opened
+std::shared_ptr<MappedFile> map_file(const std::string &path);
+
+#endif // PIPER2_MAPPED_FILE_H_
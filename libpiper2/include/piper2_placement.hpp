@@ -0,0 +1,44 @@
+#ifndef PIPER2_PLACEMENT_H_
+#define PIPER2_PLACEMENT_H_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// CPU and NUMA placement of threads and memory.
+// Everything here is a no-op where it isn't supported: CPU pinning needs
+// Linux, and NUMA placement needs libnuma (PIPER2_HAVE_NUMA).
+
+// Parse a Linux cpu list like "0-7,16,18-19", or nullopt if it's invalid
+std::optional<std::vector<int>> parse_cpu_list(const std::string &cpu_list);
+
+// Restrict the current thread to the given CPUs.
+// Threads created afterwards by this thread inherit the restriction.
+bool pin_current_thread(const std::vector<int> &cpus);
+
+// Run the current thread on the CPUs of a NUMA node, and allocate its memory
+// from that node.
+bool bind_current_thread_to_node(int node);
+
+// Number of NUMA nodes (1 without libnuma)
+int numa_node_count();
+
+// Binds the current thread to a NUMA node until the end of the scope, then
+// restores its CPU affinity and memory policy.
+// Memory allocated in the scope (e.g., model weights) is placed on the node,
+// and threads created in the scope (e.g., onnxruntime's thread pools) stay
+// on it.
+class NumaNodeScope {
+  public:
+    explicit NumaNodeScope(int node);
+    ~NumaNodeScope();
+
+    NumaNodeScope(const NumaNodeScope &) = delete;
+    NumaNodeScope &operator=(const NumaNodeScope &) = delete;
+
+  private:
+    bool bound = false;
+    std::vector<int> saved_cpus;
+};
+
+#endif // PIPER2_PLACEMENT_H_
@@ -0,0 +1,44 @@
+#ifndef PIPER2_POSTPROCESS_H_
+#define PIPER2_POSTPROCESS_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "piper2.h"
+
+// Samples per block. DC, loudness and gain are updated at block boundaries,
+// counted from the start of the request.
+const std::size_t POSTPROCESS_BLOCK_SIZE = 64;
+
+// Post-processing state carried across the chunks of one request
+struct PostprocessState {
+    // Samples processed so far
+    uint64_t position = 0;
+
+    // Statistics of the block in progress
+    double block_sum = 0;
+    double block_sum_squares = 0;
+    float block_peak = 0;
+
+    // Estimates from completed blocks
+    float dc = 0;
+    float mean_square = 0;
+    bool has_loudness = false;
+    float peak = 0;
+
+    // Gain of sample j in the current block is gain_from + gain_step * (j + 1)
+    float gain_from = 1.0f;
+    float gain_step = 0;
+};
+
+// Post-process a chunk in place with SSE or NEON where available
+void postprocess_chunk(const piper2_postprocess_options &options,
+                       int sample_rate, PostprocessState &state,
+                       float *samples, std::size_t num_samples);
+
+// Scalar reference of postprocess_chunk
+void postprocess_chunk_scalar(const piper2_postprocess_options &options,
+                              int sample_rate, PostprocessState &state,
+                              float *samples, std::size_t num_samples);
+
+#endif // PIPER2_POSTPROCESS_H_
@@ -0,0 +1,228 @@
+#ifndef PIPER2_RING_H_
+#define PIPER2_RING_H_
+
+// Shared-memory audio ring buffer.
+//
+// A single producer (usually the process running libpiper2) writes samples
+// into a ring in a memfd or POSIX shared memory segment, and a single
+// consumer in another process reads them in place.
+//
+// Segment layout (native byte order, offsets in bytes):
+//
+//   0    char[8] magic "PPR2RING"
+//   8    uint32  version (1)
+//   12   uint32  header size = offset of sample data (192)
+//   16   uint32  sample format (PIPER2_RING_FORMAT_FLOAT32)
+//   20   uint32  number of channels (1)
+//   24   uint32  sample rate in Hertz (0 until the first chunk)
+//   28   uint32  reserved (0)
+//   32   uint64  capacity in samples (power of 2)
+//
+//   producer cache line:
+//   64   uint64  write position (total samples written)
+//   72   uint64  write sequence (total chunks written)
+//   80   uint32  write futex (changes whenever samples are published)
+//   84   uint32  flags (PIPER2_RING_FLAG_CLOSED)
+//   88   uint32  consumer waiting (1 if the consumer is sleeping)
+//
+//   consumer cache line:
+//   128  uint64  read position (total samples read)
+//   136  uint32  read futex (changes whenever space is freed)
+//   140  uint32  producer waiting (1 if the producer is sleeping)
+//
+//   192  samples[capacity]
+//
+// Positions only increase; the sample at position p is stored at index
+// p & (capacity - 1). Positions, futex words and flags are read and written
+// with atomic acquire/release operations. Only the producer writes the
+// producer cache line and only the consumer writes the read position.
+// Sleepers wait on the futex word of the other side and set their waiting
+// flag first, so a side only makes a wake system call when the other side
+// is actually asleep.
+//
+// Linux only. Elsewhere, piper2_ring_create and piper2_ring_open return
+// NULL.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "piper2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPER2_RING_VERSION 1
+#define PIPER2_RING_FORMAT_FLOAT32 1
+#define PIPER2_RING_FLAG_CLOSED 1
+
+/**
+ * \brief Header at the start of a shared-memory audio ring.
+ */
+typedef struct piper2_ring_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t sample_format;
+  uint32_t num_channels;
+  uint32_t sample_rate;
+  uint32_t reserved;
+  uint64_t capacity;
+  uint8_t padding1[24];
+
+  uint64_t write_pos;
+  uint64_t write_seq;
+  uint32_t write_futex;
+  uint32_t flags;
+  uint32_t consumer_waiting;
+  uint8_t padding2[36];
+
+  uint64_t read_pos;
+  uint32_t read_futex;
+  uint32_t producer_waiting;
+  uint8_t padding3[48];
+} piper2_ring_header;
+
+/**
+ * \brief Mapped audio ring (producer or consumer side).
+ */
+typedef struct piper2_ring piper2_ring;
+
+/**
+ * \brief Create an audio ring as the producer.
+ *
+ * \param name POSIX shared memory name starting with "/" so other processes
+ * can open it with piper2_ring_open, or any other name for an anonymous
+ * memfd that is shared by passing its file descriptor.
+ *
+ * \param capacity minimum number of samples the ring holds (rounded up to a
+ * power of 2).
+ *
+ * \return a ring or NULL on error.
+ */
+piper2_ring *piper2_ring_create(const char *name, size_t capacity);
+
+/**
+ * \brief Open an existing audio ring by POSIX shared memory name as the
+ * consumer.
+ *
+ * \return a ring or NULL on error.
+ */
+piper2_ring *piper2_ring_open(const char *name);
+
+/**
+ * \brief Open an audio ring from a file descriptor (e.g., received over a
+ * Unix socket) as the consumer.
+ *
+ * The descriptor is duplicated, so the caller still owns it.
+ *
+ * \return a ring or NULL on error.
+ */
+piper2_ring *piper2_ring_open_fd(int fd);
+
+/**
+ * \brief Unmap an audio ring.
+ *
+ * A POSIX shared memory segment is unlinked when its producer frees it.
+ */
+void piper2_ring_free(piper2_ring *ring);
+
+/**
+ * \brief File descriptor of the ring's shared memory, for passing to the
+ * consumer.
+ */
+int piper2_ring_fd(piper2_ring *ring);
+
+/**
+ * \brief Get the header of the ring in shared memory.
+ */
+const piper2_ring_header *piper2_ring_get_header(piper2_ring *ring);
+
+/**
+ * \brief Write samples, waiting for the consumer to free space if needed.
+ *
+ * \param timeout_ms maximum time to wait for space or -1 to wait forever.
+ *
+ * \return PIPER2_OK when all samples were written, PIPER2_AGAIN on timeout
+ * (some samples may have been written) or error code.
+ */
+int piper2_ring_write(piper2_ring *ring, const float *samples,
+                      size_t num_samples, int timeout_ms);
+
+/**
+ * \brief Write an audio chunk from piper2_synthesize_next or
+ * piper2_request_next, and count it in the write sequence.
+ *
+ * \return same as \ref piper2_ring_write.
+ */
+int piper2_ring_write_chunk(piper2_ring *ring, const piper2_audio_chunk *chunk,
+                            int timeout_ms);
+
+/**
+ * \brief Synthesize text straight into an audio ring.
+ *
+ * Each sentence is synthesized in order and its audio is post-processed (if
+ * enabled) in the voice model's output buffer and written to the ring as
+ * one chunk, so the ring write is the only copy of the samples. Returns once
+ * all of the text is written; the ring is not closed.
+ *
+ * Part of libpiper2, not the standalone piper2_ring library.
+ *
+ * \param options synthesis options or NULL for the voice's defaults.
+ *
+ * \param timeout_ms maximum time to wait for space in the ring for each
+ * sentence or -1 to wait forever.
+ *
+ * \return PIPER2_OK, PIPER2_AGAIN on timeout (the text was only partly
+ * written) or error code.
+ */
+int piper2_synthesize_to_ring(piper2_synthesizer *synth, const char *text,
+                              const piper2_synthesize_options *options,
+                              piper2_ring *ring, int timeout_ms);
+
+/**
+ * \brief Mark the end of the stream. The consumer gets PIPER2_DONE once it
+ * has read everything.
+ */
+void piper2_ring_close(piper2_ring *ring);
+
+/**
+ * \brief Wait for samples as the consumer.
+ *
+ * \param timeout_ms maximum time to wait or -1 to wait forever.
+ *
+ * \return PIPER2_OK when samples are available, PIPER2_AGAIN on timeout,
+ * PIPER2_DONE when the producer closed the ring and all samples were read,
+ * or error code.
+ */
+int piper2_ring_wait(piper2_ring *ring, int timeout_ms);
+
+/**
+ * \brief Get readable samples in place without copying.
+ *
+ * \param samples set to the first readable sample.
+ *
+ * \return number of contiguous readable samples (0 if empty). Samples that
+ * wrap around the end of the ring are returned by the next call after
+ * piper2_ring_consume.
+ */
+size_t piper2_ring_peek(piper2_ring *ring, const float **samples);
+
+/**
+ * \brief Release samples returned by piper2_ring_peek back to the producer.
+ */
+void piper2_ring_consume(piper2_ring *ring, size_t num_samples);
+
+/**
+ * \brief Copy up to max_samples readable samples out of the ring.
+ *
+ * \return number of samples copied.
+ */
+size_t piper2_ring_read(piper2_ring *ring, float *samples,
+                        size_t max_samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIPER2_RING_H_
@@ -0,0 +1,119 @@
+#ifndef PIPER2_TRACE_H_
+#define PIPER2_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+// Stages of synthesis recorded in timeline traces (see piper2_trace_start)
+enum TraceStage : uint8_t {
+    TRACE_SEGMENTATION,
+    TRACE_NUMBER_FORMAT,
+    TRACE_PHONEMIZER,
+    TRACE_STRESS,
+    TRACE_VOICE,
+    TRACE_COPY_OUT,
+    TRACE_POSTPROCESS,
+    TRACE_QUEUED,
+    TRACE_NUM_STAGES
+};
+
+// Events recorded per thread between flushes. Later events are dropped.
+const std::size_t TRACE_BUFFER_EVENTS = 64 * 1024;
+
+const uint32_t TRACE_NO_SENTENCE = UINT32_MAX;
+
+struct TraceEvent {
+    int64_t begin_ns;
+    int64_t end_ns;
+    uint64_t request_id; // 0 = none
+    uint32_t sentence_idx;
+    TraceStage stage;
+};
+
+// Request and sentence the current thread is working on
+struct TraceContext {
+    uint64_t request_id = 0;
+    uint32_t sentence_idx = TRACE_NO_SENTENCE;
+};
+
+extern std::atomic<bool> trace_enabled;
+extern thread_local TraceContext trace_context;
+
+// Checked before doing anything else, so disabled tracing costs a relaxed
+// load and a branch (nothing if compiled out).
+inline bool is_tracing() {
+#if defined(PIPER2_HAVE_TRACING)
+    return trace_enabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+// Unique id for tagging a request's events
+uint64_t new_trace_request_id();
+
+// Monotonic time in nanoseconds
+int64_t trace_now_ns();
+
+// Start time of a stage, or -1 if not tracing
+inline int64_t trace_begin() { return is_tracing() ? trace_now_ns() : -1; }
+
+// Record a stage that began at begin_ns (if >= 0) and ends now
+void trace_end(TraceStage stage, int64_t begin_ns, uint64_t request_id,
+               uint32_t sentence_idx);
+
+inline void trace_end(TraceStage stage, int64_t begin_ns) {
+    if (begin_ns >= 0) {
+        trace_end(stage, begin_ns, trace_context.request_id,
+                  trace_context.sentence_idx);
+    }
+}
+
+// Name shown for the current thread in traces
+void trace_set_thread_name(const std::string &name);
+
+// Records a stage from construction to destruction
+class TraceScope {
+  public:
+    explicit TraceScope(TraceStage stage)
+        : stage(stage), begin_ns(trace_begin()) {}
+    ~TraceScope() { trace_end(stage, begin_ns); }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    TraceStage stage;
+    int64_t begin_ns;
+};
+
+// Sets the current thread's trace context and restores it on destruction
+class TraceContextScope {
+  public:
+    TraceContextScope(uint64_t request_id, uint32_t sentence_idx) {
+#if defined(PIPER2_HAVE_TRACING)
+        saved = trace_context;
+        trace_context.request_id = request_id;
+        trace_context.sentence_idx = sentence_idx;
+#else
+        (void)request_id;
+        (void)sentence_idx;
+#endif
+    }
+
+    ~TraceContextScope() {
+#if defined(PIPER2_HAVE_TRACING)
+        trace_context = saved;
+#endif
+    }
+
+    TraceContextScope(const TraceContextScope &) = delete;
+    TraceContextScope &operator=(const TraceContextScope &) = delete;
+
+  private:
+    TraceContext saved;
+};
+
+#endif // PIPER2_TRACE_H_
@@ -0,0 +1,312 @@
+#include "piper2.h"
+#include "piper2_capture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+using Clock = std::chrono::steady_clock;
+
+const char CAPTURE_MAGIC[8] = {'P', 'P', 'R', '2', 'C', 'A', 'P', '\0'};
+const std::size_t CAPTURE_HEADER_SIZE = 24;
+
+// Fixed-size fields at the start of a record, after its size
+const std::size_t CAPTURE_RECORD_FIXED_SIZE = 44;
+
+static void put_u8(std::string &out, uint8_t value) {
+    out.push_back((char)value);
+}
+
+static void put_u16(std::string &out, uint16_t value) {
+    for (int i = 0; i < 2; ++i) {
+        out.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+static void put_u32(std::string &out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+static void put_u64(std::string &out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+static void put_f32(std::string &out, float value) {
+    uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    put_u32(out, bits);
+}
+
+// Reads little endian values from a buffer, failing past its end
+struct ByteReader {
+    const uint8_t *data = nullptr;
+    std::size_t size = 0;
+    std::size_t pos = 0;
+    bool ok = true;
+
+    uint64_t get(int num_bytes) {
+        if ((size - pos) < (std::size_t)num_bytes) {
+            ok = false;
+            return 0;
+        }
+
+        uint64_t value = 0;
+        for (int i = 0; i < num_bytes; ++i) {
+            value |= (uint64_t)data[pos + i] << (8 * i);
+        }
+        pos += num_bytes;
+
+        return value;
+    }
+
+    float get_f32() {
+        uint32_t bits = (uint32_t)get(4);
+        float value = 0;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    std::string get_string(std::size_t length) {
+        if ((size - pos) < length) {
+            ok = false;
+            return "";
+        }
+
+        std::string value((const char *)data + pos, length);
+        pos += length;
+
+        return value;
+    }
+};
+
+static uint32_t micros_since(Clock::time_point start, Clock::time_point end) {
+    auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+            .count();
+    return (uint32_t)std::clamp<int64_t>(micros, 0, UINT32_MAX);
+}
+
+static std::string encode_record(const CapturedRequest &request) {
+    std::string record;
+    put_u64(record, request.arrival_us);
+    put_u8(record, request.status);
+    put_u8(record, request.priority);
+    put_u16(record, (uint16_t)request.voice.size());
+    put_u32(record, (uint32_t)request.text.size());
+    put_u32(record, (uint32_t)request.speaker_id);
+    put_f32(record, request.length_scale);
+    put_f32(record, request.noise_scale);
+    put_f32(record, request.noise_w_scale);
+    put_u64(record, (uint64_t)request.deadline_ms);
+    put_u32(record, (uint32_t)request.chunks.size());
+    record += request.voice;
+    record += request.text;
+    for (const auto &chunk : request.chunks) {
+        put_u32(record, chunk.ready_us);
+        put_u32(record, chunk.num_samples);
+    }
+
+    std::string size_prefix;
+    put_u32(size_prefix, (uint32_t)record.size());
+
+    return size_prefix + record;
+}
+
+void piper2_capture::append(const std::string &record) {
+    bool should_flush = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += record;
+
+        auto now = Clock::now();
+        should_flush = (pending.size() >= CAPTURE_FLUSH_BYTES) ||
+                       ((now - last_flush) >= CAPTURE_FLUSH_INTERVAL);
+    }
+
+    if (should_flush) {
+        flush();
+    }
+}
+
+void piper2_capture::flush() {
+    // Records may reach the file out of order; readers sort by arrival
+    std::string records;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.swap(pending);
+        last_flush = Clock::now();
+    }
+
+    if (records.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    file.write(records.data(), records.size());
+    file.flush();
+}
+
+void RequestCapture::begin(piper2_capture *new_capture,
+                           const std::string &voice, const char *text,
+                           uint8_t priority, int64_t deadline_ms,
+                           int32_t speaker_id, float length_scale,
+                           float noise_scale, float noise_w_scale) {
+    end(CAPTURE_STATUS_CANCELLED);
+    if (!new_capture) {
+        return;
+    }
+
+    capture = new_capture;
+    arrival = Clock::now();
+
+    request = CapturedRequest();
+    request.arrival_us = (uint64_t)std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::microseconds>(
+               arrival - capture->start_time)
+               .count());
+    request.priority = priority;
+    request.voice = voice.substr(0, UINT16_MAX);
+    request.text = text;
+    request.speaker_id = speaker_id;
+    request.length_scale = length_scale;
+    request.noise_scale = noise_scale;
+    request.noise_w_scale = noise_w_scale;
+    request.deadline_ms = deadline_ms;
+}
+
+void RequestCapture::add_chunk(std::size_t num_samples) {
+    if (!capture) {
+        return;
+    }
+
+    CapturedChunk chunk;
+    chunk.ready_us = micros_since(arrival, Clock::now());
+    chunk.num_samples = (uint32_t)num_samples;
+    request.chunks.push_back(chunk);
+}
+
+void RequestCapture::end(uint8_t status) {
+    if (!capture) {
+        return;
+    }
+
+    request.status = status;
+    capture->append(encode_record(request));
+
+    capture = nullptr;
+    request = CapturedRequest();
+}
+
+std::optional<CaptureLog> read_capture_log(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+    if ((bytes.size() < CAPTURE_HEADER_SIZE) ||
+        (std::memcmp(bytes.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) !=
+         0)) {
+        return std::nullopt;
+    }
+
+    ByteReader header{bytes.data(), bytes.size(), sizeof(CAPTURE_MAGIC)};
+    uint32_t version = (uint32_t)header.get(4);
+    header.get(4); // reserved
+    if (version != CAPTURE_VERSION) {
+        return std::nullopt;
+    }
+
+    CaptureLog log;
+    log.start_unix_us = header.get(8);
+
+    std::size_t pos = CAPTURE_HEADER_SIZE;
+    while ((bytes.size() - pos) >= 4) {
+        ByteReader size_reader{bytes.data(), bytes.size(), pos};
+        std::size_t record_size = (std::size_t)size_reader.get(4);
+        pos += 4;
+        if ((record_size < CAPTURE_RECORD_FIXED_SIZE) ||
+            ((bytes.size() - pos) < record_size)) {
+            break;
+        }
+
+        ByteReader reader{bytes.data() + pos, record_size};
+        CapturedRequest request;
+        request.arrival_us = reader.get(8);
+        request.status = (uint8_t)reader.get(1);
+        request.priority = (uint8_t)reader.get(1);
+        std::size_t voice_length = (std::size_t)reader.get(2);
+        std::size_t text_length = (std::size_t)reader.get(4);
+        request.speaker_id = (int32_t)(uint32_t)reader.get(4);
+        request.length_scale = reader.get_f32();
+        request.noise_scale = reader.get_f32();
+        request.noise_w_scale = reader.get_f32();
+        request.deadline_ms = (int64_t)reader.get(8);
+        std::size_t num_chunks = (std::size_t)reader.get(4);
+        request.voice = reader.get_string(voice_length);
+        request.text = reader.get_string(text_length);
+        for (std::size_t i = 0; reader.ok && (i < num_chunks); ++i) {
+            CapturedChunk chunk;
+            chunk.ready_us = (uint32_t)reader.get(4);
+            chunk.num_samples = (uint32_t)reader.get(4);
+            request.chunks.push_back(chunk);
+        }
+
+        if (!reader.ok) {
+            break;
+        }
+
+        log.requests.push_back(std::move(request));
+        pos += record_size;
+    }
+
+    // Records are written as requests finish, so sort by arrival
+    std::stable_sort(log.requests.begin(), log.requests.end(),
+                     [](const CapturedRequest &a, const CapturedRequest &b) {
+                         return a.arrival_us < b.arrival_us;
+                     });
+
+    return log;
+}
+
+piper2_capture *piper2_capture_open(const char *path) {
+    if (!path) {
+        return nullptr;
+    }
+
+    piper2_capture *capture = new piper2_capture();
+    capture->file.open(path, std::ios::binary | std::ios::trunc);
+    if (!capture->file) {
+        delete capture;
+        return nullptr;
+    }
+
+    capture->start_time = Clock::now();
+    capture->last_flush = capture->start_time;
+    auto start_unix_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+
+    std::string header(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    put_u32(header, CAPTURE_VERSION);
+    put_u32(header, 0);
+    put_u64(header, (uint64_t)start_unix_us);
+    capture->file.write(header.data(), header.size());
+    capture->file.flush();
+
+    return capture;
+}
+
+void piper2_capture_close(piper2_capture *capture) {
+    if (!capture) {
+        return;
+    }
+
+    capture->flush();
+    delete capture;
+}
@@ -0,0 +1,352 @@
+#include "piper2.h"
+#include "piper2_impl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+
+using json = nlohmann::json;
+
+// Rough defaults for English voices on a desktop CPU, until calibrated
+const float DEFAULT_PHONEMES_PER_CHAR = 0.9f;
+const float DEFAULT_SECONDS_PER_PHONEME = 0.07f;
+const float DEFAULT_CPU_SECONDS_PER_SENTENCE = 0.005f;
+const float DEFAULT_CPU_SECONDS_PER_CHAR = 0.0005f;
+const float DEFAULT_CPU_SECONDS_PER_AUDIO_SECOND = 0.1f;
+
+// Measurements of one sentence for calibration
+struct SentenceCost {
+    double phonemized_chars = 0;
+    double lexicon_phonemes = 0;
+    double phonemes = 0;
+    double audio_seconds = 0; // at length scale 1
+    double cpu_seconds = 0;
+};
+
+// Characters that go through the phonemizer and phonemes that come from the
+// lexicon
+static void count_sentence(const Sentence &sentence,
+                           std::size_t &phonemized_chars,
+                           std::size_t &lexicon_phonemes) {
+    phonemized_chars = sentence.char_ids.size();
+    lexicon_phonemes = 0;
+    for (const auto &word : sentence.lexicon_words) {
+        phonemized_chars -= std::min(phonemized_chars,
+                                     word.char_end - word.char_start);
+        lexicon_phonemes += word.phonemes.countChar32();
+    }
+}
+
+static piper2_cost_model default_cost_model() {
+    piper2_cost_model model;
+    model.phonemes_per_char = DEFAULT_PHONEMES_PER_CHAR;
+    model.seconds_per_phoneme = DEFAULT_SECONDS_PER_PHONEME;
+    model.cpu_seconds_per_sentence = DEFAULT_CPU_SECONDS_PER_SENTENCE;
+    model.cpu_seconds_per_char = DEFAULT_CPU_SECONDS_PER_CHAR;
+    model.cpu_seconds_per_audio_second = DEFAULT_CPU_SECONDS_PER_AUDIO_SECOND;
+    model.num_calibration_sentences = 0;
+
+    return model;
+}
+
+piper2_cost_model load_cost_model(const std::string &voice_model_path) {
+    piper2_cost_model model = default_cost_model();
+
+    std::ifstream cost_stream(voice_model_path + ".cost.json");
+    if (!cost_stream) {
+        return model;
+    }
+
+    auto cost_json = json::parse(cost_stream, nullptr, false);
+    if (cost_json.is_discarded() || !cost_json.is_object()) {
+        return model;
+    }
+
+    model.phonemes_per_char =
+        cost_json.value("phonemes_per_char", model.phonemes_per_char);
+    model.seconds_per_phoneme =
+        cost_json.value("seconds_per_phoneme", model.seconds_per_phoneme);
+    model.cpu_seconds_per_sentence = cost_json.value(
+        "cpu_seconds_per_sentence", model.cpu_seconds_per_sentence);
+    model.cpu_seconds_per_char =
+        cost_json.value("cpu_seconds_per_char", model.cpu_seconds_per_char);
+    model.cpu_seconds_per_audio_second =
+        cost_json.value("cpu_seconds_per_audio_second",
+                        model.cpu_seconds_per_audio_second);
+    model.num_calibration_sentences = cost_json.value(
+        "num_calibration_sentences", model.num_calibration_sentences);
+
+    return model;
+}
+
+int piper2_estimate(piper2_synthesizer *synth, const char *text,
+                    const piper2_synthesize_options *options,
+                    piper2_cost_estimate *total,
+                    piper2_cost_estimate *sentences, size_t max_sentences) {
+    if (!synth || !text || !total) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    piper2_cost_model model;
+    {
+        std::lock_guard<std::mutex> lock(synth->cost_model_mutex);
+        model = synth->cost_model;
+    }
+
+    SynthesisParams params = make_synthesis_params(synth, options);
+
+    *total = piper2_cost_estimate{};
+    std::size_t sentence_idx = 0;
+    for (const auto &sentence : text_to_sentences(synth, text)) {
+        std::size_t phonemized_chars = 0;
+        std::size_t lexicon_phonemes = 0;
+        count_sentence(sentence, phonemized_chars, lexicon_phonemes);
+
+        piper2_cost_estimate estimate;
+        estimate.num_sentences = 1;
+        estimate.num_chars = sentence.char_ids.size();
+        estimate.num_phonemes =
+            lexicon_phonemes +
+            (std::size_t)std::lround(phonemized_chars *
+                                     model.phonemes_per_char);
+        estimate.audio_seconds = estimate.num_phonemes *
+                                 model.seconds_per_phoneme *
+                                 params.length_scale;
+        estimate.cpu_seconds =
+            model.cpu_seconds_per_sentence +
+            (phonemized_chars * model.cpu_seconds_per_char) +
+            (estimate.audio_seconds * model.cpu_seconds_per_audio_second);
+
+        if (sentences && (sentence_idx < max_sentences)) {
+            sentences[sentence_idx] = estimate;
+        }
+        sentence_idx++;
+
+        total->num_sentences++;
+        total->num_chars += estimate.num_chars;
+        total->num_phonemes += estimate.num_phonemes;
+        total->audio_seconds += estimate.audio_seconds;
+        total->cpu_seconds += estimate.cpu_seconds;
+    }
+
+    return PIPER2_OK;
+}
+
+int piper2_get_cost_model(piper2_synthesizer *synth,
+                          piper2_cost_model *model) {
+    if (!synth || !model) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::lock_guard<std::mutex> lock(synth->cost_model_mutex);
+    *model = synth->cost_model;
+
+    return PIPER2_OK;
+}
+
+int piper2_set_cost_model(piper2_synthesizer *synth,
+                          const piper2_cost_model *model) {
+    if (!synth || !model) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::lock_guard<std::mutex> lock(synth->cost_model_mutex);
+    synth->cost_model = *model;
+
+    return PIPER2_OK;
+}
+
+// Least squares fit of y = sum(coeffs[i] * x[i]) over the features in use.
+// Returns false if the features are degenerate.
+static bool fit_least_squares(const std::vector<std::array<double, 3>> &xs,
+                              const std::vector<double> &ys,
+                              const std::array<bool, 3> &use,
+                              std::array<double, 3> &coeffs) {
+    const int n = 3;
+    double a[n][n + 1] = {};
+    for (std::size_t row = 0; row < xs.size(); ++row) {
+        for (int i = 0; i < n; ++i) {
+            if (!use[i]) {
+                continue;
+            }
+
+            for (int j = 0; j < n; ++j) {
+                if (use[j]) {
+                    a[i][j] += xs[row][i] * xs[row][j];
+                }
+            }
+            a[i][n] += xs[row][i] * ys[row];
+        }
+    }
+
+    // Unused features get the equation coeff = 0
+    for (int i = 0; i < n; ++i) {
+        if (!use[i]) {
+            a[i][i] = 1.0;
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        for (int row = col + 1; row < n; ++row) {
+            if (std::fabs(a[row][col]) > std::fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+
+        if (std::fabs(a[pivot][col]) < 1e-12) {
+            return false;
+        }
+
+        std::swap(a[col], a[pivot]);
+        for (int row = 0; row < n; ++row) {
+            if (row == col) {
+                continue;
+            }
+
+            double factor = a[row][col] / a[col][col];
+            for (int k = col; k <= n; ++k) {
+                a[row][k] -= factor * a[col][k];
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        coeffs[i] = a[i][n] / a[i][i];
+    }
+
+    return true;
+}
+
+int piper2_calibrate_cost_model(piper2_synthesizer *synth,
+                                const char *const *texts, size_t num_texts,
+                                piper2_cost_model *model) {
+    if (!synth || !texts || (num_texts == 0) || !model) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    // Voice defaults, with durations measured at length scale 1
+    SynthesisParams params = make_synthesis_params(synth, nullptr);
+    params.length_scale = 1.0f;
+
+    std::vector<SentenceCost> costs;
+    SentenceAudio audio;
+    bool is_warm = false;
+    for (std::size_t text_idx = 0; text_idx < num_texts; ++text_idx) {
+        if (!texts[text_idx]) {
+            continue;
+        }
+
+        for (const auto &sentence : text_to_sentences(synth, texts[text_idx])) {
+            if (!is_warm) {
+                // First run includes one-time initialization
+                synthesize_sentence(synth, sentence, params, audio);
+                is_warm = true;
+            }
+
+            // Process CPU time, so ONNX Runtime's intra-op threads are
+            // counted. Anything else running in the process is counted too,
+            // which is why calibration needs an idle process.
+            std::clock_t start_clock = std::clock();
+            int result = synthesize_sentence(synth, sentence, params, audio);
+            std::clock_t end_clock = std::clock();
+            if (result != PIPER2_OK) {
+                return result;
+            }
+
+            std::size_t phonemized_chars = 0;
+            std::size_t lexicon_phonemes = 0;
+            count_sentence(sentence, phonemized_chars, lexicon_phonemes);
+
+            SentenceCost cost;
+            cost.phonemized_chars = (double)phonemized_chars;
+            cost.lexicon_phonemes = (double)lexicon_phonemes;
+            cost.phonemes =
+                icu::UnicodeString::fromUTF8(audio.phonemes).countChar32();
+            cost.audio_seconds = (double)audio.samples.size() /
+                                 std::max(1, synth->sample_rate);
+            cost.cpu_seconds =
+                (double)(end_clock - start_clock) / CLOCKS_PER_SEC;
+            costs.push_back(cost);
+        }
+    }
+
+    if (costs.empty()) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    double total_chars = 0;
+    double total_phonemized_phonemes = 0;
+    double total_phonemes = 0;
+    double total_audio_seconds = 0;
+    double total_cpu_seconds = 0;
+    for (const auto &cost : costs) {
+        total_chars += cost.phonemized_chars;
+        total_phonemized_phonemes +=
+            std::max(0.0, cost.phonemes - cost.lexicon_phonemes);
+        total_phonemes += cost.phonemes;
+        total_audio_seconds += cost.audio_seconds;
+        total_cpu_seconds += cost.cpu_seconds;
+    }
+
+    piper2_cost_model fitted = default_cost_model();
+    if (total_chars > 0) {
+        fitted.phonemes_per_char =
+            (float)(total_phonemized_phonemes / total_chars);
+    }
+    if (total_phonemes > 0) {
+        fitted.seconds_per_phoneme =
+            (float)(total_audio_seconds / total_phonemes);
+    }
+
+    // cpu = per_sentence + per_char * chars + per_audio_second * audio,
+    // dropping terms that come out negative.
+    std::vector<std::array<double, 3>> xs;
+    std::vector<double> ys;
+    for (const auto &cost : costs) {
+        xs.push_back({1.0, cost.phonemized_chars, cost.audio_seconds});
+        ys.push_back(cost.cpu_seconds);
+    }
+
+    std::array<bool, 3> use = {true, true, true};
+    std::array<double, 3> coeffs = {0, 0, 0};
+    bool fitted_cpu = false;
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        if (!fit_least_squares(xs, ys, use, coeffs)) {
+            break;
+        }
+
+        bool has_negative = false;
+        for (int i = 0; i < 3; ++i) {
+            if (use[i] && (coeffs[i] < 0)) {
+                use[i] = false;
+                has_negative = true;
+            }
+        }
+
+        if (!has_negative) {
+            fitted_cpu = true;
+            break;
+        }
+    }
+
+    if (fitted_cpu) {
+        fitted.cpu_seconds_per_sentence = (float)coeffs[0];
+        fitted.cpu_seconds_per_char = (float)coeffs[1];
+        fitted.cpu_seconds_per_audio_second = (float)coeffs[2];
+    } else if (total_audio_seconds > 0) {
+        // Too few or too similar sentences: cost proportional to audio
+        fitted.cpu_seconds_per_sentence = 0;
+        fitted.cpu_seconds_per_char = 0;
+        fitted.cpu_seconds_per_audio_second =
+            (float)(total_cpu_seconds / total_audio_seconds);
+    }
+
+    fitted.num_calibration_sentences = costs.size();
+    *model = fitted;
+
+    return piper2_set_cost_model(synth, &fitted);
+}
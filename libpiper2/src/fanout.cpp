@@ -0,0 +1,208 @@
+#include "piper2.h"
+#include "piper2_impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Speakers per voice model run, to bound scratch memory
+const std::size_t MAX_FANOUT_BATCH = 16;
+
+// Without per-item lengths from the voice model, batched audio past a
+// speaker's own length is decoded from padding, which comes out as
+// near-silence. Trailing blocks quieter than this are treated as padding.
+const float FANOUT_TRIM_LEVEL = 1e-3f;
+
+// Samples per trimmed block (the voice model's hop length)
+const std::size_t FANOUT_TRIM_BLOCK = 256;
+
+// End of the last block that isn't near-silence
+static std::size_t audible_end(const std::vector<float> &samples) {
+    std::size_t end = samples.size();
+    while (end > 0) {
+        std::size_t block_start =
+            (end > FANOUT_TRIM_BLOCK) ? (end - FANOUT_TRIM_BLOCK) : 0;
+        bool is_quiet = std::all_of(
+            samples.begin() + block_start, samples.begin() + end,
+            [](float sample) { return std::fabs(sample) < FANOUT_TRIM_LEVEL; });
+        if (!is_quiet) {
+            break;
+        }
+
+        end = block_start;
+    }
+
+    return end;
+}
+
+// The item that sounds longest is taken to be the unpadded one and is kept
+// whole, as it would be on its own. Only the others are trimmed.
+static void trim_batch_padding(std::vector<std::vector<float>> &samples,
+                               std::size_t batch_size) {
+    if (batch_size < 2) {
+        return;
+    }
+
+    std::vector<std::size_t> ends(batch_size);
+    std::size_t longest = 0;
+    for (std::size_t i = 0; i < batch_size; ++i) {
+        ends[i] = audible_end(samples[i]);
+        if (ends[i] > ends[longest]) {
+            longest = i;
+        }
+    }
+
+    for (std::size_t i = 0; i < batch_size; ++i) {
+        if (i != longest) {
+            samples[i].resize(ends[i]);
+        }
+    }
+}
+
+static bool same_scales(const SynthesisParams &a, const SynthesisParams &b) {
+    return (a.length_scale == b.length_scale) &&
+           (a.noise_scale == b.noise_scale) &&
+           (a.noise_w_scale == b.noise_w_scale);
+}
+
+int piper2_fanout_start(piper2_synthesizer *synth, const char *text,
+                        const piper2_synthesize_options *options,
+                        size_t num_speakers) {
+    if (!synth || !text || !options || (num_speakers == 0) ||
+        (synth->num_speakers <= 1)) {
+        // Single-speaker voices have no speaker ids to batch over
+        return PIPER2_ERR_GENERIC;
+    }
+
+    for (std::size_t i = 0; i < num_speakers; ++i) {
+        if ((options[i].speaker_id < 0) ||
+            (options[i].speaker_id >= synth->num_speakers)) {
+            return PIPER2_ERR_GENERIC;
+        }
+    }
+
+    // Clear state
+    while (!synth->fanout_queue.empty()) {
+        synth->fanout_queue.pop();
+    }
+
+    synth->fanout_params.clear();
+    for (std::size_t i = 0; i < num_speakers; ++i) {
+        synth->fanout_params.push_back(
+            make_synthesis_params(synth, &options[i]));
+    }
+
+    synth->fanout_audio.resize(num_speakers);
+    for (auto &audio : synth->fanout_audio) {
+        audio.samples.clear();
+    }
+    synth->fanout_postprocess_states.assign(num_speakers, PostprocessState());
+
+    synth->fanout_trace_request_id = new_trace_request_id();
+    synth->fanout_trace_sentence_idx = 0;
+    TraceContextScope trace_scope(synth->fanout_trace_request_id,
+                                  TRACE_NO_SENTENCE);
+
+    for (auto &sentence : text_to_sentences(synth, text)) {
+        synth->fanout_queue.push(std::move(sentence));
+    }
+
+    return PIPER2_OK;
+}
+
+int piper2_fanout_next(piper2_synthesizer *synth, piper2_audio_chunk *chunks) {
+    if (!synth || !chunks) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::size_t num_speakers = synth->fanout_params.size();
+    for (std::size_t i = 0; i < num_speakers; ++i) {
+        // Clear data from previous call
+        synth->fanout_audio[i].samples.clear();
+
+        chunks[i].sample_rate = synth->sample_rate;
+        chunks[i].samples = nullptr;
+        chunks[i].num_samples = 0;
+        chunks[i].is_last = false;
+    }
+
+    if (synth->fanout_queue.empty()) {
+        // Empty final chunks
+        for (std::size_t i = 0; i < num_speakers; ++i) {
+            chunks[i].is_last = true;
+        }
+        return PIPER2_DONE;
+    }
+
+    // Process next sentence
+    auto sentence = std::move(synth->fanout_queue.front());
+    synth->fanout_queue.pop();
+
+    TraceContextScope trace_scope(synth->fanout_trace_request_id,
+                                  synth->fanout_trace_sentence_idx++);
+
+    // Frontend once for all speakers
+    SentenceAudio frontend_audio;
+    std::vector<PhonemeId> syn_phoneme_ids;
+    int result =
+        phonemize_sentence(synth, sentence, frontend_audio, syn_phoneme_ids);
+    if (result != PIPER2_OK) {
+        return result;
+    }
+
+    // Voice model once per group of speakers with the same scales
+    std::vector<bool> is_done(num_speakers, false);
+    std::vector<std::size_t> group;
+    std::vector<SpeakerId> speaker_ids;
+    std::vector<std::vector<float>> samples;
+    bool has_lengths = voice_model_reports_lengths(synth);
+    for (std::size_t first = 0; first < num_speakers; ++first) {
+        if (is_done[first]) {
+            continue;
+        }
+
+        const SynthesisParams &params = synth->fanout_params[first];
+        group.clear();
+        speaker_ids.clear();
+        for (std::size_t i = first;
+             (i < num_speakers) && (group.size() < MAX_FANOUT_BATCH); ++i) {
+            if (!is_done[i] && same_scales(params, synth->fanout_params[i])) {
+                group.push_back(i);
+                speaker_ids.push_back(synth->fanout_params[i].speaker_id);
+                is_done[i] = true;
+            }
+        }
+
+        result = run_voice_model(synth, syn_phoneme_ids, params, speaker_ids,
+                                 samples);
+        if (result != PIPER2_OK) {
+            return result;
+        }
+
+        if (!has_lengths) {
+            trim_batch_padding(samples, group.size());
+        }
+
+        for (std::size_t j = 0; j < group.size(); ++j) {
+            synth->fanout_audio[group[j]].samples = std::move(samples[j]);
+        }
+    }
+
+    for (std::size_t i = 0; i < num_speakers; ++i) {
+        auto &audio = synth->fanout_audio[i];
+        audio.chars = frontend_audio.chars;
+        audio.phonemes = frontend_audio.phonemes;
+        audio.phoneme_ids = frontend_audio.phoneme_ids;
+
+        if (synth->postprocess.enabled) {
+            TraceScope postprocess_trace(TRACE_POSTPROCESS);
+            postprocess_chunk(synth->postprocess, synth->sample_rate,
+                              synth->fanout_postprocess_states[i],
+                              audio.samples.data(), audio.samples.size());
+        }
+
+        fill_audio_chunk(synth, audio, &chunks[i]);
+        chunks[i].is_last = synth->fanout_queue.empty();
+    }
+
+    return PIPER2_OK;
+}
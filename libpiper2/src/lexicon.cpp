@@ -0,0 +1,168 @@
+#include "piper2_lexicon.hpp"
+
+#include <cstring>
+#include <fstream>
+
+static uint32_t fnv1a_hash(std::string_view text) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static uint32_t read_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+           ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t *src) {
+    return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static void write_u32(std::vector<uint8_t> &dest, std::size_t offset,
+                      uint32_t value) {
+    dest[offset] = value & 0xFF;
+    dest[offset + 1] = (value >> 8) & 0xFF;
+    dest[offset + 2] = (value >> 16) & 0xFF;
+    dest[offset + 3] = (value >> 24) & 0xFF;
+}
+
+std::optional<std::string_view> Lexicon::lookup(std::string_view word) const {
+    if (num_slots == 0) {
+        return std::nullopt;
+    }
+
+    // Entries follow the slot table. Offsets are checked in size_t, so a
+    // corrupt file can't wrap them around into bounds.
+    std::size_t entries_start =
+        LEXICON_HEADER_SIZE + ((std::size_t)num_slots * LEXICON_SLOT_SIZE);
+
+    uint32_t hash = fnv1a_hash(word);
+    uint32_t slot_mask = num_slots - 1;
+    for (uint32_t probe = 0; probe < num_slots; ++probe) {
+        const uint8_t *slot = data + LEXICON_HEADER_SIZE +
+                              (((hash + probe) & slot_mask) * LEXICON_SLOT_SIZE);
+        std::size_t entry_offset = read_u32(slot + 4);
+        if (entry_offset == 0) {
+            // Empty slot
+            break;
+        }
+
+        if (read_u32(slot) != hash) {
+            continue;
+        }
+
+        if ((entry_offset < entries_start) || ((entry_offset + 4) > data_size)) {
+            break;
+        }
+
+        const uint8_t *entry = data + entry_offset;
+        uint16_t word_length = read_u16(entry);
+        uint16_t phonemes_length = read_u16(entry + 2);
+        if ((entry_offset + 4 + (std::size_t)word_length + phonemes_length) >
+            data_size) {
+            break;
+        }
+
+        std::string_view entry_word((const char *)entry + 4, word_length);
+        if (entry_word == word) {
+            return std::string_view((const char *)entry + 4 + word_length,
+                                    phonemes_length);
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::unique_ptr<Lexicon> open_lexicon(const std::string &path) {
+    auto lexicon = std::make_unique<Lexicon>();
+    lexicon->file = map_file(path);
+    if (!lexicon->file) {
+        return nullptr;
+    }
+
+    lexicon->data = lexicon->file->data;
+    lexicon->data_size = lexicon->file->size;
+
+    // Validate header
+    if ((lexicon->data_size < LEXICON_HEADER_SIZE) ||
+        (std::memcmp(lexicon->data, LEXICON_MAGIC, sizeof(LEXICON_MAGIC)) !=
+         0) ||
+        (read_u32(lexicon->data + 8) != LEXICON_VERSION)) {
+        return nullptr;
+    }
+
+    lexicon->num_entries = read_u32(lexicon->data + 12);
+    lexicon->num_slots = read_u32(lexicon->data + 16);
+    if ((lexicon->num_slots & (lexicon->num_slots - 1)) != 0) {
+        // Not a power of 2
+        return nullptr;
+    }
+
+    if ((LEXICON_HEADER_SIZE +
+         ((std::size_t)lexicon->num_slots * LEXICON_SLOT_SIZE)) >
+        lexicon->data_size) {
+        return nullptr;
+    }
+
+    return lexicon;
+}
+
+bool build_lexicon(const std::map<std::string, std::string> &entries,
+                   const std::string &path) {
+    // Keep the load factor at or below 0.5 so probes stay short
+    uint32_t num_slots = 1;
+    while (num_slots < (entries.size() * 2)) {
+        num_slots *= 2;
+    }
+
+    std::vector<uint8_t> data(LEXICON_HEADER_SIZE +
+                              (num_slots * LEXICON_SLOT_SIZE));
+    std::memcpy(data.data(), LEXICON_MAGIC, sizeof(LEXICON_MAGIC));
+    write_u32(data, 8, LEXICON_VERSION);
+    write_u32(data, 12, (uint32_t)entries.size());
+    write_u32(data, 16, num_slots);
+    write_u32(data, 20, 0);
+
+    uint32_t slot_mask = num_slots - 1;
+    for (auto &entry : entries) {
+        const std::string &word = entry.first;
+        const std::string &phonemes = entry.second;
+        if ((word.size() > UINT16_MAX) || (phonemes.size() > UINT16_MAX)) {
+            return false;
+        }
+
+        std::size_t entry_offset = data.size();
+        if (entry_offset > UINT32_MAX) {
+            return false;
+        }
+
+        data.push_back(word.size() & 0xFF);
+        data.push_back((word.size() >> 8) & 0xFF);
+        data.push_back(phonemes.size() & 0xFF);
+        data.push_back((phonemes.size() >> 8) & 0xFF);
+        data.insert(data.end(), word.begin(), word.end());
+        data.insert(data.end(), phonemes.begin(), phonemes.end());
+
+        // Linear probing
+        uint32_t hash = fnv1a_hash(word);
+        for (uint32_t probe = 0; probe < num_slots; ++probe) {
+            std::size_t slot_offset =
+                LEXICON_HEADER_SIZE +
+                (((hash + probe) & slot_mask) * LEXICON_SLOT_SIZE);
+            if (read_u32(&data[slot_offset + 4]) == 0) {
+                write_u32(data, slot_offset, hash);
+                write_u32(data, slot_offset + 4, (uint32_t)entry_offset);
+                break;
+            }
+        }
+    }
+
+    std::ofstream lexicon_file(path, std::ios::binary);
+    lexicon_file.write((const char *)data.data(), data.size());
+
+    return (bool)lexicon_file;
+}
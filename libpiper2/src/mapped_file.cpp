@@ -0,0 +1,58 @@
+#include "piper2_mapped_file.hpp"
+
+#include <fstream>
+#include <iterator>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+    if (data && buffer.empty()) {
+        munmap((void *)data, size);
+    }
+#endif
+}
+
+std::shared_ptr<MappedFile> map_file(const std::string &path) {
+    auto file = std::make_shared<MappedFile>();
+
+#if defined(_WIN32)
+    std::ifstream input_file(path, std::ios::binary);
+    if (!input_file) {
+        return nullptr;
+    }
+
+    file->buffer.assign(std::istreambuf_iterator<char>(input_file),
+                        std::istreambuf_iterator<char>());
+    file->data = file->buffer.data();
+    file->size = file->buffer.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size <= 0)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *mapped =
+        mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+
+    file->data = (const uint8_t *)mapped;
+    file->size = file_stat.st_size;
+#endif
+
+    return file;
+}
@@ -3,21 +3,218 @@
 
 #include <iostream> // TODO
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <limits>
 
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
 using json = nlohmann::json;
 
-piper2_synthesizer *piper2_create_phonemizer_stress(
-    const char *locale, const char *voice_model_path,
-    const char *voice_config_path, const char *phonemizer_model_path,
-    const char *phonemizer_config_path, const char *stress_model_path) {
+// Voice model input lengths are padded to powers of 2 from here
+const std::size_t MIN_BUCKET_LENGTH = 32;
+
+// Spare input buffers kept per bucket (about one per concurrent sentence)
+const std::size_t MAX_BUCKET_BUFFERS = 8;
+
+// Optional voice model output with each batch item's length in frames
+const char *VOICE_LENGTHS_OUTPUT = "y_lengths";
+
+// Samples per voice model output frame
+const std::size_t VOICE_HOP_LENGTH = 256;
+
+static std::size_t get_file_size(const std::string &path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : (std::size_t)size;
+}
+
+// Resident memory of this process in bytes (0 if unknown)
+static std::size_t get_resident_bytes() {
+#if defined(__linux__)
+    std::ifstream statm_file("/proc/self/statm");
+    std::size_t total_pages = 0, resident_pages = 0;
+    if (statm_file >> total_pages >> resident_pages) {
+        return resident_pages * (std::size_t)sysconf(_SC_PAGESIZE);
+    }
+#endif
+
+    return 0;
+}
+
+static void update_peak_resident(const piper2_synthesizer *synth) {
+    std::size_t resident_bytes = get_resident_bytes();
+    std::size_t peak_bytes = synth->peak_resident_bytes.load();
+    while ((resident_bytes > peak_bytes) &&
+           !synth->peak_resident_bytes.compare_exchange_weak(peak_bytes,
+                                                             resident_bytes)) {
+    }
+}
+
+std::string resolve_model_variant(const std::string &model_path,
+                                  const char *precision) {
+    if (!precision || (precision[0] == '\0')) {
+        return model_path;
+    }
+
+    std::filesystem::path variant_path(model_path);
+    std::string extension = variant_path.extension().string();
+    variant_path.replace_extension(std::string(".") + precision + extension);
+
+    std::error_code ec;
+    if (!std::filesystem::exists(variant_path, ec)) {
+        // Fall back to the model as given
+        return model_path;
+    }
+
+    return variant_path.string();
+}
+
+size_t piper2_resolve_model_variant(const char *model_path,
+                                    const char *precision, char *path,
+                                    size_t path_size) {
+    if (!model_path) {
+        return 0;
+    }
+
+    std::string variant_path = resolve_model_variant(model_path, precision);
+    if (path && (path_size > 0)) {
+        std::size_t length = std::min(variant_path.size(), path_size - 1);
+        std::memcpy(path, variant_path.data(), length);
+        path[length] = '\0';
+    }
+
+    return variant_path.size();
+}
+
+std::shared_ptr<Ort::Session>
+load_session(const std::string &model_path,
+             const Ort::SessionOptions &session_options, bool map_model) {
+    if (map_model) {
+        auto model_file = map_file(model_path);
+        if (model_file) {
+            // The mapping must outlive the session
+            Ort::SessionOptions mapped_options = session_options.Clone();
+            mapped_options.AddConfigEntry("session.use_ort_model_bytes_directly",
+                                          "1");
+            mapped_options.AddConfigEntry(
+                "session.use_ort_model_bytes_for_initializers", "1");
+
+            return std::shared_ptr<Ort::Session>(
+                new Ort::Session(ort_env, model_file->data, model_file->size,
+                                 mapped_options),
+                [model_file](Ort::Session *session) { delete session; });
+        }
+    }
+
+    return std::make_shared<Ort::Session>(
+        Ort::Session(ort_env, model_path.c_str(), session_options));
+}
+
+// Load the phonemizer and stress sessions if they aren't loaded
+// (frontend_sessions_mutex held, or the synthesizer is still being created)
+static void load_frontend_sessions(const piper2_synthesizer *synth) {
+    if (synth->phonemizer_session && synth->stress_session) {
+        return;
+    }
+
+    auto load = [synth](const std::string &model_path) {
+        if (synth->frontend_session_loader) {
+            return synth->frontend_session_loader(model_path);
+        }
+
+        return load_session(model_path, synth->session_options,
+                            synth->map_models);
+    };
+
+    NumaNodeScope node_scope(synth->numa_node);
+    if (!synth->phonemizer_session) {
+        synth->phonemizer_session = load(synth->phonemizer_model_path);
+    }
+
+    if (!synth->stress_session) {
+        synth->stress_session = load(synth->stress_model_path);
+    }
+}
+
+// Get the phonemizer and stress sessions, loading them again if they were
+// unloaded while idle. The returned references keep them alive while in use.
+static void get_frontend_sessions(const piper2_synthesizer *synth,
+                                  std::shared_ptr<Ort::Session> &phonemizer,
+                                  std::shared_ptr<Ort::Session> &stress) {
+    if (synth->frontend_idle_unload ==
+        std::chrono::steady_clock::duration::zero()) {
+        // Never unloaded, so there's nothing to guard
+        phonemizer = synth->phonemizer_session;
+        stress = synth->stress_session;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(synth->frontend_sessions_mutex);
+    load_frontend_sessions(synth);
+
+    synth->frontend_last_used = std::chrono::steady_clock::now();
+    synth->frontend_unload_cond.notify_all();
+
+    phonemizer = synth->phonemizer_session;
+    stress = synth->stress_session;
+}
+
+// Unload the phonemizer and stress sessions after they've been idle
+static void frontend_unload_run(piper2_synthesizer *synth) {
+    std::unique_lock<std::mutex> lock(synth->frontend_sessions_mutex);
+    while (!synth->stopping) {
+        if (!synth->phonemizer_session && !synth->stress_session) {
+            synth->frontend_unload_cond.wait(lock);
+            continue;
+        }
+
+        auto unload_time =
+            synth->frontend_last_used + synth->frontend_idle_unload;
+        if (std::chrono::steady_clock::now() < unload_time) {
+            synth->frontend_unload_cond.wait_until(lock, unload_time);
+            continue;
+        }
+
+        // Sentences in progress hold their own references
+        synth->phonemizer_session.reset();
+        synth->stress_session.reset();
+    }
+}
+
+piper2_synthesizer *
+create_synthesizer(const char *locale, const char *voice_model_path,
+                   const char *voice_config_path,
+                   const char *phonemizer_model_path,
+                   const char *phonemizer_config_path,
+                   const char *stress_model_path,
+                   const piper2_create_options *options,
+                   std::shared_ptr<Ort::Session> phonemizer_session,
+                   std::shared_ptr<Ort::Session> stress_session) {
 
     if (!voice_model_path || !phonemizer_model_path || !stress_model_path) {
         return nullptr;
     }
 
+    piper2_create_options default_options = piper2_default_create_options();
+    if (!options) {
+        options = &default_options;
+    }
+
+    std::shared_ptr<Lexicon> lexicon;
+    if (options->lexicon_path) {
+        lexicon = open_lexicon(options->lexicon_path);
+        if (!lexicon) {
+            // Missing or invalid lexicon
+            return nullptr;
+        }
+    }
+
     // Resolve config paths
     std::string voice_config_path_str;
     if (!voice_config_path) {
@@ -197,31 +394,172 @@ piper2_synthesizer *piper2_create_phonemizer_stress(
     synth->phonemizer_stress_char = icu::UnicodeString::fromUTF8(
         phonemizer_config["stress_char"].get<std::string>());
 
+    synth->lexicon = lexicon;
+    synth->max_sentence_chars = options->max_sentence_chars;
+    synth->postprocess = options->postprocess;
+
     // Load ONNX models
     synth->session_options.DisableCpuMemArena();
     synth->session_options.DisableMemPattern();
     synth->session_options.DisableProfiling();
+    if (options->fork_safe) {
+        // Thread pool threads would not exist in forked processes
+        synth->session_options.SetIntraOpNumThreads(1);
+        synth->session_options.SetInterOpNumThreads(1);
+    }
+    synth->map_models = options->map_models;
+    synth->numa_node = options->numa_node;
 
-    synth->voice_session = std::make_unique<Ort::Session>(
-        Ort::Session(ort_env, voice_model_path, synth->session_options));
+    synth->shape_buckets = options->shape_buckets;
+    synth->voice_model_path =
+        resolve_model_variant(voice_model_path, options->voice_precision);
+    synth->cost_model = load_cost_model(synth->voice_model_path);
 
-    synth->phonemizer_session = std::make_unique<Ort::Session>(
-        Ort::Session(ort_env, phonemizer_model_path, synth->session_options));
+    {
+        // Input shapes repeat with buckets, so memory plans can be reused
+        Ort::SessionOptions voice_session_options =
+            synth->session_options.Clone();
+        if (synth->shape_buckets) {
+            voice_session_options.EnableCpuMemArena();
+            voice_session_options.EnableMemPattern();
+        }
 
-    synth->stress_session = std::make_unique<Ort::Session>(
-        Ort::Session(ort_env, stress_model_path, synth->session_options));
+        NumaNodeScope node_scope(synth->numa_node);
+        synth->voice_session = load_session(
+            synth->voice_model_path, voice_session_options, synth->map_models);
+    }
+    synth->voice_model_bytes = get_file_size(synth->voice_model_path);
+
+    // Phonemizer and stress sessions may already be loaded for another voice
+    synth->phonemizer_model_path = resolve_model_variant(
+        phonemizer_model_path, options->phonemizer_precision);
+    synth->stress_model_path =
+        resolve_model_variant(stress_model_path, options->stress_precision);
+    synth->frontend_model_bytes = get_file_size(synth->phonemizer_model_path) +
+                                  get_file_size(synth->stress_model_path);
+
+    synth->phonemizer_session = phonemizer_session;
+    synth->stress_session = stress_session;
+    load_frontend_sessions(synth);
+    synth->frontend_last_used = std::chrono::steady_clock::now();
+
+    if ((options->frontend_idle_unload_seconds > 0) && !options->fork_safe) {
+        synth->frontend_idle_unload =
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<float>(
+                    options->frontend_idle_unload_seconds));
+        synth->frontend_unload_thread =
+            std::thread(frontend_unload_run, synth);
+    }
+
+    update_peak_resident(synth);
 
     return synth;
 }
 
+piper2_create_options piper2_default_create_options(void) {
+    piper2_create_options options;
+    options.lexicon_path = nullptr;
+    options.map_models = false;
+    options.max_sentence_chars = 0;
+    options.frontend_idle_unload_seconds = 0;
+    options.numa_node = -1;
+    options.shape_buckets = false;
+    options.voice_precision = nullptr;
+    options.phonemizer_precision = nullptr;
+    options.stress_precision = nullptr;
+
+    options.postprocess.enabled = false;
+    options.postprocess.remove_dc = true;
+    options.postprocess.normalize = true;
+    options.postprocess.target_loudness_db = -20.0f;
+    options.postprocess.max_gain_db = 12.0f;
+    options.postprocess.peak_limit = 0.95f;
+    options.postprocess.fade_ms = 5.0f;
+
+    options.fork_safe = false;
+
+    return options;
+}
+
+piper2_create_options piper2_low_memory_create_options(void) {
+    piper2_create_options options = piper2_default_create_options();
+    options.map_models = true;
+    options.max_sentence_chars = 200;
+    options.frontend_idle_unload_seconds = 30;
+
+    return options;
+}
+
+piper2_synthesizer *piper2_create_phonemizer_stress(
+    const char *locale, const char *voice_model_path,
+    const char *voice_config_path, const char *phonemizer_model_path,
+    const char *phonemizer_config_path, const char *stress_model_path) {
+    return create_synthesizer(locale, voice_model_path, voice_config_path,
+                              phonemizer_model_path, phonemizer_config_path,
+                              stress_model_path, nullptr, nullptr, nullptr);
+}
+
+piper2_synthesizer *piper2_create_phonemizer_stress_with_options(
+    const char *locale, const char *voice_model_path,
+    const char *voice_config_path, const char *phonemizer_model_path,
+    const char *phonemizer_config_path, const char *stress_model_path,
+    const piper2_create_options *options) {
+    return create_synthesizer(locale, voice_model_path, voice_config_path,
+                              phonemizer_model_path, phonemizer_config_path,
+                              stress_model_path, options, nullptr, nullptr);
+}
+
 void piper2_free(struct piper2_synthesizer *synth) {
     if (!synth) {
         return;
     }
 
+    if (synth->frontend_unload_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(synth->frontend_sessions_mutex);
+            synth->stopping = true;
+        }
+        synth->frontend_unload_cond.notify_all();
+        synth->frontend_unload_thread.join();
+    }
+
     delete synth;
 }
 
+int piper2_get_memory_usage(piper2_synthesizer *synth,
+                            piper2_memory_usage *usage) {
+    if (!synth || !usage) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    usage->model_bytes = synth->voice_model_bytes;
+    {
+        std::lock_guard<std::mutex> lock(synth->frontend_sessions_mutex);
+        if (synth->phonemizer_session) {
+            usage->model_bytes += synth->frontend_model_bytes;
+        }
+    }
+
+    usage->resident_bytes = get_resident_bytes();
+    usage->peak_resident_bytes = synth->peak_resident_bytes.load();
+
+    return PIPER2_OK;
+}
+
+int piper2_set_capture(piper2_synthesizer *synth, piper2_capture *capture,
+                       const char *voice_name) {
+    if (!synth) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    synth->capture.end(CAPTURE_STATUS_CANCELLED);
+    synth->capture_log = capture;
+    synth->capture_voice = voice_name ? voice_name : "";
+
+    return PIPER2_OK;
+}
+
 piper2_synthesize_options
 piper2_default_synthesize_options(piper2_synthesizer *synth) {
     piper2_synthesize_options options;
@@ -239,29 +577,77 @@ piper2_default_synthesize_options(piper2_synthesizer *synth) {
     return options;
 }
 
-int piper2_synthesize_start(struct piper2_synthesizer *synth, const char *text,
-                            const piper2_synthesize_options *options) {
-    if (!synth) {
-        return PIPER2_ERR_GENERIC;
+SynthesisParams make_synthesis_params(piper2_synthesizer *synth,
+                                      const piper2_synthesize_options *options) {
+    piper2_synthesize_options default_options;
+    if (!options) {
+        default_options = piper2_default_synthesize_options(synth);
+        options = &default_options;
     }
 
-    // Clear state
-    while (!synth->char_id_queue.empty()) {
-        synth->char_id_queue.pop();
+    SynthesisParams params;
+    params.length_scale = options->length_scale;
+    params.noise_scale = options->noise_scale;
+    params.noise_w_scale = options->noise_w_scale;
+    params.speaker_id = options->speaker_id;
+
+    return params;
+}
+
+// Append a sentence, splitting it at word boundaries into pieces of at most
+// max_chars characters (0 = no limit).
+static void append_sentence(std::vector<Sentence> &sentences,
+                            Sentence sentence,
+                            const std::vector<std::size_t> &word_starts,
+                            std::size_t max_chars) {
+    std::size_t num_chars = sentence.char_ids.size();
+    if ((max_chars == 0) || (num_chars <= max_chars)) {
+        sentences.push_back(std::move(sentence));
+        return;
     }
-    synth->chunk_samples.clear();
 
-    std::unique_ptr<piper2_synthesize_options> default_options;
-    if (!options) {
-        default_options = std::make_unique<piper2_synthesize_options>(
-            piper2_default_synthesize_options(synth));
-        options = default_options.get();
+    std::size_t piece_start = 0;
+    std::size_t lexicon_idx = 0;
+    while (piece_start < num_chars) {
+        std::size_t piece_end = std::min(piece_start + max_chars, num_chars);
+        if (piece_end < num_chars) {
+            // Break at the last word that fits, or in the middle of a word
+            // that is longer than the limit.
+            auto word_iter = std::upper_bound(word_starts.begin(),
+                                              word_starts.end(), piece_end);
+            if ((word_iter != word_starts.begin()) &&
+                (*(word_iter - 1) > piece_start)) {
+                piece_end = *(word_iter - 1);
+            }
+        }
+
+        Sentence piece;
+        piece.char_ids.assign(sentence.char_ids.begin() + piece_start,
+                              sentence.char_ids.begin() + piece_end);
+
+        while ((lexicon_idx < sentence.lexicon_words.size()) &&
+               (sentence.lexicon_words[lexicon_idx].char_start < piece_end)) {
+            auto &word = sentence.lexicon_words[lexicon_idx];
+            if (word.char_end <= piece_end) {
+                piece.lexicon_words.push_back(
+                    LexiconWord{word.char_start - piece_start,
+                                word.char_end - piece_start, word.phonemes});
+            }
+            // A word that was split is phonemized from its characters
+
+            ++lexicon_idx;
+        }
+
+        sentences.push_back(std::move(piece));
+        piece_start = piece_end;
     }
+}
 
-    synth->length_scale = options->length_scale;
-    synth->noise_scale = options->noise_scale;
-    synth->noise_w_scale = options->noise_w_scale;
-    synth->speaker_id = options->speaker_id;
+std::vector<Sentence> text_to_sentences(piper2_synthesizer *synth,
+                                        const char *text) {
+    std::lock_guard<std::mutex> lock(synth->frontend_mutex);
+    TraceScope segmentation_trace(TRACE_SEGMENTATION);
+    std::vector<Sentence> sentences;
 
     // Normalize text (remove accents, NFC)
     auto text_unicode = icu::UnicodeString::fromUTF8(text).toLower();
@@ -300,6 +686,8 @@ int piper2_synthesize_start(struct piper2_synthesizer *synth, const char *text,
 
             bool is_number = false;
             if (word_iter->getRuleStatus() == UBRK_WORD_NUMBER) {
+                TraceScope number_trace(TRACE_NUMBER_FORMAT);
+
                 // Attempt to parse as a number
                 icu::Formattable number_result;
                 UErrorCode number_status = U_ZERO_ERROR;
@@ -358,7 +746,11 @@ int piper2_synthesize_start(struct piper2_synthesizer *synth, const char *text,
 
         // Split into characters (graphemes)
         std::vector<CharId> sen_char_ids;
+        std::vector<LexiconWord> sen_lexicon_words;
+        std::vector<std::size_t> sen_word_starts;
         for (auto word_text : words) {
+            std::size_t word_char_start = sen_char_ids.size();
+            sen_word_starts.push_back(word_char_start);
             char_iter->setText(word_text);
             int char_start = 0;
             int32_t char_end = char_iter->next();
@@ -384,50 +776,92 @@ int piper2_synthesize_start(struct piper2_synthesizer *synth, const char *text,
                 char_end = char_iter->next();
             } // for each character
 
+            if (synth->lexicon && (sen_char_ids.size() > word_char_start)) {
+                // Look up pronunciation
+                std::string word_str;
+                word_text.toUTF8String(word_str);
+                auto lexicon_phonemes = synth->lexicon->lookup(word_str);
+                if (lexicon_phonemes) {
+                    sen_lexicon_words.push_back(LexiconWord{
+                        word_char_start, sen_char_ids.size(),
+                        icu::UnicodeString::fromUTF8(icu::StringPiece(
+                            lexicon_phonemes->data(),
+                            (int32_t)lexicon_phonemes->size()))});
+                }
+            }
         } // for each word
 
-        synth->char_id_queue.emplace(sen_char_ids);
+        append_sentence(
+            sentences,
+            Sentence{std::move(sen_char_ids), std::move(sen_lexicon_words)},
+            sen_word_starts, synth->max_sentence_chars);
 
         // Next sentence
         sen_start = sen_end;
         sen_end = sen_iter->next();
     } // for each sentence
 
-    return PIPER2_OK;
+    return sentences;
 }
 
-int piper2_synthesize_next(struct piper2_synthesizer *synth,
-                           struct piper2_audio_chunk *chunk) {
-    if (!synth || !chunk) {
+int piper2_synthesize_start(struct piper2_synthesizer *synth, const char *text,
+                            const piper2_synthesize_options *options) {
+    if (!synth || !text) {
         return PIPER2_ERR_GENERIC;
     }
 
-    // Clear data from previous call
-    synth->chunk_samples.clear();
-    synth->chunk_chars = "";
-    synth->chunk_phonemes = "";
-    synth->chunk_phoneme_ids.clear();
+    // Clear state
+    while (!synth->sentence_queue.empty()) {
+        synth->sentence_queue.pop();
+    }
+    synth->chunk_audio.samples.clear();
 
-    chunk->sample_rate = synth->sample_rate;
-    chunk->samples = nullptr;
-    chunk->num_samples = 0;
-    chunk->is_last = false;
+    synth->params = make_synthesis_params(synth, options);
+    synth->postprocess_state = PostprocessState();
+    synth->capture.begin(synth->capture_log, synth->capture_voice, text,
+                         CAPTURE_NO_PRIORITY, 0, synth->params.speaker_id,
+                         synth->params.length_scale, synth->params.noise_scale,
+                         synth->params.noise_w_scale);
 
-    if (synth->char_id_queue.empty()) {
-        // Empty final chunk
-        chunk->is_last = true;
-        return PIPER2_DONE;
+    synth->trace_request_id = new_trace_request_id();
+    synth->trace_sentence_idx = 0;
+    TraceContextScope trace_scope(synth->trace_request_id, TRACE_NO_SENTENCE);
+
+    for (auto &sentence : text_to_sentences(synth, text)) {
+        synth->sentence_queue.push(std::move(sentence));
     }
 
-    // Process next list of phoneme ids
-    auto next_char_ids = std::move(synth->char_id_queue.front());
-    synth->char_id_queue.pop();
+    return PIPER2_OK;
+}
 
-    icu::UnicodeString chunk_chars_unicode;
-    for (auto char_id : next_char_ids) {
-        chunk_chars_unicode.append(synth->phonemizer_id_char_map[char_id]);
+// Run the phonemizer and stress models on characters, appending phonemes
+static int phonemize_char_ids(const piper2_synthesizer *synth,
+                              std::vector<CharId> &char_ids,
+                              std::vector<icu::UnicodeString> &phonemes) {
+    // Runs of spaces and punctuation map directly to phonemes
+    bool is_trivial = true;
+    std::vector<icu::UnicodeString> trivial_phonemes;
+    for (auto char_id : char_ids) {
+        auto id_char_iter = synth->phonemizer_id_char_map.find(char_id);
+        if ((id_char_iter == synth->phonemizer_id_char_map.end()) ||
+            u_isalpha(id_char_iter->second.char32At(0)) ||
+            (synth->phonemizer_phoneme_id_map.count(id_char_iter->second) ==
+             0)) {
+            is_trivial = false;
+            break;
+        }
+
+        trivial_phonemes.push_back(id_char_iter->second);
+    }
+
+    if (is_trivial) {
+        phonemes.insert(phonemes.end(), trivial_phonemes.begin(),
+                        trivial_phonemes.end());
+        return PIPER2_OK;
     }
-    chunk_chars_unicode.toUTF8String(synth->chunk_chars);
+
+    std::shared_ptr<Ort::Session> phonemizer_session, stress_session;
+    get_frontend_sessions(synth, phonemizer_session, stress_session);
 
     auto memoryInfo = Ort::MemoryInfo::CreateCpu(
         OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
@@ -439,16 +873,16 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
 
     {
         std::vector<Ort::Value> input_tensors;
-        std::vector<int64_t> char_ids_shape{1, (int64_t)next_char_ids.size()};
+        std::vector<int64_t> char_ids_shape{1, (int64_t)char_ids.size()};
         input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
-            memoryInfo, next_char_ids.data(), next_char_ids.size(),
+            memoryInfo, char_ids.data(), char_ids.size(),
             char_ids_shape.data(), char_ids_shape.size()));
 
         std::array<const char *, 1> input_names = {"input_ids"};
 
         // Get all output names
         std::vector<std::string> output_names_strs =
-            synth->phonemizer_session->GetOutputNames();
+            phonemizer_session->GetOutputNames();
 
         std::vector<const char *> output_names;
         for (const auto &name : output_names_strs) {
@@ -456,15 +890,19 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
         }
 
         // char ids -> phoneme ids
-        auto output_tensors = synth->phonemizer_session->Run(
+        int64_t phonemizer_begin = trace_begin();
+        auto output_tensors = phonemizer_session->Run(
             Ort::RunOptions{nullptr}, input_names.data(), input_tensors.data(),
             input_tensors.size(), output_names.data(), output_names.size());
+        trace_end(TRACE_PHONEMIZER, phonemizer_begin);
 
         if ((output_tensors.size() < 1) ||
             (!output_tensors.front().IsTensor())) {
             return PIPER2_ERR_GENERIC;
         }
 
+        update_peak_resident(synth);
+
         auto output_shape =
             output_tensors.front().GetTensorTypeAndShapeInfo().GetShape();
         auto num_logits = output_shape[output_shape.size() - 2];
@@ -520,8 +958,6 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
     // ------
     // Stress
     // ------
-    std::vector<icu::UnicodeString> phonemes;
-
     {
         std::vector<Ort::Value> input_tensors;
         std::vector<int64_t> phoneme_ids_shape{1, (int64_t)phoneme_ids.size()};
@@ -533,7 +969,7 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
 
         // Get all output names
         std::vector<std::string> output_names_strs =
-            synth->phonemizer_session->GetOutputNames();
+            phonemizer_session->GetOutputNames();
 
         std::vector<const char *> output_names;
         for (const auto &name : output_names_strs) {
@@ -541,9 +977,11 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
         }
 
         // phoneme_ids -> stress probability
-        auto output_tensors = synth->stress_session->Run(
+        int64_t stress_begin = trace_begin();
+        auto output_tensors = stress_session->Run(
             Ort::RunOptions{nullptr}, input_names.data(), input_tensors.data(),
             input_tensors.size(), output_names.data(), output_names.size());
+        trace_end(TRACE_STRESS, stress_begin);
 
         if ((output_tensors.size() < 1) ||
             (!output_tensors.front().IsTensor())) {
@@ -569,8 +1007,12 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
                 }
 
                 auto phoneme_id = phoneme_ids[prob_idx];
-                phonemes.push_back(
-                    synth->phonemizer_id_phoneme_map[phoneme_id]);
+                auto id_phoneme_iter =
+                    synth->phonemizer_id_phoneme_map.find(phoneme_id);
+                if (id_phoneme_iter !=
+                    synth->phonemizer_id_phoneme_map.end()) {
+                    phonemes.push_back(id_phoneme_iter->second);
+                }
             }
         }
 
@@ -584,135 +1026,378 @@ int piper2_synthesize_next(struct piper2_synthesizer *synth,
         }
     } // stress
 
+    return PIPER2_OK;
+}
+
+// Voice model input padded to a bucket length.
+// Taken from the synthesizer's spare buffers and given back when done.
+struct BucketBuffer {
+    const piper2_synthesizer *synth = nullptr;
+    std::vector<PhonemeId> ids;
+
+    BucketBuffer(const piper2_synthesizer *synth, std::size_t length)
+        : synth(synth) {
+        std::size_t bucket_length = MIN_BUCKET_LENGTH;
+        while (bucket_length < length) {
+            bucket_length *= 2;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(synth->bucket_buffers_mutex);
+            auto &spare_buffers = synth->bucket_buffers[bucket_length];
+            if (!spare_buffers.empty()) {
+                ids = std::move(spare_buffers.back());
+                spare_buffers.pop_back();
+            }
+        }
+
+        ids.resize(bucket_length);
+    }
+
+    ~BucketBuffer() {
+        std::lock_guard<std::mutex> lock(synth->bucket_buffers_mutex);
+        auto &spare_buffers = synth->bucket_buffers[ids.size()];
+        if (spare_buffers.size() < MAX_BUCKET_BUFFERS) {
+            spare_buffers.push_back(std::move(ids));
+        }
+    }
+};
+
+int phonemize_sentence(const piper2_synthesizer *synth,
+                       const Sentence &sentence, SentenceAudio &audio,
+                       std::vector<PhonemeId> &syn_phoneme_ids) {
+    audio.samples.clear();
+    audio.chars = "";
+    audio.phonemes = "";
+    audio.phoneme_ids.clear();
+    syn_phoneme_ids.clear();
+
+    // Not shared with other threads
+    UErrorCode status = U_ZERO_ERROR;
+
+    icu::UnicodeString chunk_chars_unicode;
+    for (auto char_id : sentence.char_ids) {
+        auto id_char_iter = synth->phonemizer_id_char_map.find(char_id);
+        if (id_char_iter != synth->phonemizer_id_char_map.end()) {
+            chunk_chars_unicode.append(id_char_iter->second);
+        }
+    }
+    chunk_chars_unicode.toUTF8String(audio.chars);
+
+    // Words from the lexicon skip the phonemizer and stress models, so only
+    // the characters between them are phonemized.
+    std::vector<icu::UnicodeString> phonemes;
+    std::size_t char_idx = 0;
+    for (std::size_t word_idx = 0; word_idx <= sentence.lexicon_words.size();
+         ++word_idx) {
+        bool is_lexicon_word = (word_idx < sentence.lexicon_words.size());
+        std::size_t run_end = is_lexicon_word
+                                  ? sentence.lexicon_words[word_idx].char_start
+                                  : sentence.char_ids.size();
+
+        if (run_end > char_idx) {
+            std::vector<CharId> run_char_ids(
+                sentence.char_ids.begin() + char_idx,
+                sentence.char_ids.begin() + run_end);
+            int result = phonemize_char_ids(synth, run_char_ids, phonemes);
+            if (result != PIPER2_OK) {
+                return result;
+            }
+        }
+
+        if (is_lexicon_word) {
+            phonemes.push_back(sentence.lexicon_words[word_idx].phonemes);
+            char_idx = sentence.lexicon_words[word_idx].char_end;
+        }
+    }
+
     icu::UnicodeString chunk_phonemes_unicode;
     for (auto phoneme : phonemes) {
         chunk_phonemes_unicode.append(phoneme);
     }
-    chunk_phonemes_unicode.toUTF8String(synth->chunk_phonemes);
+    chunk_phonemes_unicode.toUTF8String(audio.phonemes);
 
-    // ---------
-    // Synthesis
-    // ---------
+    auto codepoint_iter = std::unique_ptr<icu::BreakIterator>(
+        icu::BreakIterator::createCharacterInstance(synth->locale, status));
 
-    {
-        auto codepoint_iter = std::unique_ptr<icu::BreakIterator>(
-            icu::BreakIterator::createCharacterInstance(synth->locale,
-                                                        synth->status));
-
-        // voice model expects NFD codepoints as phonemes
-        std::vector<PhonemeId> syn_phoneme_ids{ID_BOS, ID_PAD};
-        for (auto phoneme : phonemes) {
-            phoneme = synth->normalizer_nfd->normalize(phoneme, synth->status);
-            codepoint_iter->setText(phoneme);
-
-            int codepoint_start = 0;
-            int32_t codepoint_end = codepoint_iter->next();
-            while (codepoint_end != icu::BreakIterator::DONE) {
-                auto codepoint_text = icu::UnicodeString(
-                    phoneme, codepoint_start, codepoint_end - codepoint_start);
-
-                auto phoneme_id_iter = synth->voice_phoneme_id_map.find(
-                    codepoint_text.char32At(0));
-                if (phoneme_id_iter != synth->voice_phoneme_id_map.end()) {
-                    for (auto phoneme_id : phoneme_id_iter->second) {
-                        syn_phoneme_ids.push_back(phoneme_id);
-                        syn_phoneme_ids.push_back(ID_PAD);
-                    }
+    // voice model expects NFD codepoints as phonemes
+    syn_phoneme_ids.push_back(ID_BOS);
+    syn_phoneme_ids.push_back(ID_PAD);
+    for (auto phoneme : phonemes) {
+        phoneme = synth->normalizer_nfd->normalize(phoneme, status);
+        codepoint_iter->setText(phoneme);
+
+        int codepoint_start = 0;
+        int32_t codepoint_end = codepoint_iter->next();
+        while (codepoint_end != icu::BreakIterator::DONE) {
+            auto codepoint_text = icu::UnicodeString(
+                phoneme, codepoint_start, codepoint_end - codepoint_start);
+
+            auto phoneme_id_iter =
+                synth->voice_phoneme_id_map.find(codepoint_text.char32At(0));
+            if (phoneme_id_iter != synth->voice_phoneme_id_map.end()) {
+                for (auto phoneme_id : phoneme_id_iter->second) {
+                    syn_phoneme_ids.push_back(phoneme_id);
+                    syn_phoneme_ids.push_back(ID_PAD);
                 }
+            }
+
+            // Next codepoint
+            codepoint_start = codepoint_end;
+            codepoint_end = codepoint_iter->next();
+        } // for each codepoint
+    }
+    syn_phoneme_ids.push_back(ID_EOS);
+
+    for (auto phoneme_id : syn_phoneme_ids) {
+        audio.phoneme_ids.push_back(phoneme_id);
+    }
+
+    return PIPER2_OK;
+}
 
-                // Next codepoint
-                codepoint_start = codepoint_end;
-                codepoint_end = codepoint_iter->next();
-            } // for each codepoint
+int run_voice_model(const piper2_synthesizer *synth,
+                    const std::vector<PhonemeId> &syn_phoneme_ids,
+                    const SynthesisParams &params,
+                    const std::vector<SpeakerId> &speaker_ids,
+                    std::vector<std::vector<float>> &samples,
+                    const SampleSink *sink) {
+    std::size_t batch_size = std::max<std::size_t>(1, speaker_ids.size());
+    if (sink && (batch_size > 1)) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    samples.resize(batch_size);
+
+    auto memoryInfo = Ort::MemoryInfo::CreateCpu(
+        OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
+
+    // Padding past input_lengths is masked out by the model, so it gets
+    // no duration and doesn't change the audio.
+    std::optional<BucketBuffer> bucket_buffer;
+    const PhonemeId *input_ids = syn_phoneme_ids.data();
+    std::size_t input_length = syn_phoneme_ids.size();
+    if (synth->shape_buckets) {
+        bucket_buffer.emplace(synth, syn_phoneme_ids.size());
+        auto &padded_ids = bucket_buffer->ids;
+        std::copy(syn_phoneme_ids.begin(), syn_phoneme_ids.end(),
+                  padded_ids.begin());
+        std::fill(padded_ids.begin() + syn_phoneme_ids.size(),
+                  padded_ids.end(), ID_PAD);
+        input_ids = padded_ids.data();
+        input_length = padded_ids.size();
+    }
+
+    // Every item in the batch has the same phoneme ids
+    std::vector<PhonemeId> batch_ids;
+    if (batch_size > 1) {
+        batch_ids.reserve(batch_size * input_length);
+        for (std::size_t i = 0; i < batch_size; ++i) {
+            batch_ids.insert(batch_ids.end(), input_ids,
+                             input_ids + input_length);
         }
-        syn_phoneme_ids.push_back(ID_EOS);
+        input_ids = batch_ids.data();
+    }
 
-        std::vector<int64_t> phoneme_id_lengths{
-            (int64_t)syn_phoneme_ids.size()};
-        std::vector<float> scales{synth->noise_scale, synth->length_scale,
-                                  synth->noise_w_scale};
-        std::vector<Ort::Value> input_tensors;
-        std::vector<int64_t> phoneme_ids_shape{1,
-                                               (int64_t)syn_phoneme_ids.size()};
-        input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
-            memoryInfo, syn_phoneme_ids.data(), syn_phoneme_ids.size(),
-            phoneme_ids_shape.data(), phoneme_ids_shape.size()));
+    std::vector<int64_t> phoneme_id_lengths(batch_size,
+                                            (int64_t)syn_phoneme_ids.size());
+    std::vector<float> scales{params.noise_scale, params.length_scale,
+                              params.noise_w_scale};
+    std::vector<Ort::Value> input_tensors;
+    std::vector<int64_t> phoneme_ids_shape{(int64_t)batch_size,
+                                           (int64_t)input_length};
+    input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
+        memoryInfo, const_cast<PhonemeId *>(input_ids),
+        batch_size * input_length, phoneme_ids_shape.data(),
+        phoneme_ids_shape.size()));
+
+    std::vector<int64_t> phoneme_id_lengths_shape{
+        (int64_t)phoneme_id_lengths.size()};
+    input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
+        memoryInfo, phoneme_id_lengths.data(), phoneme_id_lengths.size(),
+        phoneme_id_lengths_shape.data(), phoneme_id_lengths_shape.size()));
+
+    std::vector<int64_t> scales_shape{(int64_t)scales.size()};
+    input_tensors.push_back(Ort::Value::CreateTensor<float>(
+        memoryInfo, scales.data(), scales.size(), scales_shape.data(),
+        scales_shape.size()));
+
+    // Add speaker ids.
+    // NOTE: These must be kept outside the "if" below to avoid being
+    // deallocated.
+    std::vector<int64_t> speaker_id{(int64_t)params.speaker_id};
+    if (!speaker_ids.empty()) {
+        speaker_id.assign(speaker_ids.begin(), speaker_ids.end());
+    }
+    std::vector<int64_t> speaker_id_shape{(int64_t)speaker_id.size()};
 
-        std::vector<int64_t> phoneme_id_lengths_shape{
-            (int64_t)phoneme_id_lengths.size()};
+    if (synth->num_speakers > 1) {
         input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
-            memoryInfo, phoneme_id_lengths.data(), phoneme_id_lengths.size(),
-            phoneme_id_lengths_shape.data(), phoneme_id_lengths_shape.size()));
+            memoryInfo, speaker_id.data(), speaker_id.size(),
+            speaker_id_shape.data(), speaker_id_shape.size()));
+    }
 
-        std::vector<int64_t> scales_shape{(int64_t)scales.size()};
-        input_tensors.push_back(Ort::Value::CreateTensor<float>(
-            memoryInfo, scales.data(), scales.size(), scales_shape.data(),
-            scales_shape.size()));
+    // From export_onnx.py
+    std::array<const char *, 4> input_names = {"input", "input_lengths",
+                                               "scales", "sid"};
 
-        // Add speaker id.
-        // NOTE: These must be kept outside the "if" below to avoid being
-        // deallocated.
-        std::vector<int64_t> speaker_id{(int64_t)synth->speaker_id};
-        std::vector<int64_t> speaker_id_shape{(int64_t)speaker_id.size()};
+    // Get all output names
+    std::vector<std::string> output_names_strs =
+        synth->voice_session->GetOutputNames();
+    std::vector<const char *> output_names;
+    for (const auto &name : output_names_strs) {
+        output_names.push_back(name.c_str());
+    }
 
-        if (synth->num_speakers > 1) {
-            input_tensors.push_back(Ort::Value::CreateTensor<int64_t>(
-                memoryInfo, speaker_id.data(), speaker_id.size(),
-                speaker_id_shape.data(), speaker_id_shape.size()));
-        }
+    // Infer
+    int64_t voice_begin = trace_begin();
+    auto output_tensors = synth->voice_session->Run(
+        Ort::RunOptions{nullptr}, input_names.data(), input_tensors.data(),
+        input_tensors.size(), output_names.data(), output_names.size());
+    trace_end(TRACE_VOICE, voice_begin);
 
-        // From export_onnx.py
-        std::array<const char *, 4> input_names = {"input", "input_lengths",
-                                                   "scales", "sid"};
+    if ((output_tensors.size() < 1) || (!output_tensors.front().IsTensor())) {
+        return PIPER2_ERR_GENERIC;
+    }
 
-        // Get all output names
-        std::vector<std::string> output_names_strs =
-            synth->voice_session->GetOutputNames();
-        std::vector<const char *> output_names;
-        for (const auto &name : output_names_strs) {
-            output_names.push_back(name.c_str());
+    // Scratch memory is at its largest while the audio is alive
+    update_peak_resident(synth);
+
+    // [batch, 1, samples], padded to the longest item
+    auto audio_info = output_tensors.front().GetTensorTypeAndShapeInfo();
+    std::size_t num_samples = audio_info.GetElementCount() / batch_size;
+
+    // [batch] frames, if the export has them
+    const int64_t *item_frames = nullptr;
+    for (std::size_t i = 1; i < output_names_strs.size(); ++i) {
+        if ((output_names_strs[i] == VOICE_LENGTHS_OUTPUT) &&
+            output_tensors[i].IsTensor()) {
+            auto lengths_info = output_tensors[i].GetTensorTypeAndShapeInfo();
+            if ((lengths_info.GetElementType() ==
+                 ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64) &&
+                (lengths_info.GetElementCount() == batch_size)) {
+                item_frames = output_tensors[i].GetTensorData<int64_t>();
+            }
         }
+    }
 
-        // Infer
-        auto output_tensors = synth->voice_session->Run(
-            Ort::RunOptions{nullptr}, input_names.data(), input_tensors.data(),
-            input_tensors.size(), output_names.data(), output_names.size());
+    int result = PIPER2_OK;
+    float *audio_tensor_data =
+        output_tensors.front().GetTensorMutableData<float>();
+    if (sink) {
+        TraceScope copy_out_trace(TRACE_COPY_OUT);
+        result = (*sink)(audio_tensor_data, num_samples);
+    } else {
+        TraceScope copy_out_trace(TRACE_COPY_OUT);
+        for (std::size_t i = 0; i < batch_size; ++i) {
+            std::size_t item_samples = num_samples;
+            if (item_frames && (item_frames[i] >= 0)) {
+                item_samples =
+                    std::min(num_samples,
+                             (std::size_t)item_frames[i] * VOICE_HOP_LENGTH);
+            }
 
-        if ((output_tensors.size() < 1) ||
-            (!output_tensors.front().IsTensor())) {
-            return PIPER2_ERR_GENERIC;
+            const float *item_data = audio_tensor_data + (i * num_samples);
+            samples[i].assign(item_data, item_data + item_samples);
         }
+    }
 
-        auto audio_shape =
-            output_tensors.front().GetTensorTypeAndShapeInfo().GetShape();
-        chunk->num_samples = audio_shape[audio_shape.size() - 1];
+    // Clean up
+    for (std::size_t i = 0; i < output_tensors.size(); i++) {
+        Ort::detail::OrtRelease(output_tensors[i].release());
+    }
 
-        const float *audio_tensor_data =
-            output_tensors.front().GetTensorData<float>();
-        synth->chunk_samples.resize(chunk->num_samples);
-        std::copy(audio_tensor_data, audio_tensor_data + chunk->num_samples,
-                  synth->chunk_samples.begin());
-        chunk->samples = synth->chunk_samples.data();
-        chunk->chars = synth->chunk_chars.c_str();
-        chunk->phonemes = synth->chunk_phonemes.c_str();
+    for (std::size_t i = 0; i < input_tensors.size(); i++) {
+        Ort::detail::OrtRelease(input_tensors[i].release());
+    }
+
+    return result;
+}
 
-        for (auto phoneme_id : syn_phoneme_ids) {
-            synth->chunk_phoneme_ids.push_back(phoneme_id);
+bool voice_model_reports_lengths(const piper2_synthesizer *synth) {
+    for (const auto &name : synth->voice_session->GetOutputNames()) {
+        if (name == VOICE_LENGTHS_OUTPUT) {
+            return true;
         }
-        chunk->phoneme_ids = synth->chunk_phoneme_ids.data();
-        chunk->num_phoneme_ids = synth->chunk_phoneme_ids.size();
+    }
 
-        chunk->is_last = synth->char_id_queue.empty();
+    return false;
+}
 
-        // Clean up
-        for (std::size_t i = 0; i < output_tensors.size(); i++) {
-            Ort::detail::OrtRelease(output_tensors[i].release());
-        }
+int synthesize_sentence(const piper2_synthesizer *synth,
+                        const Sentence &sentence,
+                        const SynthesisParams &params, SentenceAudio &audio) {
+    std::vector<PhonemeId> syn_phoneme_ids;
+    int result = phonemize_sentence(synth, sentence, audio, syn_phoneme_ids);
+    if (result != PIPER2_OK) {
+        return result;
+    }
 
-        for (std::size_t i = 0; i < input_tensors.size(); i++) {
-            Ort::detail::OrtRelease(input_tensors[i].release());
-        }
+    std::vector<std::vector<float>> samples(1);
+    samples[0] = std::move(audio.samples);
+    result = run_voice_model(synth, syn_phoneme_ids, params, {}, samples);
+    audio.samples = std::move(samples[0]);
+
+    return result;
+}
+
+void fill_audio_chunk(const piper2_synthesizer *synth,
+                      const SentenceAudio &audio, piper2_audio_chunk *chunk) {
+    chunk->sample_rate = synth->sample_rate;
+    chunk->samples = audio.samples.data();
+    chunk->num_samples = audio.samples.size();
+    chunk->is_last = false;
+    chunk->chars = audio.chars.c_str();
+    chunk->phonemes = audio.phonemes.c_str();
+    chunk->phoneme_ids = audio.phoneme_ids.data();
+    chunk->num_phoneme_ids = audio.phoneme_ids.size();
+}
+
+int piper2_synthesize_next(struct piper2_synthesizer *synth,
+                           struct piper2_audio_chunk *chunk) {
+    if (!synth || !chunk) {
+        return PIPER2_ERR_GENERIC;
     }
 
+    // Clear data from previous call
+    synth->chunk_audio.samples.clear();
+
+    chunk->sample_rate = synth->sample_rate;
+    chunk->samples = nullptr;
+    chunk->num_samples = 0;
+    chunk->is_last = false;
+
+    if (synth->sentence_queue.empty()) {
+        // Empty final chunk
+        chunk->is_last = true;
+        synth->capture.end(CAPTURE_STATUS_DONE);
+        return PIPER2_DONE;
+    }
+
+    // Process next sentence
+    auto sentence = std::move(synth->sentence_queue.front());
+    synth->sentence_queue.pop();
+
+    TraceContextScope trace_scope(synth->trace_request_id,
+                                  synth->trace_sentence_idx++);
+    int result = synthesize_sentence(synth, sentence, synth->params,
+                                     synth->chunk_audio);
+    if (result != PIPER2_OK) {
+        synth->capture.end(CAPTURE_STATUS_ERROR);
+        return result;
+    }
+
+    if (synth->postprocess.enabled) {
+        TraceScope postprocess_trace(TRACE_POSTPROCESS);
+        postprocess_chunk(synth->postprocess, synth->sample_rate,
+                          synth->postprocess_state,
+                          synth->chunk_audio.samples.data(),
+                          synth->chunk_audio.samples.size());
+    }
+
+    fill_audio_chunk(synth, synth->chunk_audio, chunk);
+    chunk->is_last = synth->sentence_queue.empty();
+    synth->capture.add_chunk(chunk->num_samples);
+
     return PIPER2_OK;
 }
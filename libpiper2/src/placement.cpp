@@ -0,0 +1,138 @@
+#include "piper2_placement.hpp"
+
+#include <sstream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(PIPER2_HAVE_NUMA)
+#include <numa.h>
+#endif
+
+std::optional<std::vector<int>> parse_cpu_list(const std::string &cpu_list) {
+    std::vector<int> cpus;
+    std::stringstream list_stream(cpu_list);
+    std::string range;
+    while (std::getline(list_stream, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+
+        try {
+            std::size_t dash_idx = range.find('-');
+            int first = std::stoi(range.substr(0, dash_idx));
+            int last = (dash_idx == std::string::npos)
+                           ? first
+                           : std::stoi(range.substr(dash_idx + 1));
+            if ((first < 0) || (last < first)) {
+                return std::nullopt;
+            }
+
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+    }
+
+    if (cpus.empty()) {
+        return std::nullopt;
+    }
+
+    return cpus;
+}
+
+#if defined(PIPER2_HAVE_NUMA)
+static std::vector<int> get_current_thread_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) ==
+        0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpu_set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    return cpus;
+}
+#endif
+
+bool pin_current_thread(const std::vector<int> &cpus) {
+#if defined(__linux__)
+    if (cpus.empty()) {
+        return false;
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        if ((cpu >= 0) && (cpu < CPU_SETSIZE)) {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                  &cpu_set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+bool bind_current_thread_to_node(int node) {
+#if defined(PIPER2_HAVE_NUMA)
+    if ((node < 0) || (numa_available() < 0) || (node > numa_max_node())) {
+        return false;
+    }
+
+    if (numa_run_on_node(node) != 0) {
+        return false;
+    }
+
+    numa_set_preferred(node);
+    return true;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+int numa_node_count() {
+#if defined(PIPER2_HAVE_NUMA)
+    if (numa_available() >= 0) {
+        return numa_max_node() + 1;
+    }
+#endif
+
+    return 1;
+}
+
+NumaNodeScope::NumaNodeScope(int node) {
+#if defined(PIPER2_HAVE_NUMA)
+    if (node < 0) {
+        return;
+    }
+
+    saved_cpus = get_current_thread_cpus();
+    bound = bind_current_thread_to_node(node);
+#else
+    (void)node;
+#endif
+}
+
+NumaNodeScope::~NumaNodeScope() {
+#if defined(PIPER2_HAVE_NUMA)
+    if (!bound) {
+        return;
+    }
+
+    numa_set_localalloc();
+    pin_current_thread(saved_cpus);
+#endif
+}
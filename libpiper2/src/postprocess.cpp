@@ -0,0 +1,329 @@
+#include "piper2_postprocess.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIPER2_POSTPROCESS_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIPER2_POSTPROCESS_NEON
+#endif
+
+// Time constants in seconds
+const float DC_TIME_CONSTANT = 0.2f;
+const float LOUDNESS_TIME_CONSTANT = 0.4f;
+const float GAIN_ATTACK_TIME_CONSTANT = 0.005f;
+const float GAIN_RELEASE_TIME_CONSTANT = 0.3f;
+
+// Blocks quieter than -50 dBFS don't count towards loudness
+const float SILENCE_MEAN_SQUARE = 1e-5f;
+
+// Fade multiplier for chunks without fades (large enough to always be 1)
+const float NO_FADE = 1e30f;
+
+// Per-block smoothing coefficients for a sample rate
+struct BlockCoefficients {
+    float dc = 0;
+    float loudness = 0;
+    float gain_attack = 0;
+    float gain_release = 0;
+};
+
+// Settings for samples within one block of a chunk
+struct SegmentParams {
+    float dc = 0;
+    float gain_from = 1.0f;
+    float gain_step = 0;
+    float inv_fade = NO_FADE;
+    float num_samples = 0; // in the chunk
+};
+
+struct SegmentStats {
+    float sum = 0;
+    float sum_squares = 0;
+    float peak = 0;
+};
+
+static float smoothing_coefficient(float block_seconds, float time_constant) {
+    return 1.0f - std::exp(-block_seconds / time_constant);
+}
+
+static BlockCoefficients get_coefficients(int sample_rate) {
+    float block_seconds = (float)POSTPROCESS_BLOCK_SIZE / sample_rate;
+
+    BlockCoefficients coeffs;
+    coeffs.dc = smoothing_coefficient(block_seconds, DC_TIME_CONSTANT);
+    coeffs.loudness =
+        smoothing_coefficient(block_seconds, LOUDNESS_TIME_CONSTANT);
+    coeffs.gain_attack =
+        smoothing_coefficient(block_seconds, GAIN_ATTACK_TIME_CONSTANT);
+    coeffs.gain_release =
+        smoothing_coefficient(block_seconds, GAIN_RELEASE_TIME_CONSTANT);
+
+    return coeffs;
+}
+
+// Update estimates from a completed block and plan the next block's gain
+static void finish_block(const piper2_postprocess_options &options,
+                         const BlockCoefficients &coeffs,
+                         PostprocessState &state) {
+    const float block_size = (float)POSTPROCESS_BLOCK_SIZE;
+    float block_mean = (float)(state.block_sum / block_size);
+    float block_mean_square = (float)(state.block_sum_squares / block_size);
+
+    if (options.remove_dc) {
+        state.dc += coeffs.dc * (block_mean - state.dc);
+    }
+
+    state.peak = std::max(state.peak, state.block_peak);
+    if (block_mean_square > SILENCE_MEAN_SQUARE) {
+        if (state.has_loudness) {
+            state.mean_square +=
+                coeffs.loudness * (block_mean_square - state.mean_square);
+        } else {
+            state.mean_square = block_mean_square;
+            state.has_loudness = true;
+        }
+    }
+
+    float gain = state.gain_from + (state.gain_step * block_size);
+    float target_gain = 1.0f;
+    if (options.normalize) {
+        if (state.has_loudness) {
+            float max_gain = std::pow(10.0f, options.max_gain_db / 20.0f);
+            float target_rms =
+                std::pow(10.0f, options.target_loudness_db / 20.0f);
+            target_gain = std::clamp(
+                target_rms / std::sqrt(state.mean_square), 1.0f / max_gain,
+                max_gain);
+        }
+
+        if ((state.peak * target_gain) > options.peak_limit) {
+            target_gain = options.peak_limit / state.peak;
+        }
+    }
+
+    // Reduce gain quickly to avoid clipping, raise it slowly
+    float coeff =
+        (target_gain < gain) ? coeffs.gain_attack : coeffs.gain_release;
+    float next_gain = gain + coeff * (target_gain - gain);
+
+    state.gain_from = gain;
+    state.gain_step = (next_gain - gain) / block_size;
+    state.block_sum = 0;
+    state.block_sum_squares = 0;
+    state.block_peak = 0;
+}
+
+// Process samples [start, end) of a chunk, all within one block.
+// block_offset is the position of samples[start] in its block.
+static void process_segment_scalar(const SegmentParams &params,
+                                   float *samples, std::size_t start,
+                                   std::size_t end, std::size_t block_offset,
+                                   SegmentStats &stats) {
+    for (std::size_t i = start; i < end; ++i) {
+        float x = samples[i];
+        float v = x - params.dc;
+        stats.sum += x;
+        stats.sum_squares += v * v;
+        stats.peak = std::max(stats.peak, std::fabs(v));
+
+        float j = (float)(block_offset + (i - start) + 1);
+        float gain = params.gain_from + params.gain_step * j;
+        float fade_in = (float)(i + 1) * params.inv_fade;
+        float fade_out = (params.num_samples - (float)i) * params.inv_fade;
+        float fade = std::min(1.0f, std::min(fade_in, fade_out));
+
+        samples[i] = std::clamp(v * gain * fade, -1.0f, 1.0f);
+    }
+}
+
+#if defined(PIPER2_POSTPROCESS_SSE)
+
+static void process_segment_simd(const SegmentParams &params, float *samples,
+                                 std::size_t start, std::size_t end,
+                                 std::size_t block_offset,
+                                 SegmentStats &stats) {
+    const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 dc = _mm_set1_ps(params.dc);
+    const __m128 gain_from = _mm_set1_ps(params.gain_from);
+    const __m128 gain_step = _mm_set1_ps(params.gain_step);
+    const __m128 inv_fade = _mm_set1_ps(params.inv_fade);
+    const __m128 num_samples = _mm_set1_ps(params.num_samples);
+
+    __m128 j = _mm_add_ps(_mm_set1_ps((float)(block_offset + 1)), lanes);
+    __m128 idx = _mm_add_ps(_mm_set1_ps((float)start), lanes);
+    __m128 sum = _mm_setzero_ps();
+    __m128 sum_squares = _mm_setzero_ps();
+    __m128 peak = _mm_setzero_ps();
+
+    std::size_t i = start;
+    for (; (i + 4) <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(samples + i);
+        __m128 v = _mm_sub_ps(x, dc);
+        sum = _mm_add_ps(sum, x);
+        sum_squares = _mm_add_ps(sum_squares, _mm_mul_ps(v, v));
+        peak = _mm_max_ps(peak, _mm_and_ps(v, abs_mask));
+
+        __m128 gain = _mm_add_ps(gain_from, _mm_mul_ps(gain_step, j));
+        __m128 fade_in = _mm_mul_ps(_mm_add_ps(idx, one), inv_fade);
+        __m128 fade_out = _mm_mul_ps(_mm_sub_ps(num_samples, idx), inv_fade);
+        __m128 fade = _mm_min_ps(one, _mm_min_ps(fade_in, fade_out));
+
+        __m128 y = _mm_mul_ps(_mm_mul_ps(v, gain), fade);
+        _mm_storeu_ps(samples + i, _mm_max_ps(minus_one, _mm_min_ps(one, y)));
+
+        j = _mm_add_ps(j, four);
+        idx = _mm_add_ps(idx, four);
+    }
+
+    float sum_lanes[4], sum_squares_lanes[4], peak_lanes[4];
+    _mm_storeu_ps(sum_lanes, sum);
+    _mm_storeu_ps(sum_squares_lanes, sum_squares);
+    _mm_storeu_ps(peak_lanes, peak);
+    for (int lane = 0; lane < 4; ++lane) {
+        stats.sum += sum_lanes[lane];
+        stats.sum_squares += sum_squares_lanes[lane];
+        stats.peak = std::max(stats.peak, peak_lanes[lane]);
+    }
+
+    process_segment_scalar(params, samples, i, end,
+                           block_offset + (i - start), stats);
+}
+
+#elif defined(PIPER2_POSTPROCESS_NEON)
+
+static void process_segment_simd(const SegmentParams &params, float *samples,
+                                 std::size_t start, std::size_t end,
+                                 std::size_t block_offset,
+                                 SegmentStats &stats) {
+    const float lane_values[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    const float32x4_t lanes = vld1q_f32(lane_values);
+    const float32x4_t four = vdupq_n_f32(4.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t minus_one = vdupq_n_f32(-1.0f);
+    const float32x4_t dc = vdupq_n_f32(params.dc);
+    const float32x4_t gain_from = vdupq_n_f32(params.gain_from);
+    const float32x4_t gain_step = vdupq_n_f32(params.gain_step);
+    const float32x4_t inv_fade = vdupq_n_f32(params.inv_fade);
+    const float32x4_t num_samples = vdupq_n_f32(params.num_samples);
+
+    float32x4_t j = vaddq_f32(vdupq_n_f32((float)(block_offset + 1)), lanes);
+    float32x4_t idx = vaddq_f32(vdupq_n_f32((float)start), lanes);
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    float32x4_t sum_squares = vdupq_n_f32(0.0f);
+    float32x4_t peak = vdupq_n_f32(0.0f);
+
+    std::size_t i = start;
+    for (; (i + 4) <= end; i += 4) {
+        float32x4_t x = vld1q_f32(samples + i);
+        float32x4_t v = vsubq_f32(x, dc);
+        sum = vaddq_f32(sum, x);
+        sum_squares = vaddq_f32(sum_squares, vmulq_f32(v, v));
+        peak = vmaxq_f32(peak, vabsq_f32(v));
+
+        float32x4_t gain = vaddq_f32(gain_from, vmulq_f32(gain_step, j));
+        float32x4_t fade_in = vmulq_f32(vaddq_f32(idx, one), inv_fade);
+        float32x4_t fade_out = vmulq_f32(vsubq_f32(num_samples, idx), inv_fade);
+        float32x4_t fade = vminq_f32(one, vminq_f32(fade_in, fade_out));
+
+        float32x4_t y = vmulq_f32(vmulq_f32(v, gain), fade);
+        vst1q_f32(samples + i, vmaxq_f32(minus_one, vminq_f32(one, y)));
+
+        j = vaddq_f32(j, four);
+        idx = vaddq_f32(idx, four);
+    }
+
+    float sum_lanes[4], sum_squares_lanes[4], peak_lanes[4];
+    vst1q_f32(sum_lanes, sum);
+    vst1q_f32(sum_squares_lanes, sum_squares);
+    vst1q_f32(peak_lanes, peak);
+    for (int lane = 0; lane < 4; ++lane) {
+        stats.sum += sum_lanes[lane];
+        stats.sum_squares += sum_squares_lanes[lane];
+        stats.peak = std::max(stats.peak, peak_lanes[lane]);
+    }
+
+    process_segment_scalar(params, samples, i, end,
+                           block_offset + (i - start), stats);
+}
+
+#else
+
+static void process_segment_simd(const SegmentParams &params, float *samples,
+                                 std::size_t start, std::size_t end,
+                                 std::size_t block_offset,
+                                 SegmentStats &stats) {
+    process_segment_scalar(params, samples, start, end, block_offset, stats);
+}
+
+#endif
+
+template <bool Vectorized>
+static void postprocess(const piper2_postprocess_options &options,
+                        int sample_rate, PostprocessState &state,
+                        float *samples, std::size_t num_samples) {
+    if (!samples || (num_samples == 0) || (sample_rate <= 0)) {
+        return;
+    }
+
+    BlockCoefficients coeffs = get_coefficients(sample_rate);
+
+    // Fades are per chunk, at most half of it each
+    SegmentParams params;
+    params.num_samples = (float)num_samples;
+    float fade_samples = std::min(options.fade_ms * sample_rate / 1000.0f,
+                                  num_samples / 2.0f);
+    if (fade_samples >= 1.0f) {
+        params.inv_fade = 1.0f / fade_samples;
+    }
+
+    std::size_t start = 0;
+    while (start < num_samples) {
+        std::size_t block_offset = state.position % POSTPROCESS_BLOCK_SIZE;
+        std::size_t end =
+            start + std::min(POSTPROCESS_BLOCK_SIZE - block_offset,
+                             num_samples - start);
+
+        params.dc = state.dc;
+        params.gain_from = state.gain_from;
+        params.gain_step = state.gain_step;
+
+        SegmentStats stats;
+        if (Vectorized) {
+            process_segment_simd(params, samples, start, end, block_offset,
+                                 stats);
+        } else {
+            process_segment_scalar(params, samples, start, end, block_offset,
+                                   stats);
+        }
+
+        state.block_sum += stats.sum;
+        state.block_sum_squares += stats.sum_squares;
+        state.block_peak = std::max(state.block_peak, stats.peak);
+        state.position += end - start;
+        start = end;
+
+        if ((state.position % POSTPROCESS_BLOCK_SIZE) == 0) {
+            finish_block(options, coeffs, state);
+        }
+    }
+}
+
+void postprocess_chunk(const piper2_postprocess_options &options,
+                       int sample_rate, PostprocessState &state,
+                       float *samples, std::size_t num_samples) {
+    postprocess<true>(options, sample_rate, state, samples, num_samples);
+}
+
+void postprocess_chunk_scalar(const piper2_postprocess_options &options,
+                              int sample_rate, PostprocessState &state,
+                              float *samples, std::size_t num_samples) {
+    postprocess<false>(options, sample_rate, state, samples, num_samples);
+}
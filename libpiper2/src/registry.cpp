@@ -0,0 +1,585 @@
+#include "piper2.h"
+#include "piper2_impl.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <thread>
+#include <tuple>
+
+struct VoiceEntry {
+    // Arguments for create_synthesizer
+    std::string name;
+    std::string locale;
+    std::string voice_model_path;
+    std::string voice_config_path;
+    std::string phonemizer_model_path;
+    std::string phonemizer_config_path;
+    std::string stress_model_path;
+    piper2_create_options create_options;
+
+    // Owned copies of strings in create_options
+    std::string lexicon_path;
+    std::string voice_precision;
+    std::string phonemizer_precision;
+    std::string stress_precision;
+
+    piper2_synthesizer *synth = nullptr;
+    bool is_loading = false;
+    bool load_failed = false; // reported once by piper2_registry_try_acquire
+    std::size_t ref_count = 0;
+    std::size_t memory_bytes = 0;
+    uint64_t last_used = 0;
+};
+
+// Phonemizer/stress models are shared by voices that load the same file with
+// the same session options
+struct SessionKey {
+    std::string model_path; // precision variant
+    int numa_node = -1;
+    bool map_model = false;
+    bool fork_safe = false;
+
+    bool operator<(const SessionKey &other) const {
+        return std::tie(model_path, numa_node, map_model, fork_safe) <
+               std::tie(other.model_path, other.numa_node, other.map_model,
+                        other.fork_safe);
+    }
+};
+
+struct SharedSession {
+    std::weak_ptr<Ort::Session> session;
+    std::size_t memory_bytes = 0;
+};
+
+struct piper2_registry {
+    std::size_t memory_budget = 0;
+    std::size_t voice_memory_used = 0;
+
+    // Shared models being loaded, counted until they're in shared_sessions
+    std::size_t memory_reserved = 0;
+    uint64_t use_counter = 0;
+
+    std::mutex mutex;
+    std::condition_variable loaded_cond;
+    std::map<std::string, std::unique_ptr<VoiceEntry>> voices;
+    std::map<const piper2_synthesizer *, VoiceEntry *> voices_by_synth;
+
+    // Phonemizer/stress sessions, alive while any voice uses them. Their
+    // memory counts against the budget once, however many voices share them.
+    std::map<SessionKey, SharedSession> shared_sessions;
+
+    // Request log for every voice (see piper2_registry_set_capture)
+    piper2_capture *capture = nullptr;
+
+    // Background loading
+    std::thread preload_thread;
+    std::condition_variable preload_cond;
+    std::deque<std::string> preload_queue;
+    bool stopping = false;
+
+    // Set by piper2_registry_prepare_fork once all voices are loaded and the
+    // preload thread has stopped.
+    bool is_prepared_for_fork = false;
+};
+
+static std::size_t get_file_size(const std::string &path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : (std::size_t)size;
+}
+
+// Voice models plus the shared models still in use (registry mutex held)
+static std::size_t get_memory_used(piper2_registry *registry) {
+    std::size_t memory_used =
+        registry->voice_memory_used + registry->memory_reserved;
+    for (auto session_iter = registry->shared_sessions.begin();
+         session_iter != registry->shared_sessions.end();) {
+        if (session_iter->second.session.expired()) {
+            session_iter = registry->shared_sessions.erase(session_iter);
+            continue;
+        }
+
+        memory_used += session_iter->second.memory_bytes;
+        ++session_iter;
+    }
+
+    return memory_used;
+}
+
+// Free least recently used voices that aren't in use until there is room for
+// the given number of bytes (registry mutex held). Shared models are freed
+// with the last voice that uses them.
+static void evict_voices(piper2_registry *registry, std::size_t needed_bytes) {
+    if (registry->memory_budget == 0) {
+        return;
+    }
+
+    while ((get_memory_used(registry) + needed_bytes) >
+           registry->memory_budget) {
+        VoiceEntry *lru_entry = nullptr;
+        for (auto &voice : registry->voices) {
+            auto &entry = *voice.second;
+            if (!entry.synth || (entry.ref_count > 0)) {
+                continue;
+            }
+
+            if (!lru_entry || (entry.last_used < lru_entry->last_used)) {
+                lru_entry = &entry;
+            }
+        }
+
+        if (!lru_entry) {
+            // Everything is in use
+            break;
+        }
+
+        registry->voices_by_synth.erase(lru_entry->synth);
+        piper2_free(lru_entry->synth);
+        lru_entry->synth = nullptr;
+        registry->voice_memory_used -= lru_entry->memory_bytes;
+    }
+}
+
+// Load a phonemizer or stress session again for a voice that unloaded it
+// while idle. Voices keep sharing it, and it counts against the budget.
+static std::shared_ptr<Ort::Session>
+load_shared_session(piper2_registry *registry, const SessionKey &key,
+                    const piper2_synthesizer *synth) {
+    std::unique_lock<std::mutex> lock(registry->mutex);
+    std::shared_ptr<Ort::Session> session =
+        registry->shared_sessions[key].session.lock();
+    if (session) {
+        return session;
+    }
+
+    std::size_t memory_bytes = get_file_size(key.model_path);
+    evict_voices(registry, memory_bytes);
+    registry->memory_reserved += memory_bytes;
+
+    lock.unlock();
+    try {
+        session = load_session(key.model_path, synth->session_options,
+                               synth->map_models);
+    } catch (...) {
+        lock.lock();
+        registry->memory_reserved -= memory_bytes;
+        throw;
+    }
+    lock.lock();
+    registry->memory_reserved -= memory_bytes;
+
+    auto &shared_session = registry->shared_sessions[key];
+    if (auto loaded_session = shared_session.session.lock()) {
+        // Another voice loaded it first
+        return loaded_session;
+    }
+
+    shared_session = SharedSession{session, memory_bytes};
+
+    return session;
+}
+
+// Load a voice if needed, waiting for another thread that is already loading
+// it (registry mutex held by lock).
+static bool ensure_loaded(piper2_registry *registry, VoiceEntry &entry,
+                          std::unique_lock<std::mutex> &lock) {
+    registry->loaded_cond.wait(lock, [&entry] { return !entry.is_loading; });
+    if (entry.synth) {
+        return true;
+    }
+
+    piper2_create_options create_options = entry.create_options;
+    auto owned_string = [](const std::string &value) {
+        return value.empty() ? nullptr : value.c_str();
+    };
+    create_options.lexicon_path = owned_string(entry.lexicon_path);
+    create_options.voice_precision = owned_string(entry.voice_precision);
+    create_options.phonemizer_precision =
+        owned_string(entry.phonemizer_precision);
+    create_options.stress_precision = owned_string(entry.stress_precision);
+
+    entry.is_loading = true;
+
+    // Sessions are shared between voices that load the same model file with
+    // the same options
+    SessionKey phonemizer_key;
+    phonemizer_key.model_path = resolve_model_variant(
+        entry.phonemizer_model_path, create_options.phonemizer_precision);
+    phonemizer_key.numa_node = create_options.numa_node;
+    phonemizer_key.map_model = create_options.map_models;
+    phonemizer_key.fork_safe = create_options.fork_safe;
+
+    SessionKey stress_key = phonemizer_key;
+    stress_key.model_path = resolve_model_variant(
+        entry.stress_model_path, create_options.stress_precision);
+
+    std::shared_ptr<Ort::Session> phonemizer_session =
+        registry->shared_sessions[phonemizer_key].session.lock();
+    std::shared_ptr<Ort::Session> stress_session =
+        registry->shared_sessions[stress_key].session.lock();
+
+    // Shared models that aren't loaded yet count against the budget too
+    std::size_t phonemizer_bytes =
+        phonemizer_session ? 0 : get_file_size(phonemizer_key.model_path);
+    std::size_t stress_bytes =
+        stress_session ? 0 : get_file_size(stress_key.model_path);
+    std::size_t reserved_bytes = phonemizer_bytes + stress_bytes;
+
+    entry.memory_bytes = get_file_size(resolve_model_variant(
+        entry.voice_model_path, create_options.voice_precision));
+    evict_voices(registry, entry.memory_bytes + reserved_bytes);
+    registry->voice_memory_used += entry.memory_bytes;
+    registry->memory_reserved += reserved_bytes;
+
+    // Load without blocking other voices
+    lock.unlock();
+    piper2_synthesizer *synth = create_synthesizer(
+        entry.locale.empty() ? nullptr : entry.locale.c_str(),
+        entry.voice_model_path.c_str(),
+        entry.voice_config_path.empty() ? nullptr
+                                        : entry.voice_config_path.c_str(),
+        entry.phonemizer_model_path.c_str(),
+        entry.phonemizer_config_path.empty()
+            ? nullptr
+            : entry.phonemizer_config_path.c_str(),
+        entry.stress_model_path.c_str(), &create_options, phonemizer_session,
+        stress_session);
+    lock.lock();
+
+    entry.is_loading = false;
+    entry.load_failed = (synth == nullptr);
+    if (synth) {
+        entry.synth = synth;
+        entry.last_used = ++registry->use_counter;
+        registry->voices_by_synth[synth] = &entry;
+        piper2_set_capture(synth, registry->capture, entry.name.c_str());
+
+        std::lock_guard<std::mutex> sessions_lock(
+            synth->frontend_sessions_mutex);
+        if (phonemizer_bytes > 0) {
+            registry->shared_sessions[phonemizer_key] =
+                SharedSession{synth->phonemizer_session, phonemizer_bytes};
+        }
+        if (stress_bytes > 0) {
+            registry->shared_sessions[stress_key] =
+                SharedSession{synth->stress_session, stress_bytes};
+        }
+
+        // After an idle unload, sessions come back through shared_sessions
+        synth->frontend_session_loader =
+            [registry, phonemizer_key, synth](const std::string &model_path) {
+                SessionKey key = phonemizer_key;
+                key.model_path = model_path;
+                return load_shared_session(registry, key, synth);
+            };
+    } else {
+        registry->voice_memory_used -= entry.memory_bytes;
+    }
+    registry->memory_reserved -= reserved_bytes;
+
+    registry->loaded_cond.notify_all();
+
+    return synth != nullptr;
+}
+
+static void preload_run(piper2_registry *registry) {
+    std::unique_lock<std::mutex> lock(registry->mutex);
+    while (true) {
+        registry->preload_cond.wait(lock, [registry] {
+            return registry->stopping || !registry->preload_queue.empty();
+        });
+
+        if (registry->stopping) {
+            break;
+        }
+
+        std::string name = registry->preload_queue.front();
+        registry->preload_queue.pop_front();
+
+        auto voice_iter = registry->voices.find(name);
+        if (voice_iter != registry->voices.end()) {
+            ensure_loaded(registry, *voice_iter->second, lock);
+        }
+    }
+}
+
+piper2_registry *piper2_registry_create(size_t memory_budget_bytes) {
+    piper2_registry *registry = new piper2_registry();
+    registry->memory_budget = memory_budget_bytes;
+    registry->preload_thread = std::thread(preload_run, registry);
+
+    return registry;
+}
+
+void piper2_registry_free(piper2_registry *registry) {
+    if (!registry) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        registry->stopping = true;
+    }
+    registry->preload_cond.notify_all();
+    if (registry->preload_thread.joinable()) {
+        registry->preload_thread.join();
+    }
+
+    for (auto &voice : registry->voices) {
+        piper2_free(voice.second->synth);
+    }
+
+    delete registry;
+}
+
+int piper2_registry_add_voice(piper2_registry *registry, const char *name,
+                              const char *locale, const char *voice_model_path,
+                              const char *voice_config_path,
+                              const char *phonemizer_model_path,
+                              const char *phonemizer_config_path,
+                              const char *stress_model_path,
+                              const piper2_create_options *options) {
+    if (!registry || !name || !voice_model_path || !phonemizer_model_path ||
+        !stress_model_path) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    if (registry->voices.count(name) > 0) {
+        // Already added
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto entry = std::make_unique<VoiceEntry>();
+    entry->name = name;
+    entry->locale = locale ? locale : "";
+    entry->voice_model_path = voice_model_path;
+    entry->voice_config_path = voice_config_path ? voice_config_path : "";
+    entry->phonemizer_model_path = phonemizer_model_path;
+    entry->phonemizer_config_path =
+        phonemizer_config_path ? phonemizer_config_path : "";
+    entry->stress_model_path = stress_model_path;
+    entry->create_options =
+        options ? *options : piper2_default_create_options();
+    auto &create_options = entry->create_options;
+    entry->lexicon_path =
+        create_options.lexicon_path ? create_options.lexicon_path : "";
+    entry->voice_precision =
+        create_options.voice_precision ? create_options.voice_precision : "";
+    entry->phonemizer_precision = create_options.phonemizer_precision
+                                      ? create_options.phonemizer_precision
+                                      : "";
+    entry->stress_precision =
+        create_options.stress_precision ? create_options.stress_precision : "";
+
+    registry->voices[name] = std::move(entry);
+
+    return PIPER2_OK;
+}
+
+piper2_synthesizer *piper2_registry_acquire(piper2_registry *registry,
+                                            const char *name) {
+    if (!registry || !name) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(registry->mutex);
+    auto voice_iter = registry->voices.find(name);
+    if (voice_iter == registry->voices.end()) {
+        return nullptr;
+    }
+
+    auto &entry = *voice_iter->second;
+    if (!ensure_loaded(registry, entry, lock)) {
+        return nullptr;
+    }
+
+    entry.ref_count++;
+    entry.last_used = ++registry->use_counter;
+
+    return entry.synth;
+}
+
+int piper2_registry_try_acquire(piper2_registry *registry, const char *name,
+                                piper2_synthesizer **synth) {
+    if (!registry || !name || !synth) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    *synth = nullptr;
+
+    std::unique_lock<std::mutex> lock(registry->mutex);
+    auto voice_iter = registry->voices.find(name);
+    if (voice_iter == registry->voices.end()) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto &entry = *voice_iter->second;
+    if (!entry.synth) {
+        if (entry.load_failed) {
+            // Report the failure, and try again on the next call
+            entry.load_failed = false;
+            return PIPER2_ERR_GENERIC;
+        }
+
+        if (registry->is_prepared_for_fork) {
+            // No preload thread after the fork
+            if (!ensure_loaded(registry, entry, lock)) {
+                entry.load_failed = false;
+                return PIPER2_ERR_GENERIC;
+            }
+        } else {
+            if (!entry.is_loading &&
+                (std::find(registry->preload_queue.begin(),
+                           registry->preload_queue.end(),
+                           entry.name) == registry->preload_queue.end())) {
+                registry->preload_queue.push_back(entry.name);
+                registry->preload_cond.notify_one();
+            }
+
+            return PIPER2_AGAIN;
+        }
+    }
+
+    entry.ref_count++;
+    entry.last_used = ++registry->use_counter;
+    *synth = entry.synth;
+
+    return PIPER2_OK;
+}
+
+void piper2_registry_release(piper2_registry *registry,
+                             piper2_synthesizer *synth) {
+    if (!registry || !synth) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    auto entry_iter = registry->voices_by_synth.find(synth);
+    if (entry_iter == registry->voices_by_synth.end()) {
+        return;
+    }
+
+    auto &entry = *entry_iter->second;
+    if (entry.ref_count > 0) {
+        entry.ref_count--;
+    }
+    entry.last_used = ++registry->use_counter;
+}
+
+int piper2_registry_preload(piper2_registry *registry, const char *name) {
+    if (!registry || !name) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        auto voice_iter = registry->voices.find(name);
+        if (voice_iter == registry->voices.end()) {
+            return PIPER2_ERR_GENERIC;
+        }
+
+        auto &entry = *voice_iter->second;
+        if (entry.synth || entry.is_loading ||
+            registry->is_prepared_for_fork) {
+            return PIPER2_OK;
+        }
+
+        registry->preload_queue.push_back(name);
+    }
+    registry->preload_cond.notify_one();
+
+    return PIPER2_OK;
+}
+
+int piper2_registry_prepare_fork(piper2_registry *registry,
+                                 const char *warmup_text) {
+    if (!registry) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::unique_lock<std::mutex> lock(registry->mutex);
+    for (auto &voice : registry->voices) {
+        if (!voice.second->create_options.fork_safe) {
+            // Would have onnxruntime threads that don't survive the fork
+            return PIPER2_ERR_GENERIC;
+        }
+    }
+
+    for (auto &voice : registry->voices) {
+        if (!ensure_loaded(registry, *voice.second, lock)) {
+            return PIPER2_ERR_GENERIC;
+        }
+    }
+
+    for (auto &voice : registry->voices) {
+        auto &entry = *voice.second;
+        if (!entry.synth) {
+            // Evicted by a later voice
+            return PIPER2_ERR_GENERIC;
+        }
+
+        if (!warmup_text) {
+            continue;
+        }
+
+        // Populates arenas, memory patterns and bucket buffers
+        piper2_audio_chunk chunk;
+        if (piper2_synthesize_start(entry.synth, warmup_text, nullptr) !=
+            PIPER2_OK) {
+            return PIPER2_ERR_GENERIC;
+        }
+
+        int result = PIPER2_OK;
+        while ((result = piper2_synthesize_next(entry.synth, &chunk)) ==
+               PIPER2_OK) {
+        }
+
+        if (result != PIPER2_DONE) {
+            return result;
+        }
+    }
+
+    // Threads don't survive fork, and a mutex held by one at the time of the
+    // fork would stay locked in the child.
+    registry->is_prepared_for_fork = true;
+    registry->preload_queue.clear();
+    registry->stopping = true;
+    lock.unlock();
+
+    registry->preload_cond.notify_all();
+    if (registry->preload_thread.joinable()) {
+        registry->preload_thread.join();
+    }
+
+    return PIPER2_OK;
+}
+
+size_t piper2_registry_memory_used(piper2_registry *registry) {
+    if (!registry) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    return get_memory_used(registry);
+}
+
+int piper2_registry_set_capture(piper2_registry *registry,
+                                piper2_capture *capture) {
+    if (!registry) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    registry->capture = capture;
+    for (auto &voice : registry->voices) {
+        auto &entry = *voice.second;
+        if (entry.synth) {
+            piper2_set_capture(entry.synth, capture, entry.name.c_str());
+        }
+    }
+
+    return PIPER2_OK;
+}
@@ -0,0 +1,449 @@
+#include "piper2_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+const char RING_MAGIC[8] = {'P', 'P', 'R', '2', 'R', 'I', 'N', 'G'};
+
+static_assert(sizeof(piper2_ring_header) == 192, "ring header size");
+static_assert(offsetof(piper2_ring_header, write_pos) == 64,
+              "producer cache line");
+static_assert(offsetof(piper2_ring_header, read_pos) == 128,
+              "consumer cache line");
+
+struct piper2_ring {
+    piper2_ring_header *header = nullptr;
+    float *samples = nullptr;
+    std::size_t mapped_size = 0;
+    uint64_t mask = 0;
+    int fd = -1;
+    bool is_producer = false;
+
+    // POSIX shared memory name to unlink (producer only)
+    std::string shm_name;
+};
+
+#if defined(__linux__)
+
+static uint64_t load_u64(const uint64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static uint32_t load_u32(const uint32_t *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void futex_wait(uint32_t *word, uint32_t expected, int timeout_ms) {
+    struct timespec timeout;
+    struct timespec *timeout_ptr = nullptr;
+    if (timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        timeout_ptr = &timeout;
+    }
+
+    // Not FUTEX_PRIVATE_FLAG: the word is shared between processes
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout_ptr, nullptr, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+// Bump a futex word and wake the other side if it's asleep
+static void signal_other(uint32_t *futex_word, uint32_t *waiting) {
+    __atomic_fetch_add(futex_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) != 0) {
+        futex_wake(futex_word);
+    }
+}
+
+// Sleep until ready() or the timeout. Returns false on timeout.
+template <typename Ready>
+static bool wait_other(uint32_t *futex_word, uint32_t *waiting,
+                       int timeout_ms, Ready ready) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(std::max(timeout_ms, 0));
+
+    while (true) {
+        uint32_t futex_value = __atomic_load_n(futex_word, __ATOMIC_SEQ_CST);
+        if (ready()) {
+            return true;
+        }
+
+        int remaining_ms = -1;
+        if (timeout_ms >= 0) {
+            remaining_ms = (int)std::chrono::duration_cast<
+                               std::chrono::milliseconds>(
+                               deadline - std::chrono::steady_clock::now())
+                               .count();
+            if (remaining_ms <= 0) {
+                return false;
+            }
+        }
+
+        // Other side only makes a wake system call if this flag is set
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (!ready()) {
+            futex_wait(futex_word, futex_value, remaining_ms);
+        }
+        __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+static piper2_ring *map_ring(int fd, bool is_producer) {
+    struct stat fd_stat;
+    if ((fstat(fd, &fd_stat) != 0) ||
+        ((std::size_t)fd_stat.st_size < sizeof(piper2_ring_header))) {
+        return nullptr;
+    }
+
+    void *mapped = mmap(nullptr, fd_stat.st_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto *ring = new piper2_ring();
+    ring->header = (piper2_ring_header *)mapped;
+    ring->mapped_size = fd_stat.st_size;
+    ring->fd = fd;
+    ring->is_producer = is_producer;
+
+    if (!is_producer) {
+        // Validate header
+        auto *header = ring->header;
+        uint64_t capacity = header->capacity;
+        if ((std::memcmp(header->magic, RING_MAGIC, sizeof(RING_MAGIC)) !=
+             0) ||
+            (header->version != PIPER2_RING_VERSION) ||
+            (header->header_size != sizeof(piper2_ring_header)) ||
+            (header->sample_format != PIPER2_RING_FORMAT_FLOAT32) ||
+            (capacity == 0) || ((capacity & (capacity - 1)) != 0) ||
+            ((sizeof(piper2_ring_header) + (capacity * sizeof(float))) >
+             ring->mapped_size)) {
+            ring->fd = -1; // not owned yet
+            piper2_ring_free(ring);
+            return nullptr;
+        }
+    }
+
+    ring->samples =
+        (float *)((uint8_t *)mapped + sizeof(piper2_ring_header));
+    ring->mask = ring->header->capacity - 1;
+
+    return ring;
+}
+
+piper2_ring *piper2_ring_create(const char *name, size_t capacity) {
+    if (!name || (capacity < 1)) {
+        return nullptr;
+    }
+
+    uint64_t ring_capacity = 1;
+    while (ring_capacity < capacity) {
+        ring_capacity *= 2;
+    }
+
+    bool is_shm = (name[0] == '/');
+    int fd = is_shm ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                    : memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    std::size_t size =
+        sizeof(piper2_ring_header) + (ring_capacity * sizeof(float));
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        if (is_shm) {
+            shm_unlink(name);
+        }
+        return nullptr;
+    }
+
+    // Consumers that open the segment before the header is written reject it
+    piper2_ring_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, RING_MAGIC, sizeof(RING_MAGIC));
+    header.version = PIPER2_RING_VERSION;
+    header.header_size = sizeof(piper2_ring_header);
+    header.sample_format = PIPER2_RING_FORMAT_FLOAT32;
+    header.num_channels = 1;
+    header.capacity = ring_capacity;
+
+    piper2_ring *ring = map_ring(fd, true);
+    if (!ring) {
+        close(fd);
+        if (is_shm) {
+            shm_unlink(name);
+        }
+        return nullptr;
+    }
+
+    std::memcpy(ring->header, &header, sizeof(header));
+    ring->samples = (float *)((uint8_t *)ring->header + sizeof(header));
+    ring->mask = ring_capacity - 1;
+    if (is_shm) {
+        ring->shm_name = name;
+    }
+
+    return ring;
+}
+
+piper2_ring *piper2_ring_open(const char *name) {
+    if (!name) {
+        return nullptr;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    piper2_ring *ring = map_ring(fd, false);
+    if (!ring) {
+        close(fd);
+        return nullptr;
+    }
+
+    return ring;
+}
+
+piper2_ring *piper2_ring_open_fd(int fd) {
+    int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd < 0) {
+        return nullptr;
+    }
+
+    piper2_ring *ring = map_ring(dup_fd, false);
+    if (!ring) {
+        close(dup_fd);
+        return nullptr;
+    }
+
+    return ring;
+}
+
+void piper2_ring_free(piper2_ring *ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (ring->header) {
+        munmap(ring->header, ring->mapped_size);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    if (!ring->shm_name.empty()) {
+        shm_unlink(ring->shm_name.c_str());
+    }
+
+    delete ring;
+}
+
+int piper2_ring_fd(piper2_ring *ring) { return ring ? ring->fd : -1; }
+
+const piper2_ring_header *piper2_ring_get_header(piper2_ring *ring) {
+    return ring ? ring->header : nullptr;
+}
+
+int piper2_ring_write(piper2_ring *ring, const float *samples,
+                      size_t num_samples, int timeout_ms) {
+    if (!ring || !ring->is_producer || (!samples && (num_samples > 0))) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto *header = ring->header;
+    uint64_t capacity = header->capacity;
+    uint64_t write_pos = header->write_pos; // only written by us
+
+    while (num_samples > 0) {
+        uint64_t read_pos = load_u64(&header->read_pos);
+        uint64_t free_samples = capacity - (write_pos - read_pos);
+        if (free_samples == 0) {
+            bool has_space = wait_other(
+                &header->read_futex, &header->producer_waiting, timeout_ms,
+                [header, write_pos, capacity] {
+                    return (write_pos - load_u64(&header->read_pos)) <
+                           capacity;
+                });
+            if (!has_space) {
+                return PIPER2_AGAIN;
+            }
+            continue;
+        }
+
+        // Copy up to the end of the ring, then wrap on the next iteration
+        uint64_t write_idx = write_pos & ring->mask;
+        std::size_t num_to_write = (std::size_t)std::min<uint64_t>(
+            std::min<uint64_t>(free_samples, capacity - write_idx),
+            num_samples);
+        std::memcpy(ring->samples + write_idx, samples,
+                    num_to_write * sizeof(float));
+
+        samples += num_to_write;
+        num_samples -= num_to_write;
+        write_pos += num_to_write;
+
+        __atomic_store_n(&header->write_pos, write_pos, __ATOMIC_RELEASE);
+        signal_other(&header->write_futex, &header->consumer_waiting);
+    }
+
+    return PIPER2_OK;
+}
+
+int piper2_ring_write_chunk(piper2_ring *ring, const piper2_audio_chunk *chunk,
+                            int timeout_ms) {
+    if (!ring || !chunk) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    if (chunk->sample_rate > 0) {
+        __atomic_store_n(&ring->header->sample_rate,
+                         (uint32_t)chunk->sample_rate, __ATOMIC_RELEASE);
+    }
+
+    int result = piper2_ring_write(ring, chunk->samples, chunk->num_samples,
+                                   timeout_ms);
+    if (result == PIPER2_OK) {
+        __atomic_fetch_add(&ring->header->write_seq, 1, __ATOMIC_RELEASE);
+    }
+
+    return result;
+}
+
+void piper2_ring_close(piper2_ring *ring) {
+    if (!ring || !ring->is_producer) {
+        return;
+    }
+
+    __atomic_fetch_or(&ring->header->flags, PIPER2_RING_FLAG_CLOSED,
+                      __ATOMIC_RELEASE);
+    signal_other(&ring->header->write_futex,
+                 &ring->header->consumer_waiting);
+}
+
+int piper2_ring_wait(piper2_ring *ring, int timeout_ms) {
+    if (!ring || ring->is_producer) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto *header = ring->header;
+    uint64_t read_pos = header->read_pos; // only written by us
+    auto has_samples = [header, read_pos] {
+        return load_u64(&header->write_pos) != read_pos;
+    };
+    auto is_closed = [header] {
+        return (load_u32(&header->flags) & PIPER2_RING_FLAG_CLOSED) != 0;
+    };
+
+    if (wait_other(&header->write_futex, &header->consumer_waiting,
+                   timeout_ms,
+                   [&] { return has_samples() || is_closed(); })) {
+        // Check samples again since they may have been written just before
+        // the ring was closed.
+        return has_samples() ? PIPER2_OK : PIPER2_DONE;
+    }
+
+    return PIPER2_AGAIN;
+}
+
+size_t piper2_ring_peek(piper2_ring *ring, const float **samples) {
+    if (!ring || !samples) {
+        return 0;
+    }
+
+    auto *header = ring->header;
+    uint64_t read_pos = header->read_pos;
+    uint64_t write_pos = load_u64(&header->write_pos);
+    if (write_pos == read_pos) {
+        *samples = nullptr;
+        return 0;
+    }
+
+    uint64_t read_idx = read_pos & ring->mask;
+    *samples = ring->samples + read_idx;
+
+    return (std::size_t)std::min<uint64_t>(write_pos - read_pos,
+                                           header->capacity - read_idx);
+}
+
+void piper2_ring_consume(piper2_ring *ring, size_t num_samples) {
+    if (!ring || (num_samples < 1)) {
+        return;
+    }
+
+    auto *header = ring->header;
+    uint64_t read_pos = header->read_pos;
+    uint64_t write_pos = load_u64(&header->write_pos);
+    read_pos += std::min<uint64_t>(num_samples, write_pos - read_pos);
+
+    __atomic_store_n(&header->read_pos, read_pos, __ATOMIC_RELEASE);
+    signal_other(&header->read_futex, &header->producer_waiting);
+}
+
+size_t piper2_ring_read(piper2_ring *ring, float *samples,
+                        size_t max_samples) {
+    std::size_t num_read = 0;
+    while (num_read < max_samples) {
+        const float *ring_samples = nullptr;
+        std::size_t num_available = piper2_ring_peek(ring, &ring_samples);
+        if (num_available == 0) {
+            break;
+        }
+
+        std::size_t num_to_read =
+            std::min(num_available, max_samples - num_read);
+        std::memcpy(samples + num_read, ring_samples,
+                    num_to_read * sizeof(float));
+        piper2_ring_consume(ring, num_to_read);
+        num_read += num_to_read;
+    }
+
+    return num_read;
+}
+
+#else // !__linux__
+
+piper2_ring *piper2_ring_create(const char *, size_t) { return nullptr; }
+piper2_ring *piper2_ring_open(const char *) { return nullptr; }
+piper2_ring *piper2_ring_open_fd(int) { return nullptr; }
+void piper2_ring_free(piper2_ring *ring) { delete ring; }
+int piper2_ring_fd(piper2_ring *) { return -1; }
+const piper2_ring_header *piper2_ring_get_header(piper2_ring *) {
+    return nullptr;
+}
+int piper2_ring_write(piper2_ring *, const float *, size_t, int) {
+    return PIPER2_ERR_GENERIC;
+}
+int piper2_ring_write_chunk(piper2_ring *, const piper2_audio_chunk *, int) {
+    return PIPER2_ERR_GENERIC;
+}
+void piper2_ring_close(piper2_ring *) {}
+int piper2_ring_wait(piper2_ring *, int) { return PIPER2_ERR_GENERIC; }
+size_t piper2_ring_peek(piper2_ring *, const float **samples) {
+    if (samples) {
+        *samples = nullptr;
+    }
+    return 0;
+}
+void piper2_ring_consume(piper2_ring *, size_t) {}
+size_t piper2_ring_read(piper2_ring *, float *, size_t) { return 0; }
+
+#endif
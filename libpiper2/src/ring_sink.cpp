@@ -0,0 +1,60 @@
+#include "piper2.h"
+#include "piper2_impl.hpp"
+#include "piper2_ring.h"
+
+int piper2_synthesize_to_ring(piper2_synthesizer *synth, const char *text,
+                              const piper2_synthesize_options *options,
+                              piper2_ring *ring, int timeout_ms) {
+    if (!synth || !text || !ring) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    SynthesisParams params = make_synthesis_params(synth, options);
+    PostprocessState postprocess_state;
+
+    uint64_t trace_request_id = new_trace_request_id();
+    std::vector<Sentence> sentences;
+    {
+        TraceContextScope trace_scope(trace_request_id, TRACE_NO_SENTENCE);
+        sentences = text_to_sentences(synth, text);
+    }
+
+    // Post-processing runs in place on the voice model's output, which is
+    // then written to the ring
+    SampleSink ring_sink = [&](float *samples, std::size_t num_samples) {
+        if (synth->postprocess.enabled) {
+            TraceScope postprocess_trace(TRACE_POSTPROCESS);
+            postprocess_chunk(synth->postprocess, synth->sample_rate,
+                              postprocess_state, samples, num_samples);
+        }
+
+        piper2_audio_chunk chunk = {};
+        chunk.sample_rate = synth->sample_rate;
+        chunk.samples = samples;
+        chunk.num_samples = num_samples;
+
+        return piper2_ring_write_chunk(ring, &chunk, timeout_ms);
+    };
+
+    SentenceAudio audio;
+    std::vector<PhonemeId> syn_phoneme_ids;
+    std::vector<std::vector<float>> unused_samples;
+    for (std::size_t sentence_idx = 0; sentence_idx < sentences.size();
+         ++sentence_idx) {
+        TraceContextScope trace_scope(trace_request_id,
+                                      (uint32_t)sentence_idx);
+        int result = phonemize_sentence(synth, sentences[sentence_idx], audio,
+                                        syn_phoneme_ids);
+        if (result != PIPER2_OK) {
+            return result;
+        }
+
+        result = run_voice_model(synth, syn_phoneme_ids, params, {},
+                                 unused_samples, &ring_sink);
+        if (result != PIPER2_OK) {
+            return result;
+        }
+    }
+
+    return PIPER2_OK;
+}
@@ -0,0 +1,725 @@
+#include "piper2.h"
+#include "piper2_impl.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+const std::size_t DEFAULT_MAX_QUEUED_SENTENCES = 256;
+const std::size_t DEFAULT_MAX_SENTENCES_AHEAD = 4;
+
+struct RequestState;
+
+// One sentence of a request, waiting for a worker
+struct Task {
+    std::shared_ptr<RequestState> request;
+    std::size_t sentence_idx = 0;
+    int priority = PIPER2_PRIORITY_NORMAL;
+    Clock::time_point deadline;
+    uint64_t seq = 0;
+    int64_t queued_ns = -1; // when tracing
+};
+
+// True if task a should run before task b
+static bool task_before(const Task &a, const Task &b) {
+    if (a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+
+    // First chunk of a request determines its latency
+    bool a_is_first = (a.sentence_idx == 0);
+    bool b_is_first = (b.sentence_idx == 0);
+    if (a_is_first != b_is_first) {
+        return a_is_first;
+    }
+
+    if (a.deadline != b.deadline) {
+        return a.deadline < b.deadline;
+    }
+
+    return a.seq < b.seq;
+}
+
+struct TaskAfter {
+    bool operator()(const Task &a, const Task &b) const {
+        return task_before(b, a);
+    }
+};
+
+// top_priority of an empty queue
+const int EMPTY_QUEUE_PRIORITY = std::numeric_limits<int>::max();
+
+// Tasks owned by a single worker, which other workers may steal from
+struct WorkerQueue {
+    std::mutex mutex;
+    std::priority_queue<Task, std::vector<Task>, TaskAfter> tasks;
+
+    // Priority of the top task, so other workers can look for more urgent
+    // work without taking the lock
+    std::atomic<int> top_priority{EMPTY_QUEUE_PRIORITY};
+
+    // Queue mutex held
+    void update_top_priority() {
+        top_priority.store(tasks.empty() ? EMPTY_QUEUE_PRIORITY
+                                         : tasks.top().priority,
+                           std::memory_order_relaxed);
+    }
+};
+
+struct RequestState {
+    piper2_scheduler *sched = nullptr;
+    piper2_synthesizer *synth = nullptr;
+    SynthesisParams params;
+    std::vector<Sentence> sentences;
+    int priority = PIPER2_PRIORITY_NORMAL;
+    Clock::time_point deadline;
+
+    std::mutex mutex;
+    std::condition_variable ready_cond;
+    std::size_t next_to_schedule = 0;
+    std::size_t next_to_deliver = 0;
+
+    // Synthesized sentences that haven't been read yet (may be out of order)
+    std::map<std::size_t, SentenceAudio> ready;
+    int error = PIPER2_OK;
+    bool cancelled = false;
+
+    // Sentences a worker is synthesizing with synth right now.
+    // piper2_request_free waits for these so the synthesizer can be freed
+    // after it returns.
+    std::size_t num_running = 0;
+
+    // Audio for the chunk last returned to the caller
+    SentenceAudio current;
+
+    // Post-processing runs on chunks in order, as they are delivered
+    PostprocessState postprocess;
+
+    // Record of the request if its synthesizer is capturing
+    RequestCapture capture;
+
+    // Tags the request's trace events
+    uint64_t trace_request_id = 0;
+
+    // Readiness notification for event loops (see piper2_request_fd).
+    // With eventfd, read_fd and write_fd are the same descriptor.
+    int read_fd = -1;
+    int write_fd = -1;
+    bool fd_signaled = false;
+
+    ~RequestState();
+
+    // True if the caller can read a chunk (or result) without waiting
+    bool is_readable() const {
+        return cancelled || (error != PIPER2_OK) ||
+               (next_to_deliver >= sentences.size()) ||
+               (ready.count(next_to_deliver) > 0);
+    }
+
+    // Make the notification fd match is_readable (request mutex held)
+    void update_fd();
+};
+
+RequestState::~RequestState() {
+#if !defined(_WIN32)
+    if (read_fd >= 0) {
+        close(read_fd);
+    }
+
+    if ((write_fd >= 0) && (write_fd != read_fd)) {
+        close(write_fd);
+    }
+#endif
+}
+
+void RequestState::update_fd() {
+#if !defined(_WIN32)
+    if (read_fd < 0) {
+        return;
+    }
+
+    bool readable = is_readable();
+    if (readable == fd_signaled) {
+        return;
+    }
+
+    if (readable) {
+#if defined(__linux__)
+        uint64_t value = 1;
+        ssize_t written = write(write_fd, &value, sizeof(value));
+#else
+        char value = 1;
+        ssize_t written = write(write_fd, &value, sizeof(value));
+#endif
+        (void)written;
+    } else {
+        // Drain (non-blocking)
+        char buffer[64];
+        while (read(read_fd, buffer, sizeof(buffer)) > 0) {
+        }
+    }
+
+    fd_signaled = readable;
+#endif
+}
+
+struct piper2_request {
+    std::shared_ptr<RequestState> state;
+};
+
+struct piper2_scheduler {
+    piper2_scheduler_options options;
+
+    // Parsed options.cpu_list (empty = any CPU)
+    std::vector<int> worker_cpus;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> num_queued{0};
+    std::atomic<std::size_t> next_queue{0};
+    std::atomic<uint64_t> next_seq{0};
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_cond;
+    bool stopping = false;
+
+    // Requests that may still have work, so they can be cancelled on free
+    std::mutex requests_mutex;
+    std::vector<std::weak_ptr<RequestState>> requests;
+};
+
+static void push_task(piper2_scheduler *sched, std::size_t queue_idx,
+                      Task task) {
+    {
+        auto &queue = *sched->queues[queue_idx % sched->queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        // Counted before it can be taken, so num_queued never goes below 0
+        sched->num_queued++;
+        queue.tasks.push(std::move(task));
+        queue.update_top_priority();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sched->wake_mutex);
+    }
+    sched->wake_cond.notify_one();
+}
+
+// Queue more sentences of a request, up to the read-ahead limit
+static void schedule_more(piper2_scheduler *sched,
+                          const std::shared_ptr<RequestState> &request,
+                          std::size_t queue_idx) {
+    std::vector<Task> tasks;
+
+    {
+        std::lock_guard<std::mutex> lock(request->mutex);
+        while (!request->cancelled && (request->error == PIPER2_OK) &&
+               (request->next_to_schedule < request->sentences.size()) &&
+               ((request->next_to_schedule - request->next_to_deliver) <
+                sched->options.max_sentences_ahead)) {
+            Task task;
+            task.request = request;
+            task.sentence_idx = request->next_to_schedule;
+            task.priority = request->priority;
+            task.deadline = request->deadline;
+            task.seq = sched->next_seq++;
+            task.queued_ns = trace_begin();
+            tasks.push_back(std::move(task));
+
+            request->next_to_schedule++;
+        }
+    }
+
+    for (auto &task : tasks) {
+        push_task(sched, queue_idx, std::move(task));
+    }
+}
+
+static bool pop_task(piper2_scheduler *sched, WorkerQueue &queue,
+                     Task &task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = queue.tasks.top();
+    queue.tasks.pop();
+    queue.update_top_priority();
+    sched->num_queued--;
+
+    return true;
+}
+
+// Pop from our own queue, so sentences of the same request tend to stay on
+// one worker. Other queues are only locked to steal when ours is empty, or
+// when one of them holds a more urgent priority class than ours.
+static bool take_task(piper2_scheduler *sched, std::size_t worker_idx,
+                      Task &task) {
+    std::size_t num_queues = sched->queues.size();
+    auto &own_queue = *sched->queues[worker_idx];
+
+    std::size_t urgent_queue_idx = worker_idx;
+    int urgent_priority =
+        own_queue.top_priority.load(std::memory_order_relaxed);
+    for (std::size_t offset = 1; offset < num_queues; ++offset) {
+        std::size_t queue_idx = (worker_idx + offset) % num_queues;
+        int priority = sched->queues[queue_idx]->top_priority.load(
+            std::memory_order_relaxed);
+        if (priority < urgent_priority) {
+            urgent_queue_idx = queue_idx;
+            urgent_priority = priority;
+        }
+    }
+
+    if ((urgent_queue_idx != worker_idx) &&
+        pop_task(sched, *sched->queues[urgent_queue_idx], task)) {
+        return true;
+    }
+
+    if (pop_task(sched, own_queue, task)) {
+        return true;
+    }
+
+    for (std::size_t offset = 1; offset < num_queues; ++offset) {
+        auto &queue = *sched->queues[(worker_idx + offset) % num_queues];
+        if ((queue.top_priority.load(std::memory_order_relaxed) !=
+             EMPTY_QUEUE_PRIORITY) &&
+            pop_task(sched, queue, task)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void run_task(piper2_scheduler *sched, std::size_t worker_idx,
+                     Task &task) {
+    auto &request = task.request;
+    TraceContextScope trace_scope(request->trace_request_id,
+                                  (uint32_t)task.sentence_idx);
+    trace_end(TRACE_QUEUED, task.queued_ns);
+
+    {
+        std::lock_guard<std::mutex> lock(request->mutex);
+        if (request->cancelled || (request->error != PIPER2_OK)) {
+            return;
+        }
+
+        request->num_running++;
+    }
+
+    SentenceAudio audio;
+    int result =
+        synthesize_sentence(request->synth,
+                            request->sentences[task.sentence_idx],
+                            request->params, audio);
+
+    {
+        std::lock_guard<std::mutex> lock(request->mutex);
+        request->num_running--;
+        if (result != PIPER2_OK) {
+            request->error = result;
+        } else if (!request->cancelled) {
+            request->ready.emplace(task.sentence_idx, std::move(audio));
+        }
+
+        request->update_fd();
+    }
+    request->ready_cond.notify_all();
+
+    schedule_more(sched, request, worker_idx);
+}
+
+static void worker_run(piper2_scheduler *sched, std::size_t worker_idx) {
+    trace_set_thread_name("piper2 worker " + std::to_string(worker_idx));
+
+    if (!sched->worker_cpus.empty()) {
+        pin_current_thread(sched->worker_cpus);
+    } else if (sched->options.numa_node >= 0) {
+        // Buffers allocated while synthesizing also come from the node
+        bind_current_thread_to_node(sched->options.numa_node);
+    }
+
+    while (true) {
+        Task task;
+        if (take_task(sched, worker_idx, task)) {
+            run_task(sched, worker_idx, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sched->wake_mutex);
+        sched->wake_cond.wait(lock, [sched] {
+            return sched->stopping || (sched->num_queued > 0);
+        });
+
+        if (sched->stopping) {
+            break;
+        }
+    }
+}
+
+piper2_scheduler_options piper2_default_scheduler_options(void) {
+    piper2_scheduler_options options;
+    options.num_workers = 0;
+    options.max_queued_sentences = DEFAULT_MAX_QUEUED_SENTENCES;
+    options.max_sentences_ahead = DEFAULT_MAX_SENTENCES_AHEAD;
+    options.cpu_list = nullptr;
+    options.numa_node = -1;
+
+    return options;
+}
+
+piper2_scheduler *
+piper2_scheduler_create(const piper2_scheduler_options *options) {
+    std::vector<int> worker_cpus;
+    if (options && options->cpu_list) {
+        auto cpus = parse_cpu_list(options->cpu_list);
+        if (!cpus) {
+            return nullptr;
+        }
+
+        worker_cpus = std::move(*cpus);
+    }
+
+    piper2_scheduler *sched = new piper2_scheduler();
+    sched->options =
+        options ? *options : piper2_default_scheduler_options();
+    sched->options.cpu_list = nullptr; // not owned
+    sched->worker_cpus = std::move(worker_cpus);
+
+    if (sched->options.num_workers < 1) {
+        sched->options.num_workers =
+            std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if (sched->options.max_sentences_ahead < 1) {
+        sched->options.max_sentences_ahead = 1;
+    }
+
+    for (std::size_t i = 0; i < sched->options.num_workers; ++i) {
+        sched->queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (std::size_t i = 0; i < sched->options.num_workers; ++i) {
+        sched->workers.emplace_back(worker_run, sched, i);
+    }
+
+    return sched;
+}
+
+void piper2_scheduler_free(piper2_scheduler *sched) {
+    if (!sched) {
+        return;
+    }
+
+    // Cancel first, so workers stop scheduling sentences and only finish
+    // the ones they're running
+    {
+        std::lock_guard<std::mutex> lock(sched->requests_mutex);
+        for (auto &weak_request : sched->requests) {
+            if (auto request = weak_request.lock()) {
+                {
+                    std::lock_guard<std::mutex> request_lock(request->mutex);
+                    request->cancelled = true;
+                    request->update_fd();
+                }
+                request->ready_cond.notify_all();
+            }
+        }
+    }
+
+    for (auto &queue : sched->queues) {
+        // Destroyed outside the lock, since a task may hold the last
+        // reference to its request
+        std::priority_queue<Task, std::vector<Task>, TaskAfter> tasks;
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            sched->num_queued -= queue->tasks.size();
+            std::swap(tasks, queue->tasks);
+            queue->update_top_priority();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sched->wake_mutex);
+        sched->stopping = true;
+    }
+    sched->wake_cond.notify_all();
+
+    for (auto &worker : sched->workers) {
+        worker.join();
+    }
+
+    delete sched;
+}
+
+static void begin_capture(RequestCapture &capture, piper2_synthesizer *synth,
+                          const char *text, int priority, int64_t deadline_ms,
+                          const SynthesisParams &params) {
+    capture.begin(synth->capture_log, synth->capture_voice, text,
+                  (uint8_t)priority, std::max<int64_t>(0, deadline_ms),
+                  params.speaker_id, params.length_scale, params.noise_scale,
+                  params.noise_w_scale);
+}
+
+int piper2_scheduler_submit(piper2_scheduler *sched,
+                            piper2_synthesizer *synth, const char *text,
+                            const piper2_synthesize_options *options,
+                            int priority, int64_t deadline_ms,
+                            piper2_request **request) {
+    if (!sched || !synth || !text || !request ||
+        (priority < PIPER2_PRIORITY_INTERACTIVE) ||
+        (priority > PIPER2_PRIORITY_BULK)) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    *request = nullptr;
+
+    // Admission control
+    std::size_t max_queued = sched->options.max_queued_sentences;
+    if (max_queued > 0) {
+        if (priority >= PIPER2_PRIORITY_BULK) {
+            // Keep headroom for interactive requests
+            max_queued /= 2;
+        }
+
+        if (sched->num_queued >= max_queued) {
+            if (synth->capture_log) {
+                // So replays include the overload
+                RequestCapture refused_capture;
+                begin_capture(refused_capture, synth, text, priority,
+                              deadline_ms,
+                              make_synthesis_params(synth, options));
+                refused_capture.end(CAPTURE_STATUS_REFUSED);
+            }
+
+            return PIPER2_ERR_BUSY;
+        }
+    }
+
+    auto state = std::make_shared<RequestState>();
+    state->sched = sched;
+    state->synth = synth;
+    state->params = make_synthesis_params(synth, options);
+    state->trace_request_id = new_trace_request_id();
+    {
+        TraceContextScope trace_scope(state->trace_request_id,
+                                      TRACE_NO_SENTENCE);
+        state->sentences = text_to_sentences(synth, text);
+    }
+    state->priority = priority;
+    state->deadline = Clock::time_point::max();
+    if (deadline_ms > 0) {
+        state->deadline = Clock::now() + std::chrono::milliseconds(deadline_ms);
+    }
+
+    begin_capture(state->capture, synth, text, priority, deadline_ms,
+                  state->params);
+
+    {
+        std::lock_guard<std::mutex> lock(sched->requests_mutex);
+        sched->requests.erase(
+            std::remove_if(sched->requests.begin(), sched->requests.end(),
+                           [](const std::weak_ptr<RequestState> &r) {
+                               return r.expired();
+                           }),
+            sched->requests.end());
+        sched->requests.push_back(state);
+    }
+
+    schedule_more(sched, state, sched->next_queue++);
+
+    *request = new piper2_request{state};
+
+    return PIPER2_OK;
+}
+
+// Take the next chunk if it's ready (request mutex held).
+// Returns PIPER2_AGAIN if the caller must wait.
+static int take_next_chunk(RequestState &state, piper2_audio_chunk *chunk) {
+    chunk->sample_rate = state.synth->sample_rate;
+    chunk->samples = nullptr;
+    chunk->num_samples = 0;
+    chunk->is_last = false;
+
+    if (state.cancelled) {
+        return PIPER2_ERR_CANCELLED;
+    }
+
+    if (state.error != PIPER2_OK) {
+        state.capture.end(CAPTURE_STATUS_ERROR);
+        return state.error;
+    }
+
+    if (state.next_to_deliver >= state.sentences.size()) {
+        // Empty final chunk
+        chunk->is_last = true;
+        state.capture.end(CAPTURE_STATUS_DONE);
+        return PIPER2_DONE;
+    }
+
+    auto ready_iter = state.ready.find(state.next_to_deliver);
+    if (ready_iter == state.ready.end()) {
+        return PIPER2_AGAIN;
+    }
+
+    state.current = std::move(ready_iter->second);
+    state.ready.erase(ready_iter);
+    state.next_to_deliver++;
+    state.update_fd();
+
+    if (state.synth->postprocess.enabled) {
+        int64_t postprocess_begin = trace_begin();
+        postprocess_chunk(state.synth->postprocess, state.synth->sample_rate,
+                          state.postprocess, state.current.samples.data(),
+                          state.current.samples.size());
+        trace_end(TRACE_POSTPROCESS, postprocess_begin,
+                  state.trace_request_id,
+                  (uint32_t)(state.next_to_deliver - 1));
+    }
+
+    fill_audio_chunk(state.synth, state.current, chunk);
+    chunk->is_last = (state.next_to_deliver >= state.sentences.size());
+    state.capture.add_chunk(chunk->num_samples);
+
+    return PIPER2_OK;
+}
+
+int piper2_request_next(piper2_request *request, piper2_audio_chunk *chunk) {
+    if (!request || !chunk) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto &state = request->state;
+    int result = PIPER2_OK;
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->current.samples.clear();
+
+        state->ready_cond.wait(lock, [&state] { return state->is_readable(); });
+        result = take_next_chunk(*state, chunk);
+    }
+
+    if (result == PIPER2_OK) {
+        // Reading a chunk makes room for more sentences
+        schedule_more(state->sched, state, state->sched->next_queue++);
+    }
+
+    return result;
+}
+
+int piper2_request_try_next(piper2_request *request,
+                            piper2_audio_chunk *chunk) {
+    if (!request || !chunk) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    auto &state = request->state;
+    int result = PIPER2_OK;
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        result = take_next_chunk(*state, chunk);
+    }
+
+    if (result == PIPER2_OK) {
+        // Reading a chunk makes room for more sentences
+        schedule_more(state->sched, state, state->sched->next_queue++);
+    }
+
+    return result;
+}
+
+int piper2_request_fd(piper2_request *request) {
+    if (!request) {
+        return -1;
+    }
+
+    auto &state = request->state;
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+#if defined(_WIN32)
+    return -1;
+#else
+    if (state->read_fd < 0) {
+        // Created on first use so blocking callers don't pay for it
+#if defined(__linux__)
+        int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            return -1;
+        }
+
+        state->read_fd = event_fd;
+        state->write_fd = event_fd;
+#else
+        int pipe_fds[2];
+        if (pipe(pipe_fds) != 0) {
+            return -1;
+        }
+
+        for (int fd : pipe_fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        state->read_fd = pipe_fds[0];
+        state->write_fd = pipe_fds[1];
+#endif
+        state->fd_signaled = false;
+        state->update_fd();
+    }
+
+    return state->read_fd;
+#endif
+}
+
+void piper2_request_cancel(piper2_request *request) {
+    if (!request) {
+        return;
+    }
+
+    auto &state = request->state;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+        state->ready.clear();
+        state->update_fd();
+        state->capture.end(CAPTURE_STATUS_CANCELLED);
+    }
+    state->ready_cond.notify_all();
+}
+
+void piper2_request_free(piper2_request *request) {
+    if (!request) {
+        return;
+    }
+
+    piper2_request_cancel(request);
+
+    // Queued sentences see the cancel and skip synthesis, but running ones
+    // still use the synthesizer
+    auto &state = request->state;
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->ready_cond.wait(lock,
+                               [&state] { return state->num_running == 0; });
+    }
+
+    delete request;
+}
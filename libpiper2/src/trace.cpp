@@ -0,0 +1,211 @@
+#include "piper2.h"
+#include "piper2_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+const char *const TRACE_STAGE_NAMES[TRACE_NUM_STAGES] = {
+    "segmentation", "number_format", "phonemizer", "stress",
+    "voice",        "copy_out",      "postprocess", "queued",
+};
+
+std::atomic<bool> trace_enabled{false};
+thread_local TraceContext trace_context;
+
+static std::atomic<uint64_t> next_request_id{1};
+
+// Events of one thread. Only that thread writes events and advances head;
+// only the flush advances tail, so neither needs a lock.
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> is_exited{false};
+
+    uint32_t thread_idx = 0;
+    std::string thread_name; // guarded by buffers_mutex
+};
+
+// Buffers of all threads that have recorded events, kept after their threads
+// exit until flushed.
+static std::mutex buffers_mutex;
+static std::vector<std::shared_ptr<TraceBuffer>> buffers;
+static uint32_t next_thread_idx = 0;
+
+// Owned by a thread, created on its first event
+struct ThreadTrace {
+    std::shared_ptr<TraceBuffer> buffer;
+    std::string name;
+
+    ~ThreadTrace() {
+        if (buffer) {
+            buffer->is_exited = true;
+        }
+    }
+};
+
+static thread_local ThreadTrace thread_trace;
+
+static TraceBuffer &get_thread_buffer() {
+    if (!thread_trace.buffer) {
+        auto buffer = std::make_shared<TraceBuffer>();
+        buffer->events.resize(TRACE_BUFFER_EVENTS);
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffer->thread_idx = next_thread_idx++;
+        buffer->thread_name = thread_trace.name;
+        buffers.push_back(buffer);
+        thread_trace.buffer = std::move(buffer);
+    }
+
+    return *thread_trace.buffer;
+}
+
+uint64_t new_trace_request_id() { return next_request_id++; }
+
+int64_t trace_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+}
+
+void trace_end(TraceStage stage, int64_t begin_ns, uint64_t request_id,
+               uint32_t sentence_idx) {
+    if (begin_ns < 0) {
+        return;
+    }
+
+    int64_t end_ns = trace_now_ns();
+    TraceBuffer &buffer = get_thread_buffer();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    if ((head - buffer.tail.load(std::memory_order_acquire)) >=
+        buffer.events.size()) {
+        // Full until the next flush
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer.events[head % buffer.events.size()] =
+        TraceEvent{begin_ns, end_ns, request_id, sentence_idx, stage};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void trace_set_thread_name(const std::string &name) {
+    thread_trace.name = name;
+    if (thread_trace.buffer) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        thread_trace.buffer->thread_name = name;
+    }
+}
+
+int piper2_trace_start(void) {
+#if defined(PIPER2_HAVE_TRACING)
+    trace_enabled = true;
+    return PIPER2_OK;
+#else
+    return PIPER2_ERR_GENERIC;
+#endif
+}
+
+void piper2_trace_stop(void) { trace_enabled = false; }
+
+int piper2_trace_flush(const char *path) {
+    if (!path) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    std::ofstream trace_file(path, std::ios::out | std::ios::trunc);
+    if (!trace_file) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+#if !defined(_WIN32)
+    long pid = (long)getpid();
+#else
+    long pid = 0;
+#endif
+
+    // Chrome trace event format, timestamps in microseconds
+    trace_file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool is_first = true;
+    auto separator = [&is_first]() {
+        const char *sep = is_first ? "\n" : ",\n";
+        is_first = false;
+        return sep;
+    };
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::vector<std::shared_ptr<TraceBuffer>> exited_buffers;
+    for (auto &buffer : buffers) {
+        // Checked first, so no events can be recorded after the drain below
+        if (buffer->is_exited.load()) {
+            exited_buffers.push_back(buffer);
+        }
+
+        trace_file << separator() << "{\"ph\":\"M\",\"name\":\"thread_name\""
+                   << ",\"pid\":" << pid << ",\"tid\":" << buffer->thread_idx
+                   << ",\"args\":{\"name\":\"";
+        if (buffer->thread_name.empty()) {
+            trace_file << "thread " << buffer->thread_idx;
+        } else {
+            trace_file << buffer->thread_name;
+        }
+        trace_file << "\"}}";
+
+        uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        for (uint64_t event_idx = tail; event_idx < head; ++event_idx) {
+            const TraceEvent &event =
+                buffer->events[event_idx % buffer->events.size()];
+            int64_t duration_ns = event.end_ns - event.begin_ns;
+            trace_file << separator() << "{\"ph\":\"X\",\"cat\":\"piper2\""
+                       << ",\"name\":\"" << TRACE_STAGE_NAMES[event.stage]
+                       << "\",\"pid\":" << pid
+                       << ",\"tid\":" << buffer->thread_idx
+                       << ",\"ts\":" << (event.begin_ns / 1000) << "."
+                       << (event.begin_ns % 1000 / 100)
+                       << ",\"dur\":" << (duration_ns / 1000) << "."
+                       << (duration_ns % 1000 / 100)
+                       << ",\"args\":{";
+            if (event.request_id > 0) {
+                trace_file << "\"request\":" << event.request_id;
+            }
+            if (event.sentence_idx != TRACE_NO_SENTENCE) {
+                trace_file << ((event.request_id > 0) ? "," : "")
+                           << "\"sentence\":" << event.sentence_idx;
+            }
+            trace_file << "}}";
+        }
+
+        uint64_t dropped = buffer->dropped.exchange(0);
+        if (dropped > 0) {
+            trace_file << separator() << "{\"ph\":\"i\",\"s\":\"t\""
+                       << ",\"name\":\"dropped " << dropped << " events\""
+                       << ",\"pid\":" << pid
+                       << ",\"tid\":" << buffer->thread_idx << ",\"ts\":"
+                       << (trace_now_ns() / 1000) << "}";
+        }
+
+        buffer->tail.store(head, std::memory_order_release);
+    }
+
+    trace_file << "\n]}\n";
+
+    // Buffers of exited threads have nothing more to record
+    for (auto &buffer : exited_buffers) {
+        buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+    }
+
+    return trace_file ? PIPER2_OK : PIPER2_ERR_GENERIC;
+}
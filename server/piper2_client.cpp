@@ -0,0 +1,282 @@
+#include "piper2_client.h"
+#include "piper2_protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <json.hpp>
+
+using json = nlohmann::json;
+
+#if defined(MSG_NOSIGNAL)
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+struct piper2_client {
+    int fd = -1;
+    std::vector<uint8_t> frame_payload;
+    std::vector<float> chunk_samples;
+    std::string stats;
+    std::string estimate;
+};
+
+static bool send_all(int fd, const uint8_t *data, std::size_t length) {
+    while (length > 0) {
+        ssize_t num_written = send(fd, data, length, SEND_FLAGS);
+        if (num_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data += num_written;
+        length -= num_written;
+    }
+
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t *data, std::size_t length) {
+    while (length > 0) {
+        ssize_t num_read = recv(fd, data, length, 0);
+        if (num_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        if (num_read == 0) {
+            // Disconnected
+            return false;
+        }
+
+        data += num_read;
+        length -= num_read;
+    }
+
+    return true;
+}
+
+static bool send_frame(piper2_client *client, uint8_t type,
+                       const std::string &payload) {
+    std::vector<uint8_t> frame(PIPER2_FRAME_HEADER_SIZE + payload.size());
+    piper2_put_frame_header(frame.data(), type, (uint32_t)payload.size());
+    std::memcpy(frame.data() + PIPER2_FRAME_HEADER_SIZE, payload.data(),
+                payload.size());
+
+    return send_all(client->fd, frame.data(), frame.size());
+}
+
+// Read a frame into client->frame_payload and return its type (or -1)
+static int recv_frame(piper2_client *client) {
+    uint8_t header[PIPER2_FRAME_HEADER_SIZE];
+    if (!recv_all(client->fd, header, sizeof(header))) {
+        return -1;
+    }
+
+    uint32_t length = piper2_get_u32(header);
+    if (length > PIPER2_FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    client->frame_payload.resize(length);
+    if ((length > 0) &&
+        !recv_all(client->fd, client->frame_payload.data(), length)) {
+        return -1;
+    }
+
+    return header[4];
+}
+
+piper2_client *piper2_client_connect(const char *socket_path) {
+    if (!socket_path) {
+        return nullptr;
+    }
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return nullptr;
+    }
+    std::strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+#if defined(SO_NOSIGPIPE)
+    int no_sigpipe = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+
+    piper2_client *client = new piper2_client();
+    client->fd = fd;
+
+    return client;
+}
+
+void piper2_client_close(piper2_client *client) {
+    if (!client) {
+        return;
+    }
+
+    close(client->fd);
+    delete client;
+}
+
+static void put_synthesize_options(json &request_json,
+                                   const piper2_synthesize_options *options) {
+    if (options) {
+        request_json["speaker_id"] = options->speaker_id;
+        request_json["length_scale"] = options->length_scale;
+        request_json["noise_scale"] = options->noise_scale;
+        request_json["noise_w_scale"] = options->noise_w_scale;
+    }
+}
+
+int piper2_client_synthesize_start(piper2_client *client, const char *voice,
+                                   const char *text,
+                                   const piper2_synthesize_options *options,
+                                   int priority) {
+    if (!client || !voice || !text) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    json request_json{{"voice", voice}, {"text", text}, {"priority", priority}};
+    put_synthesize_options(request_json, options);
+
+    if (!send_frame(client, PIPER2_FRAME_SYNTHESIZE, request_json.dump())) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    return PIPER2_OK;
+}
+
+int piper2_client_synthesize_next(piper2_client *client,
+                                  piper2_audio_chunk *chunk) {
+    if (!client || !chunk) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    chunk->samples = nullptr;
+    chunk->num_samples = 0;
+    chunk->sample_rate = 0;
+    chunk->is_last = false;
+    chunk->chars = nullptr;
+    chunk->phonemes = nullptr;
+    chunk->phoneme_ids = nullptr;
+    chunk->num_phoneme_ids = 0;
+
+    while (true) {
+        int type = recv_frame(client);
+        auto &payload = client->frame_payload;
+
+        switch (type) {
+        case PIPER2_FRAME_AUDIO: {
+            if (payload.size() < 4) {
+                return PIPER2_ERR_GENERIC;
+            }
+
+            std::size_t num_samples = (payload.size() - 4) / sizeof(float);
+            client->chunk_samples.resize(num_samples);
+            std::memcpy(client->chunk_samples.data(), payload.data() + 4,
+                        num_samples * sizeof(float));
+
+            chunk->sample_rate = (int)piper2_get_u32(payload.data());
+            chunk->samples = client->chunk_samples.data();
+            chunk->num_samples = num_samples;
+            return PIPER2_OK;
+        }
+
+        case PIPER2_FRAME_DONE:
+            chunk->is_last = true;
+            return PIPER2_DONE;
+
+        case PIPER2_FRAME_ERROR:
+            if (payload.size() < 4) {
+                return PIPER2_ERR_GENERIC;
+            }
+            return (int)(int32_t)piper2_get_u32(payload.data());
+
+        case PIPER2_FRAME_STATS_REPLY:
+        case PIPER2_FRAME_ESTIMATE_REPLY:
+            // Not for us
+            continue;
+
+        default:
+            return PIPER2_ERR_GENERIC;
+        }
+    }
+}
+
+int piper2_client_cancel(piper2_client *client) {
+    if (!client) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    if (!send_frame(client, PIPER2_FRAME_CANCEL, "")) {
+        return PIPER2_ERR_GENERIC;
+    }
+
+    return PIPER2_OK;
+}
+
+const char *piper2_client_stats(piper2_client *client) {
+    if (!client) {
+        return nullptr;
+    }
+
+    if (!send_frame(client, PIPER2_FRAME_STATS, "")) {
+        return nullptr;
+    }
+
+    if (recv_frame(client) != PIPER2_FRAME_STATS_REPLY) {
+        return nullptr;
+    }
+
+    client->stats.assign(client->frame_payload.begin(),
+                         client->frame_payload.end());
+
+    return client->stats.c_str();
+}
+
+const char *piper2_client_estimate(piper2_client *client, const char *voice,
+                                   const char *text,
+                                   const piper2_synthesize_options *options) {
+    if (!client || !voice || !text) {
+        return nullptr;
+    }
+
+    json request_json{{"voice", voice}, {"text", text}};
+    put_synthesize_options(request_json, options);
+
+    if (!send_frame(client, PIPER2_FRAME_ESTIMATE, request_json.dump())) {
+        return nullptr;
+    }
+
+    if (recv_frame(client) != PIPER2_FRAME_ESTIMATE_REPLY) {
+        return nullptr;
+    }
+
+    client->estimate.assign(client->frame_payload.begin(),
+                            client->frame_payload.end());
+
+    return client->estimate.c_str();
+}
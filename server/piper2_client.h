@@ -0,0 +1,118 @@
+#ifndef PIPER2_CLIENT_H_
+#define PIPER2_CLIENT_H_
+
+#include <piper2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Connection to a piper2-server.
+ */
+typedef struct piper2_client piper2_client;
+
+/**
+ * \brief Connect to a piper2-server.
+ *
+ * \param socket_path path to the server's Unix domain socket.
+ *
+ * \return a client or NULL on error.
+ */
+piper2_client *piper2_client_connect(const char *socket_path);
+
+/**
+ * \brief Close the connection, cancelling any request in progress.
+ *
+ * \param client Piper client.
+ */
+void piper2_client_close(piper2_client *client);
+
+/**
+ * \brief Start synthesis on the server.
+ *
+ * \param client Piper client.
+ *
+ * \param voice name of a voice loaded by the server.
+ *
+ * \param text text to synthesize into audio.
+ *
+ * \param options synthesis options or NULL for the voice's defaults.
+ *
+ * \param priority one of the PIPER2_PRIORITY_* values.
+ *
+ * \sa \ref piper2_client_synthesize_next
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_client_synthesize_start(piper2_client *client, const char *voice,
+                                   const char *text,
+                                   const piper2_synthesize_options *options,
+                                   int priority);
+
+/**
+ * \brief Wait for the next chunk of audio from the server.
+ *
+ * \param client Piper client.
+ *
+ * \param chunk audio chunk to fill. Only samples, num_samples, sample_rate
+ * and is_last are set.
+ *
+ * Each call will fill the audio chunk, invalidating the memory of the
+ * previous chunk.
+ *
+ * \return PIPER2_DONE when complete, otherwise PIPER2_OK or error code
+ * (PIPER2_ERR_BUSY if the server refused the request).
+ */
+int piper2_client_synthesize_next(piper2_client *client,
+                                  piper2_audio_chunk *chunk);
+
+/**
+ * \brief Cancel the request in progress.
+ *
+ * piper2_client_synthesize_next will return PIPER2_ERR_CANCELLED once the
+ * server has stopped.
+ *
+ * \param client Piper client.
+ *
+ * \return PIPER2_OK or error code.
+ */
+int piper2_client_cancel(piper2_client *client);
+
+/**
+ * \brief Get server statistics.
+ *
+ * Must not be called while a request is in progress.
+ *
+ * \param client Piper client.
+ *
+ * \return JSON object as text, valid until the next call, or NULL on error.
+ */
+const char *piper2_client_stats(piper2_client *client);
+
+/**
+ * \brief Predict the cost of synthesizing text on the server without
+ * synthesizing it.
+ *
+ * Must not be called while a request is in progress.
+ *
+ * \param client Piper client.
+ *
+ * \param voice name of a voice loaded by the server.
+ *
+ * \param text text to estimate.
+ *
+ * \param options synthesis options or NULL for the voice's defaults.
+ *
+ * \return JSON object as text (see PIPER2_FRAME_ESTIMATE_REPLY), valid until
+ * the next call, or NULL on error.
+ */
+const char *piper2_client_estimate(piper2_client *client, const char *voice,
+                                   const char *text,
+                                   const piper2_synthesize_options *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIPER2_CLIENT_H_
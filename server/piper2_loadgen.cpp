@@ -0,0 +1,211 @@
+// Load generator for piper2-server.
+// Runs concurrent connections that each issue synthesis requests back to
+// back, then reports latency percentiles and throughput.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "piper2_client.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct RequestResult {
+    double first_chunk_seconds = 0;
+    double total_seconds = 0;
+    double audio_seconds = 0;
+    bool ok = false;
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    std::size_t idx = (std::size_t)(p * (values.size() - 1));
+    return values[idx];
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]" << std::endl
+              << std::endl
+              << "  --socket PATH         server socket (default: piper2.sock)"
+              << std::endl
+              << "  --voice NAME          voice to request" << std::endl
+              << "  --connections N       concurrent connections (default: 4)"
+              << std::endl
+              << "  --requests N          requests per connection (default: 10)"
+              << std::endl
+              << "  --text TEXT           text to synthesize" << std::endl
+              << "  --text-file PATH      one text per line, used round robin"
+              << std::endl
+              << "  --priority N          request priority (default: 1)"
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string socket_path = "piper2.sock";
+    std::string voice;
+    std::size_t num_connections = 4;
+    std::size_t num_requests = 10;
+    int priority = PIPER2_PRIORITY_NORMAL;
+    std::vector<std::string> texts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--socket") && has_value) {
+            socket_path = argv[++i];
+        } else if ((arg == "--voice") && has_value) {
+            voice = argv[++i];
+        } else if ((arg == "--connections") && has_value) {
+            num_connections = std::stoul(argv[++i]);
+        } else if ((arg == "--requests") && has_value) {
+            num_requests = std::stoul(argv[++i]);
+        } else if ((arg == "--text") && has_value) {
+            texts.push_back(argv[++i]);
+        } else if ((arg == "--text-file") && has_value) {
+            std::ifstream text_file(argv[++i]);
+            std::string line;
+            while (std::getline(text_file, line)) {
+                if (!line.empty()) {
+                    texts.push_back(line);
+                }
+            }
+        } else if ((arg == "--priority") && has_value) {
+            priority = std::stoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (voice.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (texts.empty()) {
+        texts.push_back("This is a test of the Piper text to speech server. "
+                        "It has two sentences.");
+    }
+
+    std::mutex results_mutex;
+    std::vector<RequestResult> results;
+
+    auto start_time = Clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t conn_idx = 0; conn_idx < num_connections; ++conn_idx) {
+        threads.emplace_back([&, conn_idx] {
+            piper2_client *client =
+                piper2_client_connect(socket_path.c_str());
+            if (!client) {
+                std::cerr << "Failed to connect to " << socket_path
+                          << std::endl;
+                return;
+            }
+
+            for (std::size_t req_idx = 0; req_idx < num_requests; ++req_idx) {
+                const std::string &text =
+                    texts[((conn_idx * num_requests) + req_idx) % texts.size()];
+                RequestResult result;
+
+                auto request_start = Clock::now();
+                int status = piper2_client_synthesize_start(
+                    client, voice.c_str(), text.c_str(), nullptr, priority);
+
+                piper2_audio_chunk chunk;
+                bool is_first = true;
+                while (status == PIPER2_OK) {
+                    status = piper2_client_synthesize_next(client, &chunk);
+                    if (status != PIPER2_OK) {
+                        break;
+                    }
+
+                    if (is_first) {
+                        result.first_chunk_seconds =
+                            std::chrono::duration<double>(Clock::now() -
+                                                          request_start)
+                                .count();
+                        is_first = false;
+                    }
+
+                    if (chunk.sample_rate > 0) {
+                        result.audio_seconds +=
+                            (double)chunk.num_samples / chunk.sample_rate;
+                    }
+                }
+
+                result.total_seconds =
+                    std::chrono::duration<double>(Clock::now() - request_start)
+                        .count();
+                result.ok = (status == PIPER2_DONE);
+
+                std::lock_guard<std::mutex> lock(results_mutex);
+                results.push_back(result);
+            }
+
+            piper2_client_close(client);
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    double wall_seconds =
+        std::chrono::duration<double>(Clock::now() - start_time).count();
+
+    std::vector<double> first_chunk_latencies;
+    std::vector<double> total_latencies;
+    double audio_seconds = 0;
+    std::size_t num_failed = 0;
+    for (auto &result : results) {
+        if (!result.ok) {
+            num_failed++;
+            continue;
+        }
+
+        first_chunk_latencies.push_back(result.first_chunk_seconds);
+        total_latencies.push_back(result.total_seconds);
+        audio_seconds += result.audio_seconds;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "requests: " << results.size() << " (" << num_failed
+              << " failed)" << std::endl;
+    std::cout << "wall time: " << wall_seconds << " s" << std::endl;
+    std::cout << "throughput: " << (total_latencies.size() / wall_seconds)
+              << " requests/s, " << (audio_seconds / wall_seconds)
+              << " audio s/s" << std::endl;
+
+    for (auto &latencies :
+         {std::make_pair("first chunk", &first_chunk_latencies),
+          std::make_pair("total", &total_latencies)}) {
+        std::cout << latencies.first << " latency (s):"
+                  << " p50=" << percentile(*latencies.second, 0.50)
+                  << " p90=" << percentile(*latencies.second, 0.90)
+                  << " p99=" << percentile(*latencies.second, 0.99)
+                  << " max=" << percentile(*latencies.second, 1.0)
+                  << std::endl;
+    }
+
+    piper2_client *client = piper2_client_connect(socket_path.c_str());
+    if (client) {
+        const char *stats = piper2_client_stats(client);
+        if (stats) {
+            std::cout << "server stats: " << stats << std::endl;
+        }
+        piper2_client_close(client);
+    }
+
+    return (num_failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#ifndef PIPER2_PROTOCOL_H_
+#define PIPER2_PROTOCOL_H_
+
+// Wire protocol between piper2-server and piper2_client.
+//
+// Every message is a frame:
+//
+//   uint32 payload length (little endian)
+//   uint8  frame type
+//   payload
+//
+// Client -> server:
+//   SYNTHESIZE  JSON object with "voice" and "text", and optionally
+//               "speaker_id", "length_scale", "noise_scale", "noise_w_scale"
+//               and "priority". One request per connection at a time.
+//   CANCEL      empty; stops the current request.
+//   STATS       empty; asks for a STATS_REPLY.
+//   ESTIMATE    JSON object like SYNTHESIZE; asks for an ESTIMATE_REPLY
+//               without synthesizing. Allowed during a request.
+//
+// Server -> client:
+//   AUDIO       uint32 sample rate, then float32 samples (little endian).
+//               Sent as soon as each chunk is synthesized.
+//   DONE        empty; the request is complete.
+//   ERROR       int32 PIPER2_ERR_* code, then a UTF-8 message.
+//   STATS_REPLY JSON object with server counters.
+//   ESTIMATE_REPLY
+//               JSON object with "num_sentences", "num_chars",
+//               "num_phonemes", "audio_seconds", "cpu_seconds" and a
+//               "sentences" array with the same fields per sentence.
+//
+// Closing the connection cancels its request.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PIPER2_FRAME_HEADER_SIZE 5
+#define PIPER2_FRAME_MAX_PAYLOAD (64 * 1024 * 1024)
+
+#define PIPER2_FRAME_SYNTHESIZE 1
+#define PIPER2_FRAME_CANCEL 2
+#define PIPER2_FRAME_STATS 3
+#define PIPER2_FRAME_ESTIMATE 4
+
+#define PIPER2_FRAME_AUDIO 16
+#define PIPER2_FRAME_DONE 17
+#define PIPER2_FRAME_ERROR 18
+#define PIPER2_FRAME_STATS_REPLY 19
+#define PIPER2_FRAME_ESTIMATE_REPLY 20
+
+static inline void piper2_put_u32(uint8_t *dest, uint32_t value) {
+  dest[0] = (uint8_t)(value & 0xFF);
+  dest[1] = (uint8_t)((value >> 8) & 0xFF);
+  dest[2] = (uint8_t)((value >> 16) & 0xFF);
+  dest[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+static inline uint32_t piper2_get_u32(const uint8_t *src) {
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline void piper2_put_frame_header(uint8_t *dest, uint8_t type,
+                                           uint32_t payload_length) {
+  piper2_put_u32(dest, payload_length);
+  dest[4] = type;
+}
+
+#endif // PIPER2_PROTOCOL_H_
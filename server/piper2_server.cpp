@@ -0,0 +1,855 @@
+// Synthesis daemon that serves loaded voices over a Unix domain socket.
+// See piper2_protocol.h for the wire format.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <json.hpp>
+
+#include <piper2.h>
+
+#include "piper2_protocol.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+// Stop reading chunks from a request while this much audio is unsent
+const std::size_t MAX_PENDING_OUTPUT = 256 * 1024;
+
+// Poll timeout while a request waits for its voice to load in the background
+const int VOICE_LOAD_POLL_MS = 20;
+
+// Synthesized by each voice before forking worker processes
+const char *const WARMUP_TEXT = "This is a test.";
+
+static volatile std::sig_atomic_t should_stop = 0;
+
+static void handle_stop_signal(int) { should_stop = 1; }
+
+struct Connection {
+    int fd = -1;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    std::size_t output_offset = 0;
+    piper2_request *request = nullptr;
+    piper2_synthesizer *synth = nullptr; // voice acquired for request
+    bool is_waiting_for_voice = false;   // frame kept in input until loaded
+    bool closed = false;
+
+    std::size_t pending_output() const { return output.size() - output_offset; }
+};
+
+struct ServerStats {
+    Clock::time_point start_time = Clock::now();
+    uint64_t connections_total = 0;
+    uint64_t requests_total = 0;
+    uint64_t requests_refused = 0;
+    uint64_t requests_cancelled = 0;
+    uint64_t requests_failed = 0;
+    uint64_t chunks_sent = 0;
+    double audio_seconds_sent = 0;
+};
+
+struct Server {
+    std::vector<std::string> voice_names;
+    piper2_registry *registry = nullptr;
+    piper2_scheduler *sched = nullptr;
+    std::vector<std::unique_ptr<Connection>> connections;
+    ServerStats stats;
+};
+
+static void queue_frame(Connection &conn, uint8_t type, const void *payload,
+                        std::size_t payload_length) {
+    std::size_t offset = conn.output.size();
+    conn.output.resize(offset + PIPER2_FRAME_HEADER_SIZE + payload_length);
+    piper2_put_frame_header(&conn.output[offset], type,
+                            (uint32_t)payload_length);
+    if (payload_length > 0) {
+        std::memcpy(&conn.output[offset + PIPER2_FRAME_HEADER_SIZE], payload,
+                    payload_length);
+    }
+}
+
+static void queue_error(Connection &conn, int code, const std::string &message) {
+    std::vector<uint8_t> payload(4 + message.size());
+    piper2_put_u32(payload.data(), (uint32_t)code);
+    std::memcpy(payload.data() + 4, message.data(), message.size());
+    queue_frame(conn, PIPER2_FRAME_ERROR, payload.data(), payload.size());
+}
+
+static void queue_audio(Connection &conn, const piper2_audio_chunk &chunk) {
+    std::size_t num_bytes = chunk.num_samples * sizeof(float);
+    std::size_t offset = conn.output.size();
+    conn.output.resize(offset + PIPER2_FRAME_HEADER_SIZE + 4 + num_bytes);
+
+    uint8_t *frame = &conn.output[offset];
+    piper2_put_frame_header(frame, PIPER2_FRAME_AUDIO, (uint32_t)(4 + num_bytes));
+    piper2_put_u32(frame + PIPER2_FRAME_HEADER_SIZE, (uint32_t)chunk.sample_rate);
+    if (num_bytes > 0) {
+        std::memcpy(frame + PIPER2_FRAME_HEADER_SIZE + 4, chunk.samples,
+                    num_bytes);
+    }
+}
+
+static void finish_request(Server &server, Connection &conn) {
+    // Waits for the request's running sentences, so the voice isn't in use
+    // when released and eviction can free it
+    piper2_request_free(conn.request);
+    conn.request = nullptr;
+
+    piper2_registry_release(server.registry, conn.synth);
+    conn.synth = nullptr;
+}
+
+static json get_stats(const Server &server) {
+    std::size_t requests_active = 0;
+    for (auto &conn : server.connections) {
+        if (conn->request) {
+            requests_active++;
+        }
+    }
+
+    return json{
+        {"uptime_seconds",
+         std::chrono::duration<double>(Clock::now() - server.stats.start_time)
+             .count()},
+        {"connections_active", server.connections.size()},
+        {"connections_total", server.stats.connections_total},
+        {"requests_active", requests_active},
+        {"requests_total", server.stats.requests_total},
+        {"requests_refused", server.stats.requests_refused},
+        {"requests_cancelled", server.stats.requests_cancelled},
+        {"requests_failed", server.stats.requests_failed},
+        {"chunks_sent", server.stats.chunks_sent},
+        {"audio_seconds_sent", server.stats.audio_seconds_sent},
+        {"voices", server.voice_names},
+        {"voice_memory_bytes", piper2_registry_memory_used(server.registry)},
+    };
+}
+
+// Synthesize and estimate requests need a voice and text. Checking the types
+// of all fields up front keeps the accessors below from throwing.
+static bool is_valid_request(const json &request_json) {
+    if (request_json.is_discarded() || !request_json.is_object()) {
+        return false;
+    }
+
+    auto voice_iter = request_json.find("voice");
+    auto text_iter = request_json.find("text");
+    if ((voice_iter == request_json.end()) || !voice_iter->is_string() ||
+        (text_iter == request_json.end()) || !text_iter->is_string()) {
+        return false;
+    }
+
+    for (const char *key : {"speaker_id", "priority"}) {
+        auto value_iter = request_json.find(key);
+        if ((value_iter != request_json.end()) &&
+            !value_iter->is_number_integer()) {
+            return false;
+        }
+    }
+
+    for (const char *key : {"length_scale", "noise_scale", "noise_w_scale"}) {
+        auto value_iter = request_json.find(key);
+        if ((value_iter != request_json.end()) && !value_iter->is_number()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Voices that aren't loaded are loaded in the background, so a cold voice
+// doesn't stall other connections. Returns PIPER2_AGAIN if the request must
+// be handled again later, or an error after replying with it.
+static int acquire_voice(Server &server, Connection &conn,
+                         const json &request_json,
+                         piper2_synthesizer **synth) {
+    std::string voice_name = request_json["voice"].get<std::string>();
+    int result =
+        piper2_registry_try_acquire(server.registry, voice_name.c_str(), synth);
+    if ((result != PIPER2_OK) && (result != PIPER2_AGAIN)) {
+        queue_error(conn, PIPER2_ERR_GENERIC, "unknown voice");
+    }
+
+    return result;
+}
+
+static piper2_synthesize_options
+get_synthesize_options(piper2_synthesizer *synth, const json &request_json) {
+    piper2_synthesize_options options =
+        piper2_default_synthesize_options(synth);
+    options.speaker_id =
+        request_json.value("speaker_id", options.speaker_id);
+    options.length_scale =
+        request_json.value("length_scale", options.length_scale);
+    options.noise_scale = request_json.value("noise_scale", options.noise_scale);
+    options.noise_w_scale =
+        request_json.value("noise_w_scale", options.noise_w_scale);
+
+    return options;
+}
+
+static json get_estimate_json(const piper2_cost_estimate &estimate) {
+    return json{
+        {"num_chars", estimate.num_chars},
+        {"num_phonemes", estimate.num_phonemes},
+        {"audio_seconds", estimate.audio_seconds},
+        {"cpu_seconds", estimate.cpu_seconds},
+    };
+}
+
+// Runs only the text frontend, so it is answered inline.
+// Returns false if the voice is still loading.
+static bool handle_estimate(Server &server, Connection &conn,
+                            const uint8_t *payload, std::size_t length) {
+    auto request_json = json::parse(payload, payload + length, nullptr, false);
+    if (!is_valid_request(request_json)) {
+        queue_error(conn, PIPER2_ERR_GENERIC, "bad request");
+        return true;
+    }
+
+    piper2_synthesizer *synth = nullptr;
+    int result = acquire_voice(server, conn, request_json, &synth);
+    if (result != PIPER2_OK) {
+        return result != PIPER2_AGAIN;
+    }
+
+    piper2_synthesize_options options =
+        get_synthesize_options(synth, request_json);
+    std::string text = request_json["text"].get<std::string>();
+
+    // Sentence count is only known afterwards, so retry with enough room
+    piper2_cost_estimate total;
+    std::vector<piper2_cost_estimate> sentences(16);
+    result = piper2_estimate(synth, text.c_str(), &options, &total,
+                                 sentences.data(), sentences.size());
+    if ((result == PIPER2_OK) && (total.num_sentences > sentences.size())) {
+        sentences.resize(total.num_sentences);
+        result = piper2_estimate(synth, text.c_str(), &options, &total,
+                                 sentences.data(), sentences.size());
+    }
+    piper2_registry_release(server.registry, synth);
+
+    if (result != PIPER2_OK) {
+        queue_error(conn, result, "estimate failed");
+        return true;
+    }
+
+    json reply_json = get_estimate_json(total);
+    reply_json["num_sentences"] = total.num_sentences;
+    reply_json["sentences"] = json::array();
+    for (std::size_t i = 0;
+         i < std::min(total.num_sentences, sentences.size()); ++i) {
+        reply_json["sentences"].push_back(get_estimate_json(sentences[i]));
+    }
+
+    std::string reply_str = reply_json.dump();
+    queue_frame(conn, PIPER2_FRAME_ESTIMATE_REPLY, reply_str.data(),
+                reply_str.size());
+
+    return true;
+}
+
+// Returns false if the voice is still loading
+static bool handle_synthesize(Server &server, Connection &conn,
+                              const uint8_t *payload, std::size_t length) {
+    if (conn.request) {
+        queue_error(conn, PIPER2_ERR_BUSY, "request already in progress");
+        return true;
+    }
+
+    auto request_json = json::parse(payload, payload + length, nullptr, false);
+    if (!is_valid_request(request_json)) {
+        queue_error(conn, PIPER2_ERR_GENERIC, "bad request");
+        return true;
+    }
+
+    piper2_synthesizer *synth = nullptr;
+    int result = acquire_voice(server, conn, request_json, &synth);
+    if (result != PIPER2_OK) {
+        return result != PIPER2_AGAIN;
+    }
+
+    piper2_synthesize_options options =
+        get_synthesize_options(synth, request_json);
+    int priority = request_json.value("priority", PIPER2_PRIORITY_NORMAL);
+
+    std::string text = request_json["text"].get<std::string>();
+    result = piper2_scheduler_submit(server.sched, synth, text.c_str(),
+                                         &options, priority, 0, &conn.request);
+    if (result != PIPER2_OK) {
+        piper2_registry_release(server.registry, synth);
+    }
+
+    if (result == PIPER2_ERR_BUSY) {
+        server.stats.requests_refused++;
+        queue_error(conn, result, "server busy");
+        return true;
+    }
+
+    if (result != PIPER2_OK) {
+        server.stats.requests_failed++;
+        queue_error(conn, result, "synthesis failed");
+        return true;
+    }
+
+    conn.synth = synth;
+    server.stats.requests_total++;
+
+    return true;
+}
+
+static void handle_input(Server &server, Connection &conn) {
+    conn.is_waiting_for_voice = false;
+
+    std::size_t offset = 0;
+    while ((conn.input.size() - offset) >= PIPER2_FRAME_HEADER_SIZE) {
+        const uint8_t *frame = &conn.input[offset];
+        uint32_t length = piper2_get_u32(frame);
+        uint8_t type = frame[4];
+
+        if (length > PIPER2_FRAME_MAX_PAYLOAD) {
+            conn.closed = true;
+            return;
+        }
+
+        if ((conn.input.size() - offset) < (PIPER2_FRAME_HEADER_SIZE + length)) {
+            // Incomplete frame
+            break;
+        }
+
+        const uint8_t *payload = frame + PIPER2_FRAME_HEADER_SIZE;
+        bool is_handled = true;
+        switch (type) {
+        case PIPER2_FRAME_SYNTHESIZE:
+            is_handled = handle_synthesize(server, conn, payload, length);
+            break;
+
+        case PIPER2_FRAME_CANCEL:
+            if (conn.request) {
+                server.stats.requests_cancelled++;
+                finish_request(server, conn);
+                queue_error(conn, PIPER2_ERR_CANCELLED, "cancelled");
+            }
+            break;
+
+        case PIPER2_FRAME_STATS: {
+            std::string stats_str = get_stats(server).dump();
+            queue_frame(conn, PIPER2_FRAME_STATS_REPLY, stats_str.data(),
+                        stats_str.size());
+            break;
+        }
+
+        case PIPER2_FRAME_ESTIMATE:
+            is_handled = handle_estimate(server, conn, payload, length);
+            break;
+
+        default:
+            queue_error(conn, PIPER2_ERR_GENERIC, "unknown frame type");
+            break;
+        }
+
+        if (!is_handled) {
+            // Handled again once the voice is loaded, before later frames
+            conn.is_waiting_for_voice = true;
+            break;
+        }
+
+        offset += PIPER2_FRAME_HEADER_SIZE + length;
+    }
+
+    conn.input.erase(conn.input.begin(), conn.input.begin() + offset);
+}
+
+// Move ready chunks from the request into the output buffer
+static void collect_chunks(Server &server, Connection &conn) {
+    while (conn.request && (conn.pending_output() < MAX_PENDING_OUTPUT)) {
+        piper2_audio_chunk chunk;
+        int result = piper2_request_try_next(conn.request, &chunk);
+        if (result == PIPER2_AGAIN) {
+            break;
+        }
+
+        if (result == PIPER2_OK) {
+            queue_audio(conn, chunk);
+            server.stats.chunks_sent++;
+            if (chunk.sample_rate > 0) {
+                server.stats.audio_seconds_sent +=
+                    (double)chunk.num_samples / chunk.sample_rate;
+            }
+            continue;
+        }
+
+        if (result == PIPER2_DONE) {
+            queue_frame(conn, PIPER2_FRAME_DONE, nullptr, 0);
+        } else {
+            server.stats.requests_failed++;
+            queue_error(conn, result, "synthesis failed");
+        }
+
+        finish_request(server, conn);
+    }
+}
+
+static void flush_output(Connection &conn) {
+    while (conn.pending_output() > 0) {
+        ssize_t num_written = send(conn.fd, &conn.output[conn.output_offset],
+                                   conn.pending_output(), 0);
+        if (num_written < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+                (errno != EINTR)) {
+                conn.closed = true;
+            }
+            break;
+        }
+
+        conn.output_offset += num_written;
+    }
+
+    if (conn.output_offset == conn.output.size()) {
+        conn.output.clear();
+        conn.output_offset = 0;
+    }
+}
+
+static void read_input(Server &server, Connection &conn) {
+    uint8_t buffer[16 * 1024];
+    while (true) {
+        ssize_t num_read = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (num_read > 0) {
+            conn.input.insert(conn.input.end(), buffer, buffer + num_read);
+            continue;
+        }
+
+        if ((num_read < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        }
+
+        if ((num_read < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        // Disconnected
+        conn.closed = true;
+        return;
+    }
+
+    handle_input(server, conn);
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Serve connections until stopped, then close them
+static void serve(Server &server, int listen_fd) {
+    std::vector<pollfd> poll_fds;
+    while (!should_stop) {
+        // [0] = listener, then for each connection: socket, request fd
+        poll_fds.clear();
+        poll_fds.push_back({listen_fd, POLLIN, 0});
+        for (auto &conn : server.connections) {
+            short events = POLLIN;
+            if (conn->pending_output() > 0) {
+                events |= POLLOUT;
+            }
+            poll_fds.push_back({conn->fd, events, 0});
+
+            int request_fd = -1;
+            if (conn->request && (conn->pending_output() < MAX_PENDING_OUTPUT)) {
+                request_fd = piper2_request_fd(conn->request);
+            }
+            // Negative fds are ignored by poll
+            poll_fds.push_back({request_fd, POLLIN, 0});
+        }
+
+        bool is_waiting_for_voice = std::any_of(
+            server.connections.begin(), server.connections.end(),
+            [](const std::unique_ptr<Connection> &conn) {
+                return conn->is_waiting_for_voice;
+            });
+        int timeout_ms = is_waiting_for_voice ? VOICE_LOAD_POLL_MS : 1000;
+        if (poll(poll_fds.data(), poll_fds.size(), timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (std::size_t conn_idx = 0; conn_idx < server.connections.size();
+             ++conn_idx) {
+            auto &conn = *server.connections[conn_idx];
+            const pollfd &socket_poll = poll_fds[1 + (2 * conn_idx)];
+            const pollfd &request_poll = poll_fds[2 + (2 * conn_idx)];
+
+            if (socket_poll.revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_input(server, conn);
+            } else if (!conn.closed && conn.is_waiting_for_voice) {
+                handle_input(server, conn);
+            }
+
+            if (!conn.closed && conn.request && (request_poll.revents & POLLIN)) {
+                collect_chunks(server, conn);
+            }
+
+            if (!conn.closed) {
+                flush_output(conn);
+            }
+        }
+
+        // Clean up disconnected clients, cancelling their requests
+        for (auto conn_iter = server.connections.begin();
+             conn_iter != server.connections.end();) {
+            auto &conn = **conn_iter;
+            if (!conn.closed) {
+                ++conn_iter;
+                continue;
+            }
+
+            if (conn.request) {
+                server.stats.requests_cancelled++;
+                finish_request(server, conn);
+            }
+            close(conn.fd);
+            conn_iter = server.connections.erase(conn_iter);
+        }
+
+        if (poll_fds[0].revents & POLLIN) {
+            while (true) {
+                int client_fd = accept(listen_fd, nullptr, nullptr);
+                if (client_fd < 0) {
+                    break;
+                }
+
+                set_nonblocking(client_fd);
+                auto conn = std::make_unique<Connection>();
+                conn->fd = client_fd;
+                server.connections.push_back(std::move(conn));
+                server.stats.connections_total++;
+            }
+        }
+    }
+
+    // Shut down
+    for (auto &conn : server.connections) {
+        if (conn->request) {
+            finish_request(server, *conn);
+        }
+        close(conn->fd);
+    }
+    server.connections.clear();
+
+}
+
+static piper2_capture *open_capture(Server &server, const std::string &path) {
+    piper2_capture *capture = piper2_capture_open(path.c_str());
+    if (!capture) {
+        std::cerr << "Failed to open capture log: " << path << std::endl;
+        return nullptr;
+    }
+
+    piper2_registry_set_capture(server.registry, capture);
+
+    return capture;
+}
+
+// Fork a worker process that serves connections from the shared listener.
+// Returns its pid in the parent (-1 on error) and never returns in the child.
+static pid_t start_worker_process(Server &server, int listen_fd,
+                                  const piper2_scheduler_options &sched_options,
+                                  const std::string &capture_path,
+                                  std::size_t worker_idx) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    // Worker threads are only created now, after the fork
+    server.sched = piper2_scheduler_create(&sched_options);
+    if (!server.sched) {
+        std::cerr << "Invalid scheduler options" << std::endl;
+        _exit(1);
+    }
+
+    piper2_capture *capture = nullptr;
+    if (!capture_path.empty()) {
+        capture = open_capture(server,
+                               capture_path + "." + std::to_string(worker_idx));
+    }
+
+    serve(server, listen_fd);
+
+    piper2_scheduler_free(server.sched);
+    piper2_registry_set_capture(server.registry, nullptr);
+    piper2_capture_close(capture);
+
+    // The models belong to the parent. Freeing them here would only copy
+    // their pages.
+    std::cerr.flush();
+    _exit(0);
+}
+
+// Keep num_processes workers running until stopped
+static void supervise(Server &server, int listen_fd,
+                      const piper2_scheduler_options &sched_options,
+                      const std::string &capture_path,
+                      std::size_t num_processes) {
+    std::vector<pid_t> worker_pids(num_processes, -1);
+    while (!should_stop) {
+        for (std::size_t worker_idx = 0; worker_idx < num_processes;
+             ++worker_idx) {
+            if (worker_pids[worker_idx] < 0) {
+                worker_pids[worker_idx] =
+                    start_worker_process(server, listen_fd, sched_options,
+                                         capture_path, worker_idx);
+            }
+        }
+
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        for (std::size_t worker_idx = 0; worker_idx < num_processes;
+             ++worker_idx) {
+            if (worker_pids[worker_idx] == pid) {
+                std::cerr << "Worker " << worker_idx << " exited, restarting"
+                          << std::endl;
+                worker_pids[worker_idx] = -1;
+            }
+        }
+    }
+
+    for (pid_t pid : worker_pids) {
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+        }
+    }
+
+    for (pid_t pid : worker_pids) {
+        if (pid > 0) {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+}
+
+static void usage(const char *program) {
+    std::cerr
+        << "Usage: " << program << " [options]" << std::endl
+        << std::endl
+        << "  --socket PATH           Unix socket to listen on" << std::endl
+        << "  --voice NAME=MODEL      voice to load (repeatable)" << std::endl
+        << "  --phonemizer MODEL      phonemizer model" << std::endl
+        << "  --stress MODEL          stress model" << std::endl
+        << "  --locale LOCALE         ICU locale (default: en_US)" << std::endl
+        << "  --workers N             synthesis threads (default: all cores)"
+        << std::endl
+        << "  --max-queued N          queued sentences before refusing work"
+        << std::endl
+        << "  --memory-budget MB      evict idle voices above this size"
+        << std::endl
+        << "  --preload               load all voices at startup" << std::endl
+        << "  --lexicon PATH          compiled pronunciation lexicon"
+        << std::endl
+        << "  --low-memory            map models and unload idle frontends"
+        << std::endl
+        << "  --cpus LIST             run workers on these CPUs (e.g. 0-7)"
+        << std::endl
+        << "  --numa-node N           place workers and models on NUMA node N"
+        << std::endl
+        << "  --voice-precision P     load voice variants like MODEL.P.onnx"
+        << std::endl
+        << "  --capture PATH          record requests for piper2-replay"
+        << std::endl
+        << "  --postprocess           remove DC, normalize and fade chunks"
+        << std::endl
+        << "  --processes N           load voices once and fork N worker "
+           "processes"
+        << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string socket_path = "piper2.sock";
+    std::string phonemizer_path = "models/en_US-phonemizer.onnx";
+    std::string stress_path = "models/en_US-stress.onnx";
+    std::string locale = "en_US";
+    std::vector<std::pair<std::string, std::string>> voice_paths;
+    std::size_t memory_budget = 0;
+    bool preload = false;
+    std::size_t num_processes = 0;
+    std::string capture_path;
+    piper2_create_options create_options = piper2_default_create_options();
+    piper2_scheduler_options sched_options = piper2_default_scheduler_options();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--socket") && has_value) {
+            socket_path = argv[++i];
+        } else if ((arg == "--voice") && has_value) {
+            std::string voice_arg = argv[++i];
+            auto equals_pos = voice_arg.find('=');
+            if (equals_pos == std::string::npos) {
+                usage(argv[0]);
+                return 1;
+            }
+            voice_paths.emplace_back(voice_arg.substr(0, equals_pos),
+                                     voice_arg.substr(equals_pos + 1));
+        } else if ((arg == "--phonemizer") && has_value) {
+            phonemizer_path = argv[++i];
+        } else if ((arg == "--stress") && has_value) {
+            stress_path = argv[++i];
+        } else if ((arg == "--locale") && has_value) {
+            locale = argv[++i];
+        } else if ((arg == "--workers") && has_value) {
+            sched_options.num_workers = std::stoul(argv[++i]);
+        } else if ((arg == "--max-queued") && has_value) {
+            sched_options.max_queued_sentences = std::stoul(argv[++i]);
+        } else if ((arg == "--memory-budget") && has_value) {
+            memory_budget = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--preload") {
+            preload = true;
+        } else if ((arg == "--lexicon") && has_value) {
+            create_options.lexicon_path = argv[++i];
+        } else if (arg == "--low-memory") {
+            const char *lexicon_path = create_options.lexicon_path;
+            create_options = piper2_low_memory_create_options();
+            create_options.lexicon_path = lexicon_path;
+        } else if ((arg == "--cpus") && has_value) {
+            sched_options.cpu_list = argv[++i];
+        } else if ((arg == "--voice-precision") && has_value) {
+            create_options.voice_precision = argv[++i];
+        } else if (arg == "--postprocess") {
+            create_options.postprocess.enabled = true;
+        } else if ((arg == "--capture") && has_value) {
+            capture_path = argv[++i];
+        } else if ((arg == "--processes") && has_value) {
+            num_processes = std::stoul(argv[++i]);
+        } else if ((arg == "--numa-node") && has_value) {
+            sched_options.numa_node = std::stoi(argv[++i]);
+            create_options.numa_node = sched_options.numa_node;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (voice_paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Forked workers can't use onnxruntime thread pools from the parent
+    create_options.fork_safe = (num_processes > 0);
+
+    // Voices are loaded on first use (or in the background with --preload)
+    Server server;
+    server.registry = piper2_registry_create(memory_budget);
+
+    // Worker processes open their own capture logs after the fork
+    piper2_capture *capture = nullptr;
+    if (!capture_path.empty() && (num_processes == 0)) {
+        capture = open_capture(server, capture_path);
+        if (!capture) {
+            return 1;
+        }
+    }
+
+    for (auto &voice_path : voice_paths) {
+        if (piper2_registry_add_voice(
+                server.registry, voice_path.first.c_str(), locale.c_str(),
+                voice_path.second.c_str(), NULL, phonemizer_path.c_str(), NULL,
+                stress_path.c_str(), &create_options) != PIPER2_OK) {
+            std::cerr << "Duplicate voice: " << voice_path.first << std::endl;
+            return 1;
+        }
+
+        if (preload) {
+            piper2_registry_preload(server.registry, voice_path.first.c_str());
+        }
+
+        server.voice_names.push_back(voice_path.first);
+    }
+
+    if (num_processes > 0) {
+        // Worker processes create their own schedulers after the fork
+        if (sched_options.num_workers == 0) {
+            sched_options.num_workers = std::max<std::size_t>(
+                1, std::thread::hardware_concurrency() / num_processes);
+        }
+
+        std::cerr << "Loading voices" << std::endl;
+        if (piper2_registry_prepare_fork(server.registry, WARMUP_TEXT) !=
+            PIPER2_OK) {
+            std::cerr << "Failed to load voices" << std::endl;
+            return 1;
+        }
+    } else {
+        server.sched = piper2_scheduler_create(&sched_options);
+        if (!server.sched) {
+            std::cerr << "Invalid scheduler options" << std::endl;
+            return 1;
+        }
+    }
+
+    // Listen
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path is too long" << std::endl;
+        return 1;
+    }
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+
+    if ((bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(listen_fd, SOMAXCONN) != 0)) {
+        std::cerr << "Failed to listen on " << socket_path << ": "
+                  << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    set_nonblocking(listen_fd);
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, handle_stop_signal);
+    std::signal(SIGTERM, handle_stop_signal);
+
+    std::cerr << "Listening on " << socket_path << std::endl;
+
+    if (num_processes > 0) {
+        supervise(server, listen_fd, sched_options, capture_path,
+                  num_processes);
+    } else {
+        serve(server, listen_fd);
+    }
+
+    piper2_scheduler_free(server.sched);
+    piper2_registry_free(server.registry);
+    piper2_capture_close(capture);
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Checks that capture records written from several threads read back intact,
+// including more records than fit in one buffered batch, and that a
+// truncated final record or a bad header is handled.
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "piper2.h"
+#include "piper2_capture.hpp"
+
+const int NUM_THREADS = 4;
+const int REQUESTS_PER_THREAD = 500;
+
+// Text of request i from a thread, long enough to need several batches
+static std::string get_text(int thread_idx, int request_idx) {
+    return "thread " + std::to_string(thread_idx) + " request " +
+           std::to_string(request_idx) + " " +
+           std::string(50 + (request_idx % 100), 'x');
+}
+
+static void capture_requests(piper2_capture *capture, int thread_idx) {
+    for (int i = 0; i < REQUESTS_PER_THREAD; ++i) {
+        RequestCapture request;
+        request.begin(capture, "voice" + std::to_string(thread_idx),
+                      get_text(thread_idx, i).c_str(),
+                      (uint8_t)(i % 3), i % 7, thread_idx, 1.0f + i, 0.5f,
+                      0.75f);
+        for (int chunk_idx = 0; chunk_idx < (i % 4); ++chunk_idx) {
+            request.add_chunk(100 * (chunk_idx + 1));
+        }
+
+        if ((i % 5) == 0) {
+            // Destroyed without end
+            continue;
+        }
+
+        request.end(((i % 5) == 1) ? CAPTURE_STATUS_REFUSED
+                                   : CAPTURE_STATUS_DONE);
+    }
+}
+
+static bool check_request(const CapturedRequest &request) {
+    // Recover thread and request index from the text
+    int thread_idx = -1;
+    int request_idx = -1;
+    if (std::sscanf(request.text.c_str(), "thread %d request %d", &thread_idx,
+                    &request_idx) != 2) {
+        return false;
+    }
+
+    int i = request_idx;
+    uint8_t status = CAPTURE_STATUS_DONE;
+    if ((i % 5) == 0) {
+        status = CAPTURE_STATUS_CANCELLED;
+    } else if ((i % 5) == 1) {
+        status = CAPTURE_STATUS_REFUSED;
+    }
+
+    bool ok = (request.text == get_text(thread_idx, i)) &&
+              (request.voice == ("voice" + std::to_string(thread_idx))) &&
+              (request.status == status) && (request.priority == (i % 3)) &&
+              (request.deadline_ms == (i % 7)) &&
+              (request.speaker_id == thread_idx) &&
+              (request.length_scale == (1.0f + i)) &&
+              (request.noise_scale == 0.5f) &&
+              (request.noise_w_scale == 0.75f) &&
+              (request.chunks.size() == (std::size_t)(i % 4));
+    for (std::size_t chunk_idx = 0; ok && (chunk_idx < request.chunks.size());
+         ++chunk_idx) {
+        ok = (request.chunks[chunk_idx].num_samples == 100 * (chunk_idx + 1));
+    }
+
+    return ok;
+}
+
+int main() {
+    int num_failed = 0;
+    auto check = [&num_failed](bool condition, const char *message) {
+        if (!condition) {
+            std::cerr << "FAIL " << message << std::endl;
+            num_failed++;
+        }
+    };
+
+    // In the working directory (the build directory under ctest)
+    std::string path = "test_capture.bin";
+
+    // ---- Round trip ----
+
+    piper2_capture *capture = piper2_capture_open(path.c_str());
+    if (!capture) {
+        std::cerr << "FAIL open " << path << std::endl;
+        return 1;
+    }
+
+    std::vector<std::thread> threads;
+    for (int thread_idx = 0; thread_idx < NUM_THREADS; ++thread_idx) {
+        threads.emplace_back(capture_requests, capture, thread_idx);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    piper2_capture_close(capture);
+
+    auto log = read_capture_log(path);
+    check(log.has_value(), "read log");
+    if (log) {
+        check(log->requests.size() == (NUM_THREADS * REQUESTS_PER_THREAD),
+              "every request is recorded");
+
+        bool all_ok = true;
+        bool is_sorted = true;
+        for (std::size_t i = 0; i < log->requests.size(); ++i) {
+            all_ok = all_ok && check_request(log->requests[i]);
+            if ((i > 0) && (log->requests[i].arrival_us <
+                            log->requests[i - 1].arrival_us)) {
+                is_sorted = false;
+            }
+        }
+        check(all_ok, "records read back unchanged");
+        check(is_sorted, "records are sorted by arrival");
+    }
+
+    // ---- Truncated final record ----
+
+    auto file_size = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, file_size - 3);
+    auto truncated_log = read_capture_log(path);
+    check(truncated_log && (truncated_log->requests.size() ==
+                            (NUM_THREADS * REQUESTS_PER_THREAD) - 1),
+          "truncated final record is ignored");
+
+    // ---- Bad header ----
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "not a capture log at all";
+    }
+    check(!read_capture_log(path), "bad magic is rejected");
+
+    std::filesystem::remove(path);
+
+    if (num_failed > 0) {
+        return 1;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Checks lexicon lookups, and that corrupt offsets, lengths and headers are
+// rejected without reading outside the file.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "piper2_lexicon.hpp"
+
+// In the working directory (the build directory under ctest)
+const char *LEXICON_PATH = "test_lexicon.bin";
+const char *CORRUPT_PATH = "test_lexicon_corrupt.bin";
+
+static std::vector<uint8_t> read_bytes(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+}
+
+static void write_bytes(const std::string &path,
+                        const std::vector<uint8_t> &bytes) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char *)bytes.data(), bytes.size());
+}
+
+static void put_u32(std::vector<uint8_t> &bytes, std::size_t offset,
+                    uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        bytes[offset + i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t get_u32(const std::vector<uint8_t> &bytes,
+                        std::size_t offset) {
+    uint32_t value = 0;
+    std::memcpy(&value, &bytes[offset], 4);
+    return value;
+}
+
+// Change the entry offset of every used slot
+static std::vector<uint8_t> with_offsets(std::vector<uint8_t> bytes,
+                                         uint32_t entry_offset) {
+    uint32_t num_slots = get_u32(bytes, 16);
+    for (uint32_t i = 0; i < num_slots; ++i) {
+        std::size_t slot_offset = LEXICON_HEADER_SIZE + (i * LEXICON_SLOT_SIZE);
+        if (get_u32(bytes, slot_offset + 4) != 0) {
+            put_u32(bytes, slot_offset + 4, entry_offset);
+        }
+    }
+
+    return bytes;
+}
+
+// True if no word can be found, and lookups don't crash
+static bool finds_nothing(const std::vector<uint8_t> &bytes,
+                          const std::map<std::string, std::string> &entries) {
+    write_bytes(CORRUPT_PATH, bytes);
+    auto lexicon = open_lexicon(CORRUPT_PATH);
+    if (!lexicon) {
+        return true;
+    }
+
+    for (const auto &entry : entries) {
+        if (lexicon->lookup(entry.first)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main() {
+    int num_failed = 0;
+    auto check = [&num_failed](bool condition, const char *message) {
+        if (!condition) {
+            std::cerr << "FAIL " << message << std::endl;
+            num_failed++;
+        }
+    };
+
+    std::map<std::string, std::string> entries = {
+        {"hello", "həlˈoʊ"}, {"world", "wˈɝld"}, {"piper", "pˈaɪpɚ"}};
+    check(build_lexicon(entries, LEXICON_PATH), "build lexicon");
+
+    // ---- Lookup ----
+
+    auto lexicon = open_lexicon(LEXICON_PATH);
+    check(lexicon != nullptr, "open lexicon");
+    if (lexicon) {
+        check(lexicon->num_entries == entries.size(), "number of entries");
+        for (const auto &entry : entries) {
+            auto phonemes = lexicon->lookup(entry.first);
+            check(phonemes && (*phonemes == entry.second), "find every word");
+        }
+        check(!lexicon->lookup("missing"), "missing word");
+        check(!lexicon->lookup(""), "empty word");
+    }
+
+    std::vector<uint8_t> bytes = read_bytes(LEXICON_PATH);
+    uint32_t num_slots = get_u32(bytes, 16);
+    uint32_t entries_start =
+        LEXICON_HEADER_SIZE + (num_slots * LEXICON_SLOT_SIZE);
+
+    // ---- Corrupt entry offsets ----
+
+    // Values that wrap around when 4 or the lengths are added in 32 bits,
+    // that point into the header or slots, or past the end
+    for (uint32_t entry_offset :
+         {0xFFFFFFFFu, 0xFFFFFFFEu, 0xFFFFFFFCu, 8u, 20u, entries_start - 1,
+          (uint32_t)bytes.size() - 3, (uint32_t)bytes.size()}) {
+        check(finds_nothing(with_offsets(bytes, entry_offset), entries),
+              "corrupt entry offset is rejected");
+    }
+
+    // ---- Corrupt lengths ----
+
+    auto long_word = bytes;
+    long_word[entries_start] = 0xFF;
+    long_word[entries_start + 1] = 0xFF;
+    auto long_phonemes = bytes;
+    long_phonemes[entries_start + 2] = 0xFF;
+    long_phonemes[entries_start + 3] = 0xFF;
+    for (const auto &corrupt : {long_word, long_phonemes}) {
+        write_bytes(CORRUPT_PATH, corrupt);
+        auto corrupt_lexicon = open_lexicon(CORRUPT_PATH);
+        bool ok = (corrupt_lexicon != nullptr);
+        for (const auto &entry : entries) {
+            // Only the first entry is damaged
+            ok = ok && (!corrupt_lexicon->lookup(entry.first) ||
+                        (*corrupt_lexicon->lookup(entry.first) ==
+                         entry.second));
+        }
+        check(ok, "entry length past the end is rejected");
+    }
+
+    // ---- Truncated file ----
+
+    auto truncated = bytes;
+    truncated.resize(bytes.size() - 5);
+    write_bytes(CORRUPT_PATH, truncated);
+    auto truncated_lexicon = open_lexicon(CORRUPT_PATH);
+    check(truncated_lexicon != nullptr, "open truncated file");
+    if (truncated_lexicon) {
+        // Entries before the cut may still be found
+        for (const auto &entry : entries) {
+            auto phonemes = truncated_lexicon->lookup(entry.first);
+            check(!phonemes || (*phonemes == entry.second),
+                  "truncated file only returns intact entries");
+        }
+    }
+
+    // ---- Corrupt header ----
+
+    auto bad_magic = bytes;
+    bad_magic[0] = 'X';
+    auto odd_slots = bytes;
+    put_u32(odd_slots, 16, 3);
+    auto too_many_slots = bytes;
+    put_u32(too_many_slots, 16, 1u << 30);
+    auto short_file = bytes;
+    short_file.resize(LEXICON_HEADER_SIZE - 1);
+    for (const auto &corrupt :
+         {bad_magic, odd_slots, too_many_slots, short_file}) {
+        write_bytes(CORRUPT_PATH, corrupt);
+        check(!open_lexicon(CORRUPT_PATH), "corrupt header is rejected");
+    }
+
+    std::remove(LEXICON_PATH);
+    std::remove(CORRUPT_PATH);
+
+    if (num_failed > 0) {
+        return 1;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
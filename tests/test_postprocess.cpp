@@ -0,0 +1,125 @@
+// Checks that vectorized post-processing matches the scalar reference,
+// including chunks of odd sizes that start and end inside a block.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "piper2_postprocess.hpp"
+
+const int SAMPLE_RATE = 22050;
+
+// Samples may differ by float rounding (vector lanes sum in another order)
+const float MAX_DIFFERENCE = 1e-5f;
+
+static piper2_postprocess_options get_options(bool remove_dc, bool normalize,
+                                              float fade_ms) {
+    piper2_postprocess_options options;
+    options.enabled = true;
+    options.remove_dc = remove_dc;
+    options.normalize = normalize;
+    options.target_loudness_db = -20.0f;
+    options.max_gain_db = 12.0f;
+    options.peak_limit = 0.95f;
+    options.fade_ms = fade_ms;
+
+    return options;
+}
+
+// Speech-like audio with an offset, slowly varying loudness and silences
+static std::vector<float> make_audio(std::size_t num_samples) {
+    std::vector<float> audio(num_samples);
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    for (std::size_t i = 0; i < num_samples; ++i) {
+        float envelope = 0.1f + 0.08f * std::sin(i * 2e-4f);
+        if (((i / 4000) % 5) == 4) {
+            envelope = 0;
+        }
+        audio[i] = 0.02f + envelope * std::sin(i * 0.06f) + noise(rng);
+    }
+
+    return audio;
+}
+
+// Returns the largest difference between the two paths over the chunk sizes
+static float compare(const piper2_postprocess_options &options,
+                     const std::vector<float> &audio,
+                     const std::vector<std::size_t> &chunk_sizes) {
+    std::vector<float> outputs[2] = {audio, audio};
+    PostprocessState states[2];
+    for (int vectorized = 0; vectorized < 2; ++vectorized) {
+        std::size_t start = 0;
+        std::size_t chunk_idx = 0;
+        while (start < audio.size()) {
+            std::size_t chunk_size =
+                std::min(chunk_sizes[chunk_idx++ % chunk_sizes.size()],
+                         audio.size() - start);
+            float *chunk = outputs[vectorized].data() + start;
+            if (vectorized) {
+                postprocess_chunk(options, SAMPLE_RATE, states[1], chunk,
+                                  chunk_size);
+            } else {
+                postprocess_chunk_scalar(options, SAMPLE_RATE, states[0],
+                                         chunk, chunk_size);
+            }
+            start += chunk_size;
+        }
+    }
+
+    float max_difference = 0;
+    for (std::size_t i = 0; i < audio.size(); ++i) {
+        max_difference = std::max(max_difference,
+                                  std::fabs(outputs[0][i] - outputs[1][i]));
+    }
+
+    if (states[0].position != states[1].position) {
+        return INFINITY;
+    }
+
+    return max_difference;
+}
+
+int main() {
+    std::vector<float> audio = make_audio(5 * SAMPLE_RATE + 17);
+
+    // Odd sizes, sizes around the block and vector widths, and sentence-sized
+    // chunks, so chunks start at every offset within a block
+    std::vector<std::vector<std::size_t>> chunk_size_lists = {
+        {1, 2, 3, 5, 7},
+        {63, 65, 127, 129},
+        {POSTPROCESS_BLOCK_SIZE},
+        {1001, 3, 4099},
+        {(std::size_t)SAMPLE_RATE * 3 + 1},
+    };
+
+    int num_failed = 0;
+    for (int remove_dc = 0; remove_dc < 2; ++remove_dc) {
+        for (int normalize = 0; normalize < 2; ++normalize) {
+            for (float fade_ms : {0.0f, 5.0f}) {
+                auto options = get_options(remove_dc, normalize, fade_ms);
+                for (const auto &chunk_sizes : chunk_size_lists) {
+                    float difference = compare(options, audio, chunk_sizes);
+                    if (!(difference <= MAX_DIFFERENCE)) {
+                        std::cerr << "FAIL remove_dc=" << remove_dc
+                                  << " normalize=" << normalize
+                                  << " fade_ms=" << fade_ms
+                                  << " first chunk size=" << chunk_sizes[0]
+                                  << ": max difference " << difference
+                                  << std::endl;
+                        num_failed++;
+                    }
+                }
+            }
+        }
+    }
+
+    if (num_failed > 0) {
+        return 1;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
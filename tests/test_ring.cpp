@@ -0,0 +1,158 @@
+// Checks the shared-memory audio ring: samples arrive in order across
+// wraparounds with both read paths, the header counts chunks, the consumer
+// sees the end of the stream, and a full ring times out.
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "piper2_ring.h"
+
+const int SAMPLE_RATE = 22050;
+
+// Small, so writes wrap around the end of the ring many times
+const std::size_t RING_CAPACITY = 1000;
+
+const std::size_t NUM_SAMPLES = 2000000;
+
+// Sample value at a stream position, exact in float
+static float sample_at(std::size_t position) {
+    return (float)(position % 65521);
+}
+
+static void produce(piper2_ring *ring, std::size_t &num_chunks, bool &ok) {
+    std::vector<float> buffer;
+    std::size_t position = 0;
+    while (position < NUM_SAMPLES) {
+        // Odd chunk sizes, some larger than the ring
+        std::size_t chunk_size =
+            std::min(1 + ((num_chunks * 7919) % 1500), NUM_SAMPLES - position);
+        buffer.resize(chunk_size);
+        for (auto &sample : buffer) {
+            sample = sample_at(position++);
+        }
+
+        piper2_audio_chunk chunk;
+        chunk.sample_rate = SAMPLE_RATE;
+        chunk.samples = buffer.data();
+        chunk.num_samples = buffer.size();
+        chunk.is_last = false;
+        if (piper2_ring_write_chunk(ring, &chunk, -1) != PIPER2_OK) {
+            ok = false;
+            break;
+        }
+        num_chunks++;
+    }
+
+    piper2_ring_close(ring);
+}
+
+// Alternates between reading in place and copying out
+static std::size_t consume(piper2_ring *ring, bool &ok) {
+    std::vector<float> buffer(333);
+    std::size_t position = 0;
+    bool use_peek = true;
+    while (true) {
+        int result = piper2_ring_wait(ring, -1);
+        if (result == PIPER2_DONE) {
+            break;
+        }
+
+        if (result != PIPER2_OK) {
+            ok = false;
+            break;
+        }
+
+        const float *samples = nullptr;
+        std::size_t num_samples = 0;
+        if (use_peek) {
+            num_samples = piper2_ring_peek(ring, &samples);
+        } else {
+            num_samples = piper2_ring_read(ring, buffer.data(), buffer.size());
+            samples = buffer.data();
+        }
+
+        for (std::size_t i = 0; i < num_samples; ++i) {
+            if (samples[i] != sample_at(position++)) {
+                ok = false;
+            }
+        }
+
+        if (use_peek) {
+            piper2_ring_consume(ring, num_samples);
+        }
+        use_peek = !use_peek;
+    }
+
+    return position;
+}
+
+int main() {
+    int num_failed = 0;
+    auto check = [&num_failed](bool condition, const char *message) {
+        if (!condition) {
+            std::cerr << "FAIL " << message << std::endl;
+            num_failed++;
+        }
+    };
+
+    // ---- Streaming ----
+
+    piper2_ring *producer =
+        piper2_ring_create("piper2-test-ring", RING_CAPACITY);
+    if (!producer) {
+        std::cerr << "FAIL create ring" << std::endl;
+        return 1;
+    }
+
+    piper2_ring *consumer = piper2_ring_open_fd(piper2_ring_fd(producer));
+    check(consumer != nullptr, "open ring by fd");
+    if (!consumer) {
+        piper2_ring_free(producer);
+        return 1;
+    }
+
+    const piper2_ring_header *header = piper2_ring_get_header(consumer);
+    check(header->capacity >= RING_CAPACITY, "capacity is at least requested");
+    check((header->capacity & (header->capacity - 1)) == 0,
+          "capacity is a power of 2");
+
+    std::size_t num_chunks = 0;
+    bool producer_ok = true;
+    bool consumer_ok = true;
+    std::size_t num_read = 0;
+    std::thread producer_thread(produce, producer, std::ref(num_chunks),
+                                std::ref(producer_ok));
+    std::thread consumer_thread(
+        [&] { num_read = consume(consumer, consumer_ok); });
+    producer_thread.join();
+    consumer_thread.join();
+
+    check(producer_ok, "producer writes");
+    check(consumer_ok, "samples arrive in order");
+    check(num_read == NUM_SAMPLES, "every sample arrives");
+    check(header->write_seq == num_chunks, "write sequence counts chunks");
+    check(header->sample_rate == SAMPLE_RATE, "sample rate is published");
+
+    piper2_ring_free(consumer);
+    piper2_ring_free(producer);
+
+    // ---- Full ring ----
+
+    piper2_ring *full_ring = piper2_ring_create("piper2-test-ring-full", 16);
+    std::vector<float> samples(100, 0.5f);
+    check(full_ring &&
+              (piper2_ring_write(full_ring, samples.data(), samples.size(),
+                                 20) == PIPER2_AGAIN),
+          "write to a full ring times out");
+    piper2_ring_free(full_ring);
+
+    if (num_failed > 0) {
+        return 1;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
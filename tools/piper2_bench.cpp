@@ -0,0 +1,614 @@
+// Synthesis benchmark.
+// Runs requests through a scheduler and reports throughput and real-time
+// factor. With --per-node, repeats the run on every NUMA node with the
+// workers and model memory on the same node, then with model memory on
+// another node, to show the cost of remote memory.
+// With --postprocess-bench, compares the vectorized audio post-processing
+// stage against its scalar reference instead (no models needed).
+// With --calibrate, fits the voice's cost model for piper2_estimate on this
+// host and writes it next to the voice model.
+// With --fanout N, compares rendering every text for N speakers one at a time
+// against piper2_fanout_start/next.
+// With --max-rss MB, exits with an error if the process's peak resident memory
+// during a run exceeds MB (use with --low-memory to check a memory budget).
+// With --trace PATH, records a timeline of the run's stages to PATH in Chrome
+// trace format.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json.hpp>
+
+#include <piper2.h>
+#include <piper2_postprocess.hpp>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct BenchSettings {
+    std::string locale = "en_US";
+    std::string voice_model_path;
+    std::string phonemizer_model_path = "models/en_US-phonemizer.onnx";
+    std::string stress_model_path = "models/en_US-stress.onnx";
+    std::size_t num_workers = 0;
+    std::size_t num_requests = 16;
+    std::vector<std::string> texts;
+    piper2_create_options create_options = piper2_default_create_options();
+};
+
+struct BenchResult {
+    bool ok = false;
+    double seconds = 0;
+    double audio_seconds = 0;
+    std::size_t num_chunks = 0;
+    std::size_t peak_resident_bytes = 0; // of the process
+};
+
+// Number of NUMA nodes according to sysfs (1 if unknown)
+static int count_numa_nodes() {
+    int num_nodes = 0;
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator(
+             "/sys/devices/system/node", ec)) {
+        std::string name = entry.path().filename().string();
+        if ((name.rfind("node", 0) == 0) && (name.size() > 4) &&
+            std::isdigit((unsigned char)name[4])) {
+            num_nodes++;
+        }
+    }
+
+    return std::max(1, num_nodes);
+}
+
+// Run all requests with workers on worker_node and models on memory_node
+// (-1 = anywhere).
+static BenchResult run_bench(const BenchSettings &settings, int worker_node,
+                             int memory_node) {
+    BenchResult result;
+
+    piper2_create_options create_options = settings.create_options;
+    create_options.numa_node = memory_node;
+
+    piper2_synthesizer *synth = piper2_create_phonemizer_stress_with_options(
+        settings.locale.c_str(), settings.voice_model_path.c_str(), nullptr,
+        settings.phonemizer_model_path.c_str(), nullptr,
+        settings.stress_model_path.c_str(), &create_options);
+    if (!synth) {
+        std::cerr << "Failed to load voice" << std::endl;
+        return result;
+    }
+
+    piper2_scheduler_options sched_options =
+        piper2_default_scheduler_options();
+    sched_options.num_workers = settings.num_workers;
+    sched_options.max_queued_sentences = 0;
+    sched_options.numa_node = worker_node;
+
+    piper2_scheduler *sched = piper2_scheduler_create(&sched_options);
+
+    // Warm up
+    piper2_request *warmup_request = nullptr;
+    if (piper2_scheduler_submit(sched, synth, settings.texts[0].c_str(),
+                                nullptr, PIPER2_PRIORITY_NORMAL, 0,
+                                &warmup_request) == PIPER2_OK) {
+        piper2_audio_chunk chunk;
+        while (piper2_request_next(warmup_request, &chunk) == PIPER2_OK) {
+        }
+        piper2_request_free(warmup_request);
+    }
+
+    std::vector<piper2_request *> requests(settings.num_requests, nullptr);
+    std::vector<BenchResult> request_results(settings.num_requests);
+
+    auto start_time = Clock::now();
+    for (std::size_t req_idx = 0; req_idx < settings.num_requests;
+         ++req_idx) {
+        const std::string &text =
+            settings.texts[req_idx % settings.texts.size()];
+        piper2_scheduler_submit(sched, synth, text.c_str(), nullptr,
+                                PIPER2_PRIORITY_NORMAL, 0,
+                                &requests[req_idx]);
+    }
+
+    // Read every request at once so none of them stalls on its read-ahead
+    // limit.
+    std::vector<std::thread> readers;
+    for (std::size_t req_idx = 0; req_idx < settings.num_requests;
+         ++req_idx) {
+        readers.emplace_back([&, req_idx] {
+            auto &request_result = request_results[req_idx];
+            piper2_request *request = requests[req_idx];
+            if (!request) {
+                return;
+            }
+
+            piper2_audio_chunk chunk;
+            int status = PIPER2_OK;
+            while ((status = piper2_request_next(request, &chunk)) ==
+                   PIPER2_OK) {
+                request_result.num_chunks++;
+                if (chunk.sample_rate > 0) {
+                    request_result.audio_seconds +=
+                        (double)chunk.num_samples / chunk.sample_rate;
+                }
+            }
+
+            request_result.ok = (status == PIPER2_DONE);
+        });
+    }
+
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start_time).count();
+    result.ok = true;
+    for (std::size_t req_idx = 0; req_idx < settings.num_requests;
+         ++req_idx) {
+        result.ok = result.ok && request_results[req_idx].ok;
+        result.audio_seconds += request_results[req_idx].audio_seconds;
+        result.num_chunks += request_results[req_idx].num_chunks;
+        piper2_request_free(requests[req_idx]);
+    }
+
+    piper2_scheduler_free(sched);
+
+    piper2_memory_usage memory_usage;
+    if (piper2_get_memory_usage(synth, &memory_usage) == PIPER2_OK) {
+        result.peak_resident_bytes = memory_usage.peak_resident_bytes;
+    }
+    piper2_free(synth);
+
+    return result;
+}
+
+static void print_result(int worker_node, int memory_node,
+                         const BenchResult &result) {
+    auto node_str = [](int node) {
+        return (node < 0) ? std::string("any") : std::to_string(node);
+    };
+
+    double rtf =
+        (result.audio_seconds > 0) ? (result.seconds / result.audio_seconds)
+                                   : 0;
+    double chunks_per_second =
+        (result.seconds > 0) ? (result.num_chunks / result.seconds) : 0;
+
+    std::cout << std::fixed << std::setprecision(3) << std::setw(8)
+              << node_str(worker_node) << std::setw(8)
+              << node_str(memory_node) << std::setw(10) << result.seconds
+              << std::setw(10) << result.audio_seconds << std::setw(8) << rtf
+              << std::setw(12) << chunks_per_second
+              << (result.ok ? "" : "  (errors)") << std::endl;
+}
+
+// Post-process the same speech-like audio with the vectorized stage and the
+// scalar reference, in sentence-sized chunks.
+static void run_postprocess_bench() {
+    const int sample_rate = 22050;
+    const std::size_t chunk_samples = 3 * sample_rate;
+    const std::size_t num_chunks = 20;
+    const int num_runs = 20;
+
+    std::vector<float> audio(chunk_samples * num_chunks);
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    for (std::size_t i = 0; i < audio.size(); ++i) {
+        // Offset and slowly varying loudness
+        float envelope = 0.1f + 0.08f * std::sin(i * 2e-4f);
+        audio[i] = 0.02f + envelope * std::sin(i * 0.06f) + noise(rng);
+    }
+
+    piper2_postprocess_options options =
+        piper2_default_create_options().postprocess;
+    options.enabled = true;
+
+    std::vector<float> outputs[2];
+    double seconds[2] = {0, 0};
+    for (int vectorized = 0; vectorized < 2; ++vectorized) {
+        for (int run = 0; run < num_runs; ++run) {
+            std::vector<float> samples = audio;
+            PostprocessState state;
+
+            auto start_time = Clock::now();
+            for (std::size_t chunk_idx = 0; chunk_idx < num_chunks;
+                 ++chunk_idx) {
+                float *chunk = samples.data() + (chunk_idx * chunk_samples);
+                if (vectorized) {
+                    postprocess_chunk(options, sample_rate, state, chunk,
+                                      chunk_samples);
+                } else {
+                    postprocess_chunk_scalar(options, sample_rate, state,
+                                             chunk, chunk_samples);
+                }
+            }
+            seconds[vectorized] +=
+                std::chrono::duration<double>(Clock::now() - start_time)
+                    .count();
+            outputs[vectorized] = std::move(samples);
+        }
+    }
+
+    float max_difference = 0;
+    for (std::size_t i = 0; i < audio.size(); ++i) {
+        max_difference = std::max(max_difference,
+                                  std::fabs(outputs[0][i] - outputs[1][i]));
+    }
+
+    double total_samples = (double)audio.size() * num_runs;
+    std::cout << std::setw(12) << "stage" << std::setw(14) << "Msamples/s"
+              << std::setw(12) << "x realtime" << std::endl;
+    const char *names[2] = {"scalar", "vectorized"};
+    for (int vectorized = 0; vectorized < 2; ++vectorized) {
+        double samples_per_second = total_samples / seconds[vectorized];
+        std::cout << std::fixed << std::setprecision(1) << std::setw(12)
+                  << names[vectorized] << std::setw(14)
+                  << (samples_per_second / 1e6) << std::setw(12)
+                  << std::setprecision(0)
+                  << (samples_per_second / sample_rate) << std::endl;
+    }
+
+    std::cout << std::setprecision(2) << "speedup: "
+              << (seconds[0] / seconds[1]) << "x, max difference: "
+              << std::scientific << max_difference << std::endl;
+}
+
+// Render every text for speakers 0..num_speakers-1, separately and fanned out
+static int run_fanout_bench(const BenchSettings &settings,
+                            std::size_t num_speakers) {
+    piper2_synthesizer *synth = piper2_create_phonemizer_stress_with_options(
+        settings.locale.c_str(), settings.voice_model_path.c_str(), nullptr,
+        settings.phonemizer_model_path.c_str(), nullptr,
+        settings.stress_model_path.c_str(), &settings.create_options);
+    if (!synth) {
+        std::cerr << "Failed to load voice" << std::endl;
+        return 1;
+    }
+
+    std::vector<piper2_synthesize_options> options(
+        num_speakers, piper2_default_synthesize_options(synth));
+    for (std::size_t i = 0; i < num_speakers; ++i) {
+        options[i].speaker_id = (int)i;
+    }
+
+    piper2_audio_chunk chunk;
+    std::vector<piper2_audio_chunk> chunks(num_speakers);
+
+    // Warm up
+    if (piper2_fanout_start(synth, settings.texts[0].c_str(), options.data(),
+                            num_speakers) != PIPER2_OK) {
+        std::cerr << "Voice doesn't have " << num_speakers << " speakers"
+                  << std::endl;
+        piper2_free(synth);
+        return 1;
+    }
+    while (piper2_fanout_next(synth, chunks.data()) == PIPER2_OK) {
+    }
+
+    double seconds[2] = {0, 0};
+    double audio_seconds[2] = {0, 0};
+    for (int is_fanout = 0; is_fanout < 2; ++is_fanout) {
+        auto start_time = Clock::now();
+        for (const auto &text : settings.texts) {
+            if (is_fanout) {
+                piper2_fanout_start(synth, text.c_str(), options.data(),
+                                    num_speakers);
+                while (piper2_fanout_next(synth, chunks.data()) ==
+                       PIPER2_OK) {
+                    for (const auto &speaker_chunk : chunks) {
+                        audio_seconds[is_fanout] +=
+                            (double)speaker_chunk.num_samples /
+                            speaker_chunk.sample_rate;
+                    }
+                }
+                continue;
+            }
+
+            for (const auto &speaker_options : options) {
+                piper2_synthesize_start(synth, text.c_str(), &speaker_options);
+                while (piper2_synthesize_next(synth, &chunk) == PIPER2_OK) {
+                    audio_seconds[is_fanout] +=
+                        (double)chunk.num_samples / chunk.sample_rate;
+                }
+            }
+        }
+        seconds[is_fanout] =
+            std::chrono::duration<double>(Clock::now() - start_time).count();
+    }
+
+    piper2_free(synth);
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "separate: " << seconds[0] << " sec, " << audio_seconds[0]
+              << " sec audio" << std::endl
+              << "fanout:   " << seconds[1] << " sec, " << audio_seconds[1]
+              << " sec audio" << std::endl
+              << std::setprecision(2)
+              << "speedup: " << (seconds[0] / seconds[1]) << "x" << std::endl;
+
+    return 0;
+}
+
+// Fit the cost model on the benchmark texts and save it as MODEL.cost.json
+static int run_calibrate(const BenchSettings &settings) {
+    piper2_synthesizer *synth = piper2_create_phonemizer_stress_with_options(
+        settings.locale.c_str(), settings.voice_model_path.c_str(), nullptr,
+        settings.phonemizer_model_path.c_str(), nullptr,
+        settings.stress_model_path.c_str(), &settings.create_options);
+    if (!synth) {
+        std::cerr << "Failed to load voice" << std::endl;
+        return 1;
+    }
+
+    std::vector<const char *> texts;
+    for (const auto &text : settings.texts) {
+        texts.push_back(text.c_str());
+    }
+
+    piper2_cost_model model;
+    int result = piper2_calibrate_cost_model(synth, texts.data(), texts.size(),
+                                             &model);
+    piper2_free(synth);
+
+    if (result != PIPER2_OK) {
+        std::cerr << "Calibration failed" << std::endl;
+        return 1;
+    }
+
+    json model_json{
+        {"phonemes_per_char", model.phonemes_per_char},
+        {"seconds_per_phoneme", model.seconds_per_phoneme},
+        {"cpu_seconds_per_sentence", model.cpu_seconds_per_sentence},
+        {"cpu_seconds_per_char", model.cpu_seconds_per_char},
+        {"cpu_seconds_per_audio_second", model.cpu_seconds_per_audio_second},
+        {"num_calibration_sentences", model.num_calibration_sentences},
+    };
+
+    // Next to the precision variant that was loaded, where piper2_create
+    // looks for it
+    const char *precision = settings.create_options.voice_precision;
+    std::size_t length = piper2_resolve_model_variant(
+        settings.voice_model_path.c_str(), precision, nullptr, 0);
+    std::string variant_path(length + 1, '\0');
+    piper2_resolve_model_variant(settings.voice_model_path.c_str(), precision,
+                                 &variant_path[0], variant_path.size());
+    variant_path.resize(length);
+
+    std::string cost_path = variant_path + ".cost.json";
+    std::ofstream cost_file(cost_path);
+    cost_file << model_json.dump(2) << std::endl;
+    if (!cost_file) {
+        std::cerr << "Failed to write " << cost_path << std::endl;
+        return 1;
+    }
+
+    std::cout << model_json.dump(2) << std::endl
+              << "Wrote " << cost_path << std::endl;
+
+    return 0;
+}
+
+// Returns non-zero if a run failed or went over max_rss_bytes (0 = no limit)
+static int run_scheduler_bench(const BenchSettings &settings, int worker_node,
+                               std::optional<int> memory_node, bool per_node,
+                               std::size_t max_rss_bytes) {
+    std::cout << std::setw(8) << "workers" << std::setw(8) << "memory"
+              << std::setw(10) << "seconds" << std::setw(10) << "audio"
+              << std::setw(8) << "rtf" << std::setw(12) << "chunks/sec"
+              << std::endl;
+
+    std::vector<BenchResult> results;
+    if (!per_node) {
+        int run_memory_node = memory_node.value_or(worker_node);
+        results.push_back(run_bench(settings, worker_node, run_memory_node));
+        print_result(worker_node, run_memory_node, results.back());
+    } else {
+        int num_nodes = count_numa_nodes();
+        for (int node = 0; node < num_nodes; ++node) {
+            results.push_back(run_bench(settings, node, node));
+            print_result(node, node, results.back());
+            if (num_nodes > 1) {
+                int remote_node = (node + 1) % num_nodes;
+                results.push_back(run_bench(settings, node, remote_node));
+                print_result(node, remote_node, results.back());
+            }
+        }
+    }
+
+    std::size_t peak_resident_bytes = 0;
+    for (const auto &result : results) {
+        if (!result.ok) {
+            return 1;
+        }
+
+        peak_resident_bytes =
+            std::max(peak_resident_bytes, result.peak_resident_bytes);
+    }
+
+    std::cout << "peak resident memory: "
+              << (peak_resident_bytes / (1024 * 1024)) << " MB" << std::endl;
+    if ((max_rss_bytes > 0) && (peak_resident_bytes > max_rss_bytes)) {
+        std::cerr << "Peak resident memory over budget of "
+                  << (max_rss_bytes / (1024 * 1024)) << " MB" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " --model MODEL [options]" << std::endl
+              << std::endl
+              << "  --model MODEL         voice model" << std::endl
+              << "  --phonemizer MODEL    phonemizer model" << std::endl
+              << "  --stress MODEL        stress model" << std::endl
+              << "  --locale LOCALE       ICU locale (default: en_US)"
+              << std::endl
+              << "  --workers N           synthesis threads (default: all "
+                 "cores)"
+              << std::endl
+              << "  --requests N          requests per run (default: 16)"
+              << std::endl
+              << "  --text TEXT           text to synthesize" << std::endl
+              << "  --text-file PATH      one text per line, used round robin"
+              << std::endl
+              << "  --numa-node N         run workers and models on node N"
+              << std::endl
+              << "  --memory-node N       put models on node N instead"
+              << std::endl
+              << "  --per-node            run once per node, with local and "
+                 "remote model memory"
+              << std::endl
+              << "  --shape-buckets       pad voice inputs to bucket lengths"
+              << std::endl
+              << "  --postprocess         post-process audio chunks" << std::endl
+              << "  --low-memory          use the low memory create options"
+              << std::endl
+              << "  --voice-precision P   load the voice's P variant (e.g., "
+                 "int8)"
+              << std::endl
+              << "  --max-rss MB          fail if peak resident memory "
+                 "exceeds MB"
+              << std::endl
+              << "  --postprocess-bench   benchmark post-processing only"
+              << std::endl
+              << "  --calibrate           fit the cost model for "
+                 "piper2_estimate"
+              << std::endl
+              << "  --fanout N            compare N speakers rendered "
+                 "separately and fanned out"
+              << std::endl
+              << "  --trace PATH          write a timeline of the run to "
+                 "PATH (Chrome trace)"
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    BenchSettings settings;
+    int worker_node = -1;
+    std::optional<int> memory_node;
+    bool per_node = false;
+    bool postprocess_bench = false;
+    bool calibrate = false;
+    std::size_t fanout_speakers = 0;
+    std::string trace_path;
+    std::size_t max_rss_bytes = 0;
+    const char *voice_precision = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--model") && has_value) {
+            settings.voice_model_path = argv[++i];
+        } else if ((arg == "--phonemizer") && has_value) {
+            settings.phonemizer_model_path = argv[++i];
+        } else if ((arg == "--stress") && has_value) {
+            settings.stress_model_path = argv[++i];
+        } else if ((arg == "--locale") && has_value) {
+            settings.locale = argv[++i];
+        } else if ((arg == "--workers") && has_value) {
+            settings.num_workers = std::stoul(argv[++i]);
+        } else if ((arg == "--requests") && has_value) {
+            settings.num_requests = std::stoul(argv[++i]);
+        } else if ((arg == "--text") && has_value) {
+            settings.texts.push_back(argv[++i]);
+        } else if ((arg == "--text-file") && has_value) {
+            std::ifstream text_file(argv[++i]);
+            std::string line;
+            while (std::getline(text_file, line)) {
+                if (!line.empty()) {
+                    settings.texts.push_back(line);
+                }
+            }
+        } else if ((arg == "--numa-node") && has_value) {
+            worker_node = std::stoi(argv[++i]);
+        } else if ((arg == "--memory-node") && has_value) {
+            memory_node = std::stoi(argv[++i]);
+        } else if (arg == "--per-node") {
+            per_node = true;
+        } else if (arg == "--shape-buckets") {
+            settings.create_options.shape_buckets = true;
+        } else if (arg == "--postprocess") {
+            settings.create_options.postprocess.enabled = true;
+        } else if (arg == "--low-memory") {
+            piper2_postprocess_options postprocess =
+                settings.create_options.postprocess;
+            settings.create_options = piper2_low_memory_create_options();
+            settings.create_options.postprocess = postprocess;
+        } else if ((arg == "--voice-precision") && has_value) {
+            voice_precision = argv[++i];
+        } else if ((arg == "--max-rss") && has_value) {
+            max_rss_bytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--postprocess-bench") {
+            postprocess_bench = true;
+        } else if (arg == "--calibrate") {
+            calibrate = true;
+        } else if ((arg == "--fanout") && has_value) {
+            fanout_speakers = std::stoul(argv[++i]);
+        } else if ((arg == "--trace") && has_value) {
+            trace_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (postprocess_bench) {
+        run_postprocess_bench();
+        return 0;
+    }
+
+    if (settings.voice_model_path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (voice_precision) {
+        // After --low-memory, which replaces all create options
+        settings.create_options.voice_precision = voice_precision;
+    }
+
+    if (settings.texts.empty()) {
+        settings.texts.push_back(
+            "This is a test of the Piper text to speech system. It has "
+            "several sentences. Each one is synthesized by a worker thread.");
+    }
+
+    if (!trace_path.empty() && (piper2_trace_start() != PIPER2_OK)) {
+        std::cerr << "piper2 was built without tracing" << std::endl;
+        return 1;
+    }
+
+    int result = 0;
+    if (calibrate) {
+        result = run_calibrate(settings);
+    } else if (fanout_speakers > 0) {
+        result = run_fanout_bench(settings, fanout_speakers);
+    } else {
+        result = run_scheduler_bench(settings, worker_node, memory_node,
+                                     per_node, max_rss_bytes);
+    }
+
+    if (!trace_path.empty()) {
+        piper2_trace_stop();
+        if (piper2_trace_flush(trace_path.c_str()) != PIPER2_OK) {
+            std::cerr << "Failed to write trace: " << trace_path << std::endl;
+            return 1;
+        }
+    }
+
+    return result;
+}
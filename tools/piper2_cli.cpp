@@ -0,0 +1,768 @@
+// Offline renderer for long documents and batches of utterances.
+//
+// A document is split into paragraphs, which are synthesized in parallel by
+// a scheduler and written in order to a single WAV or raw file. A JSONL file
+// has one utterance per line, each written to its own file. Only a bounded
+// window of requests is in flight, so memory use doesn't grow with the
+// input. Rendering can be interrupted and resumed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json.hpp>
+
+#include <piper2.h>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+const char *PROGRESS_MAGIC = "piper2-progress";
+const int PROGRESS_VERSION = 2;
+const std::size_t WAV_HEADER_SIZE = 44;
+
+// RIFF sizes are 32-bit and count everything after the first 8 bytes
+const std::size_t MAX_WAV_DATA_BYTES = UINT32_MAX - (WAV_HEADER_SIZE - 8);
+
+// Only used for the header of an empty output
+const int DEFAULT_SAMPLE_RATE = 22050;
+
+enum class AudioFormat { WAV, RAW };
+
+// Unit of work: a paragraph of a document or a line of a JSONL file
+struct Utterance {
+    std::string text;
+    piper2_synthesize_options options;
+
+    // Own output file (JSONL only)
+    std::string output_path;
+};
+
+// Streams audio to a file. WAV is 16-bit PCM, raw is float32 samples.
+// The WAV header is written with the first chunk and its sizes are filled in
+// by finish.
+class AudioWriter {
+  public:
+    // Open for writing, keeping the first keep_bytes bytes of an existing
+    // file (to resume), or truncating it if keep_bytes is 0.
+    bool open(const std::string &path, AudioFormat format,
+              std::size_t keep_bytes = 0) {
+        this->format = format;
+        bytes_written = 0;
+
+        if (keep_bytes > 0) {
+            std::error_code ec;
+            std::filesystem::resize_file(path, keep_bytes, ec);
+            if (ec) {
+                return false;
+            }
+
+            file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(0, std::ios::end);
+            bytes_written = keep_bytes;
+        } else {
+            file.open(path, std::ios::binary | std::ios::out |
+                                std::ios::trunc);
+        }
+
+        return file.is_open();
+    }
+
+    bool write(const piper2_audio_chunk &chunk) {
+        if ((format == AudioFormat::WAV) && (bytes_written == 0)) {
+            sample_rate = chunk.sample_rate;
+            write_wav_header(0);
+        }
+
+        if (format == AudioFormat::RAW) {
+            file.write(reinterpret_cast<const char *>(chunk.samples),
+                       chunk.num_samples * sizeof(float));
+            bytes_written += chunk.num_samples * sizeof(float);
+        } else {
+            std::size_t data_bytes = (bytes_written - WAV_HEADER_SIZE) +
+                                     (chunk.num_samples * sizeof(int16_t));
+            if (data_bytes > MAX_WAV_DATA_BYTES) {
+                // The header can't hold the sizes
+                std::cerr << std::endl
+                          << "WAV output is limited to 4 GiB, use --format "
+                             "raw for longer audio"
+                          << std::endl;
+                return false;
+            }
+
+            pcm_buffer.resize(chunk.num_samples);
+            for (std::size_t i = 0; i < chunk.num_samples; ++i) {
+                float sample =
+                    std::max(-1.0f, std::min(1.0f, chunk.samples[i]));
+                pcm_buffer[i] = (int16_t)(sample * 32767.0f);
+            }
+            file.write(reinterpret_cast<const char *>(pcm_buffer.data()),
+                       pcm_buffer.size() * sizeof(int16_t));
+            bytes_written += pcm_buffer.size() * sizeof(int16_t);
+        }
+
+        return file.good();
+    }
+
+    // Make everything written so far durable enough to resume from
+    bool flush() {
+        file.flush();
+        return file.good();
+    }
+
+    bool finish(int chunk_sample_rate) {
+        if (format == AudioFormat::WAV) {
+            if (bytes_written == 0) {
+                sample_rate = chunk_sample_rate;
+                write_wav_header(0);
+            } else {
+                sample_rate = read_wav_sample_rate();
+            }
+
+            if ((bytes_written - WAV_HEADER_SIZE) > MAX_WAV_DATA_BYTES) {
+                // Never write sizes that wrapped
+                file.close();
+                return false;
+            }
+
+            file.seekp(0, std::ios::beg);
+            write_wav_header(bytes_written - WAV_HEADER_SIZE);
+        }
+
+        file.close();
+        return !file.fail();
+    }
+
+    std::size_t bytes_written = 0;
+
+  private:
+    std::fstream file;
+    AudioFormat format = AudioFormat::WAV;
+    int sample_rate = 0;
+    std::vector<int16_t> pcm_buffer;
+
+    void put_u16(uint16_t value) {
+        char bytes[2] = {(char)(value & 0xFF), (char)(value >> 8)};
+        file.write(bytes, 2);
+    }
+
+    void put_u32(uint32_t value) {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i) {
+            bytes[i] = (char)((value >> (8 * i)) & 0xFF);
+        }
+        file.write(bytes, 4);
+    }
+
+    void write_wav_header(std::size_t data_bytes) {
+        file.write("RIFF", 4);
+        put_u32((uint32_t)(36 + data_bytes));
+        file.write("WAVEfmt ", 8);
+        put_u32(16);
+        put_u16(1); // PCM
+        put_u16(1); // mono
+        put_u32((uint32_t)sample_rate);
+        put_u32((uint32_t)sample_rate * 2);
+        put_u16(2);
+        put_u16(16);
+        file.write("data", 4);
+        put_u32((uint32_t)data_bytes);
+
+        if (bytes_written == 0) {
+            bytes_written = WAV_HEADER_SIZE;
+        }
+    }
+
+    // Sample rate from the header of a resumed file
+    int read_wav_sample_rate() {
+        if (sample_rate > 0) {
+            return sample_rate;
+        }
+
+        unsigned char bytes[4] = {0, 0, 0, 0};
+        file.seekg(24, std::ios::beg);
+        file.read(reinterpret_cast<char *>(bytes), 4);
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+    }
+};
+
+// Resume point of a document: how many paragraphs were written and how many
+// bytes of the output file they take. Only valid for the same input.
+struct Progress {
+    std::size_t input_size = 0;
+    uint64_t input_hash = 0;
+    std::size_t num_utterances = 0;
+    std::size_t utterances_done = 0;
+    std::size_t bytes_written = 0;
+};
+
+static std::optional<Progress> read_progress(const std::string &path) {
+    std::ifstream file(path);
+    std::string magic;
+    int version = 0;
+    Progress progress;
+    if (!(file >> magic >> version >> progress.input_size >>
+          progress.input_hash >> progress.num_utterances >> progress.utterances_done >>
+          progress.bytes_written) ||
+        (magic != PROGRESS_MAGIC) || (version != PROGRESS_VERSION)) {
+        return std::nullopt;
+    }
+
+    return progress;
+}
+
+static bool write_progress(const std::string &path, const Progress &progress) {
+    // Replace atomically so an interruption never leaves a partial file
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        file << PROGRESS_MAGIC << " " << PROGRESS_VERSION << " "
+             << progress.input_size << " " << progress.input_hash << " "
+             << progress.num_utterances << " "
+             << progress.utterances_done << " " << progress.bytes_written
+             << std::endl;
+        if (!file) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    return !ec;
+}
+
+// 64-bit FNV-1a, to tell if a document changed since its progress was saved
+static uint64_t fnv1a_hash(const std::string &text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Split a document into paragraphs at blank lines
+static std::vector<std::string> split_paragraphs(const std::string &text) {
+    std::vector<std::string> paragraphs;
+    std::string paragraph;
+    std::istringstream lines(text);
+    std::string line;
+
+    auto is_blank = [](const std::string &s) {
+        return s.find_first_not_of(" \t\r") == std::string::npos;
+    };
+
+    while (std::getline(lines, line)) {
+        if (is_blank(line)) {
+            if (!paragraph.empty()) {
+                paragraphs.push_back(paragraph);
+                paragraph.clear();
+            }
+            continue;
+        }
+
+        if (!paragraph.empty()) {
+            paragraph += " ";
+        }
+        paragraph += line;
+    }
+
+    if (!paragraph.empty()) {
+        paragraphs.push_back(paragraph);
+    }
+
+    return paragraphs;
+}
+
+static void print_progress(std::size_t num_done, std::size_t num_total,
+                           double audio_seconds, Clock::time_point start_time,
+                           bool is_final) {
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start_time).count();
+    double rtf = (audio_seconds > 0) ? (elapsed / audio_seconds) : 0;
+
+    std::cerr << "\r" << num_done << "/" << num_total << " done, "
+              << std::fixed << std::setprecision(1) << audio_seconds
+              << " s audio in " << elapsed << " s (rtf " << std::setprecision(3)
+              << rtf << ")";
+    if (!is_final && (num_done > 0) && (num_done < num_total)) {
+        double remaining = elapsed * (num_total - num_done) / num_done;
+        std::cerr << ", ~" << std::setprecision(0) << remaining << " s left";
+    }
+    std::cerr << "    " << (is_final ? "\n" : "") << std::flush;
+}
+
+// Field types of a JSONL item, checked before reading them
+static bool is_valid_item(const json &item) {
+    if (item.is_discarded() || !item.is_object()) {
+        return false;
+    }
+
+    auto text_iter = item.find("text");
+    if ((text_iter == item.end()) || !text_iter->is_string()) {
+        return false;
+    }
+
+    auto id_iter = item.find("id");
+    if ((id_iter != item.end()) && !id_iter->is_string() &&
+        !id_iter->is_number_integer()) {
+        return false;
+    }
+
+    auto speaker_iter = item.find("speaker_id");
+    if ((speaker_iter != item.end()) && !speaker_iter->is_number_integer()) {
+        return false;
+    }
+
+    for (const char *key : {"length_scale", "noise_scale", "noise_w_scale"}) {
+        auto value_iter = item.find(key);
+        if ((value_iter != item.end()) && !value_iter->is_number()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Ids become file names in the output directory, so they can't name a
+// directory or leave it
+static bool is_safe_file_name(const std::string &name) {
+    return !name.empty() && (name != ".") && (name != "..") &&
+           (name.find_first_of(std::string("/\\\0", 3)) == std::string::npos);
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " --model MODEL (--input FILE "
+              << "--output FILE | --jsonl FILE --output-dir DIR) [options]"
+              << std::endl
+              << std::endl
+              << "  --model MODEL         voice model" << std::endl
+              << "  --phonemizer MODEL    phonemizer model" << std::endl
+              << "  --stress MODEL        stress model" << std::endl
+              << "  --locale LOCALE       ICU locale (default: en_US)"
+              << std::endl
+              << "  --input FILE          document to render (- for stdin)"
+              << std::endl
+              << "  --output FILE         audio file for the document"
+              << std::endl
+              << "  --jsonl FILE          one utterance per line: {\"text\": "
+                 "..., \"id\": ...}"
+              << std::endl
+              << "  --output-dir DIR      audio files for the utterances"
+              << std::endl
+              << "  --format FORMAT       wav (16-bit) or raw (float32), "
+                 "default: from --output or wav"
+              << std::endl
+              << "  --workers N           synthesis threads (default: all "
+                 "cores)"
+              << std::endl
+              << "  --in-flight N         requests in flight (default: 2 per "
+                 "worker)"
+              << std::endl
+              << "  --speaker N           speaker id" << std::endl
+              << "  --length-scale X      speaking rate (larger is slower)"
+              << std::endl
+              << "  --lexicon PATH        compiled pronunciation lexicon"
+              << std::endl
+              << "  --postprocess         remove DC, normalize and fade chunks"
+              << std::endl
+              << "  --restart             ignore previous progress"
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string voice_model_path;
+    std::string phonemizer_path = "models/en_US-phonemizer.onnx";
+    std::string stress_path = "models/en_US-stress.onnx";
+    std::string locale = "en_US";
+    std::string input_path;
+    std::string output_path;
+    std::string jsonl_path;
+    std::string output_dir;
+    std::optional<AudioFormat> format;
+    std::size_t num_in_flight = 0;
+    std::optional<int> speaker_id;
+    std::optional<float> length_scale;
+    bool restart = false;
+    piper2_create_options create_options = piper2_default_create_options();
+    piper2_scheduler_options sched_options = piper2_default_scheduler_options();
+    sched_options.max_queued_sentences = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--model") && has_value) {
+            voice_model_path = argv[++i];
+        } else if ((arg == "--phonemizer") && has_value) {
+            phonemizer_path = argv[++i];
+        } else if ((arg == "--stress") && has_value) {
+            stress_path = argv[++i];
+        } else if ((arg == "--locale") && has_value) {
+            locale = argv[++i];
+        } else if ((arg == "--input") && has_value) {
+            input_path = argv[++i];
+        } else if ((arg == "--output") && has_value) {
+            output_path = argv[++i];
+        } else if ((arg == "--jsonl") && has_value) {
+            jsonl_path = argv[++i];
+        } else if ((arg == "--output-dir") && has_value) {
+            output_dir = argv[++i];
+        } else if ((arg == "--format") && has_value) {
+            std::string format_name = argv[++i];
+            if (format_name == "wav") {
+                format = AudioFormat::WAV;
+            } else if (format_name == "raw") {
+                format = AudioFormat::RAW;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if ((arg == "--workers") && has_value) {
+            sched_options.num_workers = std::stoul(argv[++i]);
+        } else if ((arg == "--in-flight") && has_value) {
+            num_in_flight = std::stoul(argv[++i]);
+        } else if ((arg == "--speaker") && has_value) {
+            speaker_id = std::stoi(argv[++i]);
+        } else if ((arg == "--length-scale") && has_value) {
+            length_scale = std::stof(argv[++i]);
+        } else if ((arg == "--lexicon") && has_value) {
+            create_options.lexicon_path = argv[++i];
+        } else if (arg == "--postprocess") {
+            create_options.postprocess.enabled = true;
+        } else if (arg == "--restart") {
+            restart = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool is_document = !input_path.empty() && !output_path.empty();
+    bool is_jsonl = !jsonl_path.empty() && !output_dir.empty();
+    if (voice_model_path.empty() || (is_document == is_jsonl)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!format) {
+        auto output_extension = std::filesystem::path(output_path).extension();
+        bool is_raw = is_document && (output_extension == ".raw");
+        format = is_raw ? AudioFormat::RAW : AudioFormat::WAV;
+    }
+    const char *extension = (*format == AudioFormat::WAV) ? ".wav" : ".raw";
+
+    piper2_synthesizer *synth = piper2_create_phonemizer_stress_with_options(
+        locale.c_str(), voice_model_path.c_str(), nullptr,
+        phonemizer_path.c_str(), nullptr, stress_path.c_str(),
+        &create_options);
+    if (!synth) {
+        std::cerr << "Failed to load voice: " << voice_model_path << std::endl;
+        return 1;
+    }
+
+    piper2_synthesize_options default_options =
+        piper2_default_synthesize_options(synth);
+    if (speaker_id) {
+        default_options.speaker_id = *speaker_id;
+    }
+    if (length_scale) {
+        default_options.length_scale = *length_scale;
+    }
+
+    // ---- Read input ----
+
+    std::vector<Utterance> utterances;
+    std::size_t input_size = 0;
+    uint64_t input_hash = 0;
+    std::size_t num_skipped = 0;
+
+    if (is_document) {
+        std::string text;
+        if (input_path == "-") {
+            std::ostringstream input_stream;
+            input_stream << std::cin.rdbuf();
+            text = input_stream.str();
+        } else {
+            std::ifstream input_file(input_path, std::ios::binary);
+            if (!input_file) {
+                std::cerr << "Failed to read: " << input_path << std::endl;
+                return 1;
+            }
+            std::ostringstream input_stream;
+            input_stream << input_file.rdbuf();
+            text = input_stream.str();
+        }
+
+        input_size = text.size();
+        input_hash = fnv1a_hash(text);
+        for (auto &paragraph : split_paragraphs(text)) {
+            utterances.push_back({paragraph, default_options, ""});
+        }
+    } else {
+        std::ifstream jsonl_file(jsonl_path);
+        if (!jsonl_file) {
+            std::cerr << "Failed to read: " << jsonl_path << std::endl;
+            return 1;
+        }
+
+        std::filesystem::create_directories(output_dir);
+
+        std::string line;
+        std::size_t line_number = 0;
+        while (std::getline(jsonl_file, line)) {
+            line_number++;
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+
+            json item = json::parse(line, nullptr, false);
+            if (!is_valid_item(item)) {
+                std::cerr << "Skipping invalid line " << line_number
+                          << std::endl;
+                continue;
+            }
+
+            Utterance utterance;
+            utterance.text = item["text"].get<std::string>();
+            utterance.options = default_options;
+            if (item.contains("speaker_id")) {
+                utterance.options.speaker_id = item["speaker_id"].get<int>();
+            }
+            if (item.contains("length_scale")) {
+                utterance.options.length_scale =
+                    item["length_scale"].get<float>();
+            }
+            if (item.contains("noise_scale")) {
+                utterance.options.noise_scale =
+                    item["noise_scale"].get<float>();
+            }
+            if (item.contains("noise_w_scale")) {
+                utterance.options.noise_w_scale =
+                    item["noise_w_scale"].get<float>();
+            }
+
+            std::string name;
+            if (item.contains("id")) {
+                name = item["id"].is_string() ? item["id"].get<std::string>()
+                                              : item["id"].dump();
+            } else {
+                std::ostringstream name_stream;
+                name_stream << std::setw(6) << std::setfill('0')
+                            << line_number;
+                name = name_stream.str();
+            }
+
+            if (!is_safe_file_name(name)) {
+                std::cerr << "Skipping line " << line_number
+                          << ": id is not a valid file name" << std::endl;
+                continue;
+            }
+            utterance.output_path =
+                (std::filesystem::path(output_dir) / (name + extension))
+                    .string();
+
+            // Finished files are only renamed into place when complete
+            if (!restart && std::filesystem::exists(utterance.output_path)) {
+                num_skipped++;
+                continue;
+            }
+
+            utterances.push_back(std::move(utterance));
+        }
+    }
+
+    // ---- Resume ----
+
+    std::string progress_path = output_path + ".progress";
+    std::size_t first_utterance = 0;
+    AudioWriter document_writer;
+
+    if (is_document) {
+        std::optional<Progress> progress;
+        if (!restart && std::filesystem::exists(output_path)) {
+            progress = read_progress(progress_path);
+        }
+
+        if (progress && (progress->input_size == input_size) &&
+            (progress->input_hash == input_hash) &&
+            (progress->num_utterances == utterances.size()) &&
+            (progress->bytes_written <=
+             std::filesystem::file_size(output_path))) {
+            first_utterance = progress->utterances_done;
+            std::cerr << "Resuming after " << first_utterance << "/"
+                      << utterances.size() << " paragraph(s)" << std::endl;
+        } else {
+            progress.reset();
+        }
+
+        if (!document_writer.open(output_path, *format,
+                                  progress ? progress->bytes_written : 0)) {
+            std::cerr << "Failed to open: " << output_path << std::endl;
+            return 1;
+        }
+    } else if (num_skipped > 0) {
+        std::cerr << "Skipping " << num_skipped << " finished utterance(s)"
+                  << std::endl;
+    }
+
+    // ---- Render ----
+
+    piper2_scheduler *sched = piper2_scheduler_create(&sched_options);
+    if (!sched) {
+        std::cerr << "Invalid scheduler options" << std::endl;
+        return 1;
+    }
+
+    if (num_in_flight < 1) {
+        std::size_t num_workers = sched_options.num_workers;
+        if (num_workers < 1) {
+            num_workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_in_flight = 2 * num_workers;
+    }
+
+    // Requests are read in order. Each one only runs a few sentences ahead of
+    // what has been read, so at most num_in_flight requests' worth of
+    // sentences wait to be written.
+    std::deque<piper2_request *> in_flight;
+    std::size_t next_to_submit = first_utterance;
+    std::size_t num_failed = 0;
+    double audio_seconds = 0;
+    int sample_rate = DEFAULT_SAMPLE_RATE;
+    auto start_time = Clock::now();
+    auto last_report_time = start_time;
+    bool ok = true;
+
+    for (std::size_t utt_idx = first_utterance;
+         ok && (utt_idx < utterances.size()); ++utt_idx) {
+        while ((next_to_submit < utterances.size()) &&
+               (in_flight.size() < num_in_flight)) {
+            const auto &next_utterance = utterances[next_to_submit++];
+            piper2_request *request = nullptr;
+            piper2_scheduler_submit(sched, synth, next_utterance.text.c_str(),
+                                    &next_utterance.options,
+                                    PIPER2_PRIORITY_BULK, 0, &request);
+            in_flight.push_back(request);
+        }
+
+        const auto &utterance = utterances[utt_idx];
+        piper2_request *request = in_flight.front();
+        in_flight.pop_front();
+
+        AudioWriter utterance_writer;
+        std::string part_path = utterance.output_path + ".part";
+        AudioWriter &writer = is_document ? document_writer : utterance_writer;
+        if (!is_document && !utterance_writer.open(part_path, *format)) {
+            // Only this utterance fails
+            std::cerr << std::endl << "Failed to open: " << part_path
+                      << std::endl;
+            num_failed++;
+            piper2_request_free(request);
+            continue;
+        }
+
+        piper2_audio_chunk chunk;
+        chunk.sample_rate = sample_rate;
+        int status = request ? PIPER2_OK : PIPER2_ERR_GENERIC;
+        while (request &&
+               ((status = piper2_request_next(request, &chunk)) ==
+                PIPER2_OK)) {
+            if (!writer.write(chunk)) {
+                status = PIPER2_ERR_GENERIC;
+                break;
+            }
+
+            if (chunk.sample_rate > 0) {
+                audio_seconds += (double)chunk.num_samples / chunk.sample_rate;
+            }
+        }
+        piper2_request_free(request);
+
+        if (chunk.sample_rate > 0) {
+            sample_rate = chunk.sample_rate;
+        }
+
+        if (is_document) {
+            if (status != PIPER2_DONE) {
+                std::cerr << std::endl
+                          << "Failed to render paragraph " << (utt_idx + 1)
+                          << std::endl;
+                ok = false;
+                break;
+            }
+
+            Progress progress;
+            progress.input_size = input_size;
+            progress.input_hash = input_hash;
+            progress.num_utterances = utterances.size();
+            progress.utterances_done = utt_idx + 1;
+            progress.bytes_written = document_writer.bytes_written;
+            if (!document_writer.flush() ||
+                !write_progress(progress_path, progress)) {
+                std::cerr << std::endl
+                          << "Failed to write: " << output_path << std::endl;
+                ok = false;
+                break;
+            }
+        } else {
+            std::error_code ec;
+            if ((status == PIPER2_DONE) &&
+                utterance_writer.finish(chunk.sample_rate)) {
+                std::filesystem::rename(part_path, utterance.output_path, ec);
+            } else {
+                std::filesystem::remove(part_path, ec);
+                num_failed++;
+                std::cerr << std::endl
+                          << "Failed to render: " << utterance.output_path
+                          << std::endl;
+            }
+        }
+
+        if ((Clock::now() - last_report_time) >= std::chrono::seconds(1)) {
+            print_progress(utt_idx + 1, utterances.size(), audio_seconds,
+                           start_time, false);
+            last_report_time = Clock::now();
+        }
+    }
+
+    for (auto *request : in_flight) {
+        piper2_request_free(request);
+    }
+
+    if (ok) {
+        print_progress(utterances.size(), utterances.size(), audio_seconds,
+                       start_time, true);
+    }
+
+    if (ok && is_document) {
+        if (document_writer.finish(sample_rate)) {
+            std::error_code ec;
+            std::filesystem::remove(progress_path, ec);
+        } else {
+            std::cerr << "Failed to write: " << output_path << std::endl;
+            ok = false;
+        }
+    }
+
+    piper2_scheduler_free(sched);
+    piper2_free(synth);
+
+    if (num_failed > 0) {
+        std::cerr << num_failed << " utterance(s) failed" << std::endl;
+    }
+
+    return (ok && (num_failed == 0)) ? 0 : 1;
+}
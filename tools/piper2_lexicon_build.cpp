@@ -0,0 +1,81 @@
+// Compiles a plain text lexicon into the memory-mapped format used by
+// libpiper2 (see piper2_lexicon.hpp).
+//
+// Each input line is: word<TAB>phonemes
+// Phonemes are IPA with stress markers, exactly as the voice should receive
+// them. Empty lines and lines starting with # are ignored.
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <unicode/translit.h>
+#include <unicode/unistr.h>
+
+#include "piper2_lexicon.hpp"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <lexicon.tsv> <lexicon.bin>"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ifstream input_file(argv[1]);
+    if (!input_file) {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    // Words must be normalized the same way as the text frontend
+    UErrorCode status = U_ZERO_ERROR;
+    auto transliterator =
+        std::unique_ptr<icu::Transliterator>(icu::Transliterator::createInstance(
+            "NFD; [:Nonspacing Mark:] Remove; NFC", UTRANS_FORWARD, status));
+    if (U_FAILURE(status)) {
+        std::cerr << "Failed to create transliterator" << std::endl;
+        return 1;
+    }
+
+    std::map<std::string, std::string> entries;
+    std::string line;
+    std::size_t line_num = 0;
+    while (std::getline(input_file, line)) {
+        line_num++;
+        if (!line.empty() && (line.back() == '\r')) {
+            line.pop_back();
+        }
+
+        if (line.empty() || (line[0] == '#')) {
+            continue;
+        }
+
+        auto tab_pos = line.find('\t');
+        if ((tab_pos == std::string::npos) || (tab_pos == 0) ||
+            (tab_pos == (line.size() - 1))) {
+            std::cerr << "Skipping bad line " << line_num << ": " << line
+                      << std::endl;
+            continue;
+        }
+
+        auto word_unicode =
+            icu::UnicodeString::fromUTF8(line.substr(0, tab_pos)).toLower();
+        transliterator->transliterate(word_unicode);
+
+        std::string word;
+        word_unicode.toUTF8String(word);
+        entries[word] = line.substr(tab_pos + 1);
+    }
+
+    if (!build_lexicon(entries, argv[2])) {
+        std::cerr << "Failed to write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cerr << "Wrote " << entries.size() << " entries to " << argv[2]
+              << std::endl;
+
+    return 0;
+}
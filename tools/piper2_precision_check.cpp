@@ -0,0 +1,400 @@
+// Compares reduced-precision model variants against the models as given.
+// Synthesizes a corpus with both and reports phoneme mismatches, waveform
+// and spectral drift, and the speedup.
+//
+// Noise is disabled for both so that differences come from precision alone.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <piper2.h>
+
+using Clock = std::chrono::steady_clock;
+
+const double PI = 3.14159265358979323846;
+const std::size_t FFT_SIZE = 1024;
+const std::size_t HOP_SIZE = 256;
+
+// Spectral bins further below a frame's peak are ignored
+const double DYNAMIC_RANGE_DB = 80;
+
+struct SentenceOutput {
+    std::vector<float> samples;
+    std::vector<int> phoneme_ids;
+};
+
+struct CorpusOutput {
+    std::vector<SentenceOutput> sentences;
+    double seconds = 0;
+    double audio_seconds = 0;
+};
+
+static CorpusOutput synthesize_corpus(piper2_synthesizer *synth,
+                                      const std::vector<std::string> &texts) {
+    CorpusOutput output;
+
+    piper2_synthesize_options options =
+        piper2_default_synthesize_options(synth);
+    options.noise_scale = 0;
+    options.noise_w_scale = 0;
+
+    auto start_time = Clock::now();
+    for (auto &text : texts) {
+        piper2_synthesize_start(synth, text.c_str(), &options);
+
+        piper2_audio_chunk chunk;
+        while (piper2_synthesize_next(synth, &chunk) == PIPER2_OK) {
+            SentenceOutput sentence;
+            sentence.samples.assign(chunk.samples,
+                                    chunk.samples + chunk.num_samples);
+            sentence.phoneme_ids.assign(chunk.phoneme_ids,
+                                        chunk.phoneme_ids +
+                                            chunk.num_phoneme_ids);
+            output.sentences.push_back(std::move(sentence));
+
+            if (chunk.sample_rate > 0) {
+                output.audio_seconds +=
+                    (double)chunk.num_samples / chunk.sample_rate;
+            }
+        }
+    }
+    output.seconds =
+        std::chrono::duration<double>(Clock::now() - start_time).count();
+
+    return output;
+}
+
+// Edit distance between phoneme id sequences
+static std::size_t edit_distance(const std::vector<int> &a,
+                                 const std::vector<int> &b) {
+    std::vector<std::size_t> prev_row(b.size() + 1), row(b.size() + 1);
+    for (std::size_t j = 0; j <= b.size(); ++j) {
+        prev_row[j] = j;
+    }
+
+    for (std::size_t i = 1; i <= a.size(); ++i) {
+        row[0] = i;
+        for (std::size_t j = 1; j <= b.size(); ++j) {
+            std::size_t cost = (a[i - 1] == b[j - 1]) ? 0 : 1;
+            row[j] = std::min(
+                {prev_row[j] + 1, row[j - 1] + 1, prev_row[j - 1] + cost});
+        }
+        std::swap(prev_row, row);
+    }
+
+    return prev_row[b.size()];
+}
+
+// In-place radix-2 FFT (size must be a power of 2)
+static void fft(std::vector<std::complex<double>> &values) {
+    std::size_t n = values.size();
+    for (std::size_t i = 1, j = 0; i < n; ++i) {
+        std::size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(values[i], values[j]);
+        }
+    }
+
+    for (std::size_t length = 2; length <= n; length <<= 1) {
+        double angle = -2 * PI / length;
+        std::complex<double> step(std::cos(angle), std::sin(angle));
+        for (std::size_t i = 0; i < n; i += length) {
+            std::complex<double> w(1);
+            for (std::size_t k = 0; k < length / 2; ++k) {
+                auto even = values[i + k];
+                auto odd = values[i + k + (length / 2)] * w;
+                values[i + k] = even + odd;
+                values[i + k + (length / 2)] = even - odd;
+                w *= step;
+            }
+        }
+    }
+}
+
+// Power spectrum of one Hann-windowed frame in dB
+static std::vector<double> frame_spectrum_db(const std::vector<float> &samples,
+                                             std::size_t start) {
+    std::vector<std::complex<double>> values(FFT_SIZE);
+    for (std::size_t i = 0; i < FFT_SIZE; ++i) {
+        double window = 0.5 - (0.5 * std::cos(2 * PI * i / (FFT_SIZE - 1)));
+        values[i] = window * samples[start + i];
+    }
+
+    fft(values);
+
+    std::vector<double> spectrum_db((FFT_SIZE / 2) + 1);
+    for (std::size_t i = 0; i < spectrum_db.size(); ++i) {
+        spectrum_db[i] = 10 * std::log10(std::norm(values[i]) + 1e-10);
+    }
+
+    return spectrum_db;
+}
+
+// Mean log-spectral distance in dB over frames both signals have
+static std::optional<double> log_spectral_distance(const std::vector<float> &a,
+                                                   const std::vector<float> &b) {
+    std::size_t length = std::min(a.size(), b.size());
+    if (length < FFT_SIZE) {
+        return std::nullopt;
+    }
+
+    double total_distance = 0;
+    std::size_t num_frames = 0;
+    for (std::size_t start = 0; (start + FFT_SIZE) <= length;
+         start += HOP_SIZE) {
+        auto spectrum_a = frame_spectrum_db(a, start);
+        auto spectrum_b = frame_spectrum_db(b, start);
+        double floor_db =
+            std::max(*std::max_element(spectrum_a.begin(), spectrum_a.end()),
+                     *std::max_element(spectrum_b.begin(), spectrum_b.end())) -
+            DYNAMIC_RANGE_DB;
+
+        double squared_sum = 0;
+        for (std::size_t i = 0; i < spectrum_a.size(); ++i) {
+            double diff = std::max(spectrum_a[i], floor_db) -
+                          std::max(spectrum_b[i], floor_db);
+            squared_sum += diff * diff;
+        }
+
+        total_distance += std::sqrt(squared_sum / spectrum_a.size());
+        num_frames++;
+    }
+
+    return total_distance / num_frames;
+}
+
+// Signal to noise ratio of b against reference a in dB (same length only)
+static std::optional<double> waveform_snr(const std::vector<float> &a,
+                                          const std::vector<float> &b) {
+    if (a.size() != b.size()) {
+        return std::nullopt;
+    }
+
+    double signal = 0, noise = 0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        signal += (double)a[i] * a[i];
+        noise += ((double)a[i] - b[i]) * ((double)a[i] - b[i]);
+    }
+
+    if (noise <= 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    return 10 * std::log10(signal / noise);
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " --model MODEL [options]" << std::endl
+              << std::endl
+              << "  --model MODEL               voice model" << std::endl
+              << "  --phonemizer MODEL          phonemizer model" << std::endl
+              << "  --stress MODEL              stress model" << std::endl
+              << "  --locale LOCALE             ICU locale (default: en_US)"
+              << std::endl
+              << "  --corpus PATH               one text per line" << std::endl
+              << "  --voice-precision P         voice variant (e.g. int8)"
+              << std::endl
+              << "  --phonemizer-precision P    phonemizer variant"
+              << std::endl
+              << "  --stress-precision P        stress variant" << std::endl;
+}
+
+// Warn if a variant is missing, since the model as given is used instead.
+// Resolved by libpiper2, so this is the file it actually loads.
+static void check_variant(const std::string &model_path,
+                          const std::string &precision) {
+    if (precision.empty()) {
+        return;
+    }
+
+    std::size_t length = piper2_resolve_model_variant(
+        model_path.c_str(), precision.c_str(), nullptr, 0);
+    std::string variant_path(length + 1, '\0');
+    piper2_resolve_model_variant(model_path.c_str(), precision.c_str(),
+                                 &variant_path[0], variant_path.size());
+    variant_path.resize(length);
+
+    if (variant_path == model_path) {
+        std::cerr << "WARNING: no " << precision << " variant of "
+                  << model_path << ", comparing the model with itself"
+                  << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string locale = "en_US";
+    std::string voice_model_path;
+    std::string phonemizer_model_path = "models/en_US-phonemizer.onnx";
+    std::string stress_model_path = "models/en_US-stress.onnx";
+    std::string voice_precision, phonemizer_precision, stress_precision;
+    std::vector<std::string> texts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--model") && has_value) {
+            voice_model_path = argv[++i];
+        } else if ((arg == "--phonemizer") && has_value) {
+            phonemizer_model_path = argv[++i];
+        } else if ((arg == "--stress") && has_value) {
+            stress_model_path = argv[++i];
+        } else if ((arg == "--locale") && has_value) {
+            locale = argv[++i];
+        } else if ((arg == "--corpus") && has_value) {
+            std::ifstream corpus_file(argv[++i]);
+            std::string line;
+            while (std::getline(corpus_file, line)) {
+                if (!line.empty()) {
+                    texts.push_back(line);
+                }
+            }
+        } else if ((arg == "--voice-precision") && has_value) {
+            voice_precision = argv[++i];
+        } else if ((arg == "--phonemizer-precision") && has_value) {
+            phonemizer_precision = argv[++i];
+        } else if ((arg == "--stress-precision") && has_value) {
+            stress_precision = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (voice_model_path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (texts.empty()) {
+        texts.push_back("The quick brown fox jumps over the lazy dog.");
+        texts.push_back("On March 3rd, 2024, 1,250 people visited the museum.");
+        texts.push_back("Can you believe it? She said yes!");
+    }
+
+    check_variant(voice_model_path, voice_precision);
+    check_variant(phonemizer_model_path, phonemizer_precision);
+    check_variant(stress_model_path, stress_precision);
+
+    piper2_create_options variant_options = piper2_default_create_options();
+    variant_options.voice_precision =
+        voice_precision.empty() ? nullptr : voice_precision.c_str();
+    variant_options.phonemizer_precision =
+        phonemizer_precision.empty() ? nullptr : phonemizer_precision.c_str();
+    variant_options.stress_precision =
+        stress_precision.empty() ? nullptr : stress_precision.c_str();
+
+    piper2_synthesizer *reference_synth = piper2_create_phonemizer_stress(
+        locale.c_str(), voice_model_path.c_str(), nullptr,
+        phonemizer_model_path.c_str(), nullptr, stress_model_path.c_str());
+    piper2_synthesizer *variant_synth =
+        piper2_create_phonemizer_stress_with_options(
+            locale.c_str(), voice_model_path.c_str(), nullptr,
+            phonemizer_model_path.c_str(), nullptr, stress_model_path.c_str(),
+            &variant_options);
+    if (!reference_synth || !variant_synth) {
+        std::cerr << "Failed to load models" << std::endl;
+        return 1;
+    }
+
+    // Warm up both, then time each over the whole corpus
+    synthesize_corpus(reference_synth, {texts[0]});
+    synthesize_corpus(variant_synth, {texts[0]});
+
+    CorpusOutput reference = synthesize_corpus(reference_synth, texts);
+    CorpusOutput variant = synthesize_corpus(variant_synth, texts);
+
+    std::size_t num_sentences =
+        std::min(reference.sentences.size(), variant.sentences.size());
+    std::size_t num_phoneme_mismatches = 0;
+    std::size_t total_phoneme_edits = 0, total_phonemes = 0;
+    std::size_t num_length_mismatches = 0;
+    std::size_t num_identical = 0; // infinite SNR, left out of the mean
+    std::vector<double> snrs, spectral_distances;
+
+    for (std::size_t i = 0; i < num_sentences; ++i) {
+        auto &ref_sentence = reference.sentences[i];
+        auto &var_sentence = variant.sentences[i];
+
+        std::size_t edits =
+            edit_distance(ref_sentence.phoneme_ids, var_sentence.phoneme_ids);
+        if (edits > 0) {
+            num_phoneme_mismatches++;
+        }
+        total_phoneme_edits += edits;
+        total_phonemes += ref_sentence.phoneme_ids.size();
+
+        auto snr = waveform_snr(ref_sentence.samples, var_sentence.samples);
+        if (snr && std::isinf(*snr)) {
+            num_identical++;
+        } else if (snr) {
+            snrs.push_back(*snr);
+        } else {
+            num_length_mismatches++;
+        }
+
+        auto distance = log_spectral_distance(ref_sentence.samples,
+                                              var_sentence.samples);
+        if (distance) {
+            spectral_distances.push_back(*distance);
+        }
+    }
+
+    auto mean = [](const std::vector<double> &values) {
+        double total = 0;
+        for (double value : values) {
+            total += value;
+        }
+        return values.empty() ? 0 : (total / values.size());
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "sentences:              " << num_sentences << std::endl;
+    if (reference.sentences.size() != variant.sentences.size()) {
+        std::cout << "sentence count differs: " << reference.sentences.size()
+                  << " vs " << variant.sentences.size() << std::endl;
+    }
+    std::cout << "phoneme mismatches:     " << num_phoneme_mismatches
+              << " sentence(s), "
+              << (total_phonemes > 0
+                      ? (100.0 * total_phoneme_edits / total_phonemes)
+                      : 0)
+              << "% phoneme error rate" << std::endl;
+    std::cout << "waveform SNR:           ";
+    if (snrs.empty()) {
+        std::cout << "n/a";
+    } else {
+        std::cout << mean(snrs) << " dB mean";
+    }
+    std::cout << " over " << snrs.size() << " sentence(s), " << num_identical
+              << " identical, " << num_length_mismatches
+              << " with different lengths" << std::endl;
+    std::cout << "log-spectral distance:  " << mean(spectral_distances)
+              << " dB mean" << std::endl;
+    std::cout << "reference:              " << reference.seconds << " s for "
+              << reference.audio_seconds << " s of audio" << std::endl;
+    std::cout << "variant:                " << variant.seconds << " s for "
+              << variant.audio_seconds << " s of audio" << std::endl;
+    std::cout << "speedup:                "
+              << ((variant.seconds > 0) ? (reference.seconds / variant.seconds)
+                                        : 0)
+              << "x" << std::endl;
+
+    piper2_free(variant_synth);
+    piper2_free(reference_synth);
+
+    return 0;
+}
@@ -0,0 +1,361 @@
+// Replays a capture log (see piper2_capture_open).
+// Re-issues the captured requests through a scheduler at their original
+// arrival times, optionally sped up, and reports latency percentiles and
+// throughput next to the latencies that were captured.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <piper2.h>
+#include <piper2_capture.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+// Voice name for requests whose voice wasn't given with --voice
+const char *DEFAULT_VOICE = "";
+
+struct ReplayResult {
+    double lag_seconds = 0;
+    double first_chunk_seconds = 0;
+    double total_seconds = 0;
+    double audio_seconds = 0;
+    bool submitted = false;
+    bool ok = false;
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    std::size_t idx = (std::size_t)(p * (values.size() - 1));
+    return values[idx];
+}
+
+static void print_latencies(const std::string &name,
+                            const std::vector<double> &latencies) {
+    std::cout << name << " latency (s):"
+              << " p50=" << percentile(latencies, 0.50)
+              << " p90=" << percentile(latencies, 0.90)
+              << " p99=" << percentile(latencies, 0.99)
+              << " max=" << percentile(latencies, 1.0) << std::endl;
+}
+
+// Re-issue a captured request and read its audio. Cancelled requests are
+// cancelled again after the same number of chunks.
+static ReplayResult replay_request(piper2_scheduler *sched,
+                                   piper2_synthesizer *synth,
+                                   const CapturedRequest &captured,
+                                   Clock::time_point scheduled_time) {
+    ReplayResult result;
+
+    piper2_synthesize_options options =
+        piper2_default_synthesize_options(synth);
+    options.speaker_id = captured.speaker_id;
+    options.length_scale = captured.length_scale;
+    options.noise_scale = captured.noise_scale;
+    options.noise_w_scale = captured.noise_w_scale;
+
+    int priority = (captured.priority == CAPTURE_NO_PRIORITY)
+                       ? PIPER2_PRIORITY_NORMAL
+                       : captured.priority;
+
+    auto submit_time = Clock::now();
+    result.lag_seconds =
+        std::chrono::duration<double>(submit_time - scheduled_time).count();
+
+    piper2_request *request = nullptr;
+    if (piper2_scheduler_submit(sched, synth, captured.text.c_str(), &options,
+                                priority, captured.deadline_ms,
+                                &request) != PIPER2_OK) {
+        return result;
+    }
+    result.submitted = true;
+
+    std::size_t max_chunks = (captured.status == CAPTURE_STATUS_CANCELLED)
+                                 ? captured.chunks.size()
+                                 : SIZE_MAX;
+    std::size_t num_chunks = 0;
+    piper2_audio_chunk chunk;
+    int status = PIPER2_OK;
+    while ((num_chunks < max_chunks) &&
+           ((status = piper2_request_next(request, &chunk)) == PIPER2_OK)) {
+        if (num_chunks == 0) {
+            result.first_chunk_seconds =
+                std::chrono::duration<double>(Clock::now() - submit_time)
+                    .count();
+        }
+
+        num_chunks++;
+        if (chunk.sample_rate > 0) {
+            result.audio_seconds +=
+                (double)chunk.num_samples / chunk.sample_rate;
+        }
+    }
+
+    result.total_seconds =
+        std::chrono::duration<double>(Clock::now() - submit_time).count();
+    result.ok = (status == PIPER2_DONE) || (num_chunks >= max_chunks);
+
+    piper2_request_free(request);
+
+    return result;
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " --log PATH [options]" << std::endl
+              << std::endl
+              << "  --log PATH            capture log to replay" << std::endl
+              << "  --voice NAME=MODEL    voice for captured requests to NAME "
+                 "(repeatable)"
+              << std::endl
+              << "  --model MODEL         voice for all other requests"
+              << std::endl
+              << "  --phonemizer MODEL    phonemizer model" << std::endl
+              << "  --stress MODEL        stress model" << std::endl
+              << "  --locale LOCALE       ICU locale (default: en_US)"
+              << std::endl
+              << "  --workers N           synthesis threads (default: all "
+                 "cores)"
+              << std::endl
+              << "  --speed N             replay N times faster, or 0 for as "
+                 "fast as possible (default: 1)"
+              << std::endl
+              << "  --concurrency N       maximum requests in flight "
+                 "(default: 16)"
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string log_path;
+    std::string phonemizer_path = "models/en_US-phonemizer.onnx";
+    std::string stress_path = "models/en_US-stress.onnx";
+    std::string locale = "en_US";
+    std::map<std::string, std::string> voice_paths;
+    double speed = 1.0;
+    std::size_t concurrency = 16;
+    piper2_scheduler_options sched_options = piper2_default_scheduler_options();
+    sched_options.max_queued_sentences = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if ((arg == "--log") && has_value) {
+            log_path = argv[++i];
+        } else if ((arg == "--voice") && has_value) {
+            std::string voice_arg = argv[++i];
+            auto equals_pos = voice_arg.find('=');
+            if ((equals_pos == std::string::npos) || (equals_pos == 0)) {
+                usage(argv[0]);
+                return 1;
+            }
+            voice_paths[voice_arg.substr(0, equals_pos)] =
+                voice_arg.substr(equals_pos + 1);
+        } else if ((arg == "--model") && has_value) {
+            voice_paths[DEFAULT_VOICE] = argv[++i];
+        } else if ((arg == "--phonemizer") && has_value) {
+            phonemizer_path = argv[++i];
+        } else if ((arg == "--stress") && has_value) {
+            stress_path = argv[++i];
+        } else if ((arg == "--locale") && has_value) {
+            locale = argv[++i];
+        } else if ((arg == "--workers") && has_value) {
+            sched_options.num_workers = std::stoul(argv[++i]);
+        } else if ((arg == "--speed") && has_value) {
+            speed = std::stod(argv[++i]);
+        } else if ((arg == "--concurrency") && has_value) {
+            concurrency = std::max<std::size_t>(1, std::stoul(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (log_path.empty() || voice_paths.empty() || (speed < 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto log = read_capture_log(log_path);
+    if (!log) {
+        std::cerr << "Failed to read capture log: " << log_path << std::endl;
+        return 1;
+    }
+
+    const auto &captured = log->requests;
+    if (captured.empty()) {
+        std::cerr << "Capture log is empty" << std::endl;
+        return 1;
+    }
+
+    piper2_registry *registry = piper2_registry_create(0);
+    for (auto &voice_path : voice_paths) {
+        piper2_registry_add_voice(registry, voice_path.first.c_str(),
+                                  locale.c_str(), voice_path.second.c_str(),
+                                  nullptr, phonemizer_path.c_str(), nullptr,
+                                  stress_path.c_str(), nullptr);
+    }
+
+    // Voice for each request, loaded before replaying starts
+    std::vector<piper2_synthesizer *> synths(captured.size(), nullptr);
+    std::map<std::string, piper2_synthesizer *> loaded_voices;
+    std::set<std::string> unknown_voices;
+    for (std::size_t req_idx = 0; req_idx < captured.size(); ++req_idx) {
+        std::string voice = captured[req_idx].voice;
+        if (voice_paths.count(voice) == 0) {
+            if (voice_paths.count(DEFAULT_VOICE) == 0) {
+                unknown_voices.insert(voice);
+                continue;
+            }
+            voice = DEFAULT_VOICE;
+        }
+
+        auto voice_iter = loaded_voices.find(voice);
+        if (voice_iter == loaded_voices.end()) {
+            piper2_synthesizer *synth =
+                piper2_registry_acquire(registry, voice.c_str());
+            if (!synth) {
+                std::cerr << "Failed to load voice: " << voice_paths[voice]
+                          << std::endl;
+                return 1;
+            }
+            voice_iter = loaded_voices.emplace(voice, synth).first;
+        }
+
+        synths[req_idx] = voice_iter->second;
+    }
+
+    for (auto &voice : unknown_voices) {
+        std::cerr << "Skipping requests for unknown voice: " << voice
+                  << std::endl;
+    }
+
+    piper2_scheduler *sched = piper2_scheduler_create(&sched_options);
+    if (!sched) {
+        std::cerr << "Invalid scheduler options" << std::endl;
+        return 1;
+    }
+
+    // Each replay thread takes the next request in arrival order and submits
+    // it at its (scaled) arrival time, so at most concurrency requests are in
+    // flight and requests are delayed when all threads are busy.
+    std::vector<ReplayResult> results(captured.size());
+    std::atomic<std::size_t> next_request{0};
+    uint64_t first_arrival_us = captured.front().arrival_us;
+    auto start_time = Clock::now();
+
+    std::vector<std::thread> threads;
+    for (std::size_t thread_idx = 0; thread_idx < concurrency; ++thread_idx) {
+        threads.emplace_back([&] {
+            std::size_t req_idx = 0;
+            while ((req_idx = next_request++) < captured.size()) {
+                if (!synths[req_idx]) {
+                    continue;
+                }
+
+                auto scheduled_time = start_time;
+                if (speed > 0) {
+                    double offset_seconds =
+                        (captured[req_idx].arrival_us - first_arrival_us) /
+                        1e6 / speed;
+                    scheduled_time +=
+                        std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(offset_seconds));
+                    std::this_thread::sleep_until(scheduled_time);
+                }
+
+                results[req_idx] = replay_request(
+                    sched, synths[req_idx], captured[req_idx], scheduled_time);
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    double wall_seconds =
+        std::chrono::duration<double>(Clock::now() - start_time).count();
+
+    std::vector<double> lags;
+    std::vector<double> first_chunk_latencies;
+    std::vector<double> total_latencies;
+    std::vector<double> captured_first_chunk_latencies;
+    std::vector<double> captured_total_latencies;
+    double audio_seconds = 0;
+    std::size_t num_replayed = 0;
+    std::size_t num_failed = 0;
+    for (std::size_t req_idx = 0; req_idx < captured.size(); ++req_idx) {
+        if (!synths[req_idx]) {
+            continue;
+        }
+
+        num_replayed++;
+        const auto &result = results[req_idx];
+        if (!result.ok) {
+            num_failed++;
+            continue;
+        }
+
+        lags.push_back(result.lag_seconds);
+        if (result.audio_seconds > 0) {
+            first_chunk_latencies.push_back(result.first_chunk_seconds);
+        }
+        total_latencies.push_back(result.total_seconds);
+        audio_seconds += result.audio_seconds;
+
+        const auto &captured_chunks = captured[req_idx].chunks;
+        if ((captured[req_idx].status == CAPTURE_STATUS_DONE) &&
+            !captured_chunks.empty()) {
+            captured_first_chunk_latencies.push_back(
+                captured_chunks.front().ready_us / 1e6);
+            captured_total_latencies.push_back(captured_chunks.back().ready_us /
+                                               1e6);
+        }
+    }
+
+    double captured_seconds =
+        (captured.back().arrival_us - first_arrival_us) / 1e6;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "requests: " << num_replayed << " (" << num_failed
+              << " failed, " << (captured.size() - num_replayed)
+              << " skipped)" << std::endl;
+    std::cout << "captured span: " << captured_seconds << " s, speed: ";
+    if (speed > 0) {
+        std::cout << speed << "x" << std::endl;
+    } else {
+        std::cout << "max" << std::endl;
+    }
+    std::cout << "wall time: " << wall_seconds << " s" << std::endl;
+    std::cout << "throughput: " << (total_latencies.size() / wall_seconds)
+              << " requests/s, " << (audio_seconds / wall_seconds)
+              << " audio s/s" << std::endl;
+
+    print_latencies("submit lag", lags);
+    print_latencies("first chunk", first_chunk_latencies);
+    print_latencies("total", total_latencies);
+    if (!captured_total_latencies.empty()) {
+        print_latencies("captured first chunk", captured_first_chunk_latencies);
+        print_latencies("captured total", captured_total_latencies);
+    }
+
+    piper2_scheduler_free(sched);
+    for (auto &voice : loaded_voices) {
+        piper2_registry_release(registry, voice.second);
+    }
+    piper2_registry_free(registry);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+// Reads audio from a shared-memory ring and writes raw float32 samples to
+// stdout until the producer closes the ring.
+// Example consumer for piper2_ring.h.
+
+#include <cstdio>
+#include <iostream>
+
+#include <piper2_ring.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " /SHM_NAME" << std::endl;
+        return 1;
+    }
+
+    piper2_ring *ring = piper2_ring_open(argv[1]);
+    if (!ring) {
+        std::cerr << "Failed to open ring: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const piper2_ring_header *header = piper2_ring_get_header(ring);
+    while (piper2_ring_wait(ring, -1) == PIPER2_OK) {
+        // Samples are read in place from shared memory
+        const float *samples = nullptr;
+        std::size_t num_samples = piper2_ring_peek(ring, &samples);
+        std::fwrite(samples, sizeof(float), num_samples, stdout);
+        piper2_ring_consume(ring, num_samples);
+    }
+    std::fflush(stdout);
+
+    std::cerr << "Read " << header->write_seq << " chunk(s) at "
+              << header->sample_rate << "Hz" << std::endl;
+
+    piper2_ring_free(ring);
+
+    return 0;
+}